@@ -0,0 +1,180 @@
+#ifndef ARENAH
+#define ARENAH
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "debug.h"
+
+// Linear allocator for temporaries. Allocating bumps a pointer, nothing is
+// freed on its own, arena_reset or arena_pop_to give everything back at
+// once. When a block runs out a bigger one is chained on, resetting keeps
+// only the newest and biggest block, so after a few frames every frame
+// fits in one block and never reaches malloc.
+//
+// The editor's frame_arena (main.c) is reset at the end of every frame.
+// arena_thread_scratch is one arena per thread, used through
+// arena_mark/arena_pop_to around a piece of work.
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_DEFAULT_BLOCK_SIZE (64 * 1024)
+
+
+typedef struct ArenaBlock
+{
+    ArenaBlock* previous;
+    size_t capacity;
+    size_t used;
+    size_t padding;  // keeps the data after the header aligned
+} ArenaBlock;
+
+
+typedef struct Arena
+{
+    ArenaBlock* block;
+    DebugArenaStats stats;
+} Arena;
+
+
+typedef struct ArenaMark
+{
+    ArenaBlock* block;
+    size_t block_used;
+    size_t used;
+} ArenaMark;
+
+
+ArenaBlock* arena_new_block(ArenaBlock* previous, size_t capacity)
+{
+    ArenaBlock* block = (ArenaBlock*)malloc(sizeof(ArenaBlock) + capacity);
+    block->previous = previous;
+    block->capacity = capacity;
+    block->used = 0;
+    return block;
+}
+
+
+void arena_init(Arena &arena, const char* name, size_t block_size)
+{
+    arena.block = arena_new_block(NULL, block_size);
+    arena.stats = {};
+    arena.stats.name = name;
+    arena.stats.capacity = block_size;
+    arena.stats.block_count = 1;
+    debug_register_arena(&arena.stats);
+}
+
+
+void arena_free(Arena &arena)
+{
+    debug_unregister_arena(&arena.stats);
+    ArenaBlock* block = arena.block;
+    while (block)
+    {
+        ArenaBlock* previous = block->previous;
+        free(block);
+        block = previous;
+    }
+    arena.block = NULL;
+}
+
+
+// Uninitialized memory, valid until the arena is reset or popped past it
+void* arena_alloc(Arena &arena, size_t size)
+{
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    ArenaBlock* block = arena.block;
+    if (block->used + size > block->capacity)
+    {
+        size_t capacity = block->capacity * 2;
+        if (capacity < size)
+            capacity = size;
+        block = arena_new_block(block, capacity);
+        arena.block = block;
+        arena.stats.capacity += capacity;
+        arena.stats.block_count++;
+    }
+
+    void* result = (byte*)(block + 1) + block->used;
+    block->used += size;
+    arena.stats.used += size;
+    if (arena.stats.used > arena.stats.high_water)
+        arena.stats.high_water = arena.stats.used;
+    return result;
+}
+
+
+void* arena_alloc_zero(Arena &arena, size_t size)
+{
+    void* result = arena_alloc(arena, size);
+    memset(result, 0, size);
+    return result;
+}
+
+
+// Frees the blocks newer than keep
+void arena_free_blocks_after(Arena &arena, ArenaBlock* keep)
+{
+    while (arena.block != keep)
+    {
+        ArenaBlock* previous = arena.block->previous;
+        arena.stats.capacity -= arena.block->capacity;
+        arena.stats.block_count--;
+        free(arena.block);
+        arena.block = previous;
+    }
+}
+
+
+// Gives back everything, keeps the biggest block for the next round
+void arena_reset(Arena &arena)
+{
+    ArenaBlock* block = arena.block;
+    while (block->previous)
+    {
+        ArenaBlock* previous = block->previous;
+        arena.stats.capacity -= previous->capacity;
+        arena.stats.block_count--;
+        block->previous = previous->previous;
+        free(previous);
+    }
+    block->used = 0;
+    arena.stats.used = 0;
+    arena.stats.reset_count++;
+}
+
+
+ArenaMark arena_mark(Arena &arena)
+{
+    ArenaMark mark;
+    mark.block = arena.block;
+    mark.block_used = arena.block->used;
+    mark.used = arena.stats.used;
+    return mark;
+}
+
+
+// Gives back everything allocated since the mark
+void arena_pop_to(Arena &arena, ArenaMark mark)
+{
+    arena_free_blocks_after(arena, mark.block);
+    arena.block->used = mark.block_used;
+    arena.stats.used = mark.used;
+}
+
+
+static thread_local Arena thread_scratch_arena;
+
+
+// The calling thread's scratch arena, created on first use
+// NOTE(kk): Threads that exit have to call arena_free on it themselves
+Arena& arena_thread_scratch()
+{
+    if (!thread_scratch_arena.block)
+        arena_init(thread_scratch_arena, "thread scratch", ARENA_DEFAULT_BLOCK_SIZE);
+    return thread_scratch_arena;
+}
+
+#endif // ARENAH
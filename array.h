@@ -15,7 +15,7 @@ typedef struct Array
     u32 max_element_count;
     resize_callback *resize_func;
 
-    u32 _block_size;
+    size_t _block_size;
     byte* base_ptr;
     byte* _head_ptr;
 } Array;
@@ -26,8 +26,9 @@ void array_init(Array &arr, u32 element_size, u32 max_element_count)
     arr.element_count = 0;
     arr.element_size = element_size;
     arr.max_element_count = max_element_count;
-    arr._block_size = arr.element_size * arr.max_element_count;
-    arr.base_ptr = (byte*) calloc(arr.max_element_count, arr._block_size);
+    arr.resize_func = NULL;
+    arr._block_size = (size_t)arr.element_size * arr.max_element_count;
+    arr.base_ptr = (byte*) calloc(arr.max_element_count, arr.element_size);
     arr._head_ptr = arr.base_ptr;
 }
 
@@ -37,40 +38,71 @@ void array_realloc(Array& arr, size_t new_size)
     arr.base_ptr = (byte*)realloc(arr.base_ptr, new_size);
     arr._block_size = new_size;
     arr.max_element_count = new_size / arr.element_size;
-    arr._head_ptr = arr.base_ptr + arr.element_size * arr.element_count;
-    print("Block size %u, element count: %u, new max acount: %u",
-          arr._block_size, arr.element_count, arr.max_element_count);
+    arr._head_ptr = arr.base_ptr + (size_t)arr.element_size * arr.element_count;
 }
 
 
 void array_resize_noop() {}
 
 
+// Makes room for max_element_count elements without growing again
+void array_reserve(Array& arr, u32 max_element_count)
+{
+    if (max_element_count > arr.max_element_count)
+        array_realloc(arr, (size_t)max_element_count * arr.element_size);
+}
+
+
+// Grows to fit count more elements. Capacity doubles, or follows
+// resize_func when set, so appends are amortized O(1).
+void array_grow(Array& arr, u32 count)
+{
+    u32 needed = arr.element_count + count;
+    if (needed <= arr.max_element_count)
+        return;
+
+    size_t new_size = arr.resize_func ? arr.resize_func(&arr) : (size_t)arr.max_element_count * 2 * arr.element_size;
+    size_t needed_size = (size_t)needed * arr.element_size;
+    size_t min_size = 16 * (size_t)arr.element_size;
+    if (new_size < needed_size)
+        new_size = needed_size;
+    if (new_size < min_size)
+        new_size = min_size;
+    array_realloc(arr, new_size);
+}
+
+
+// Makes the array hold count elements, growing the buffer when needed. The
+// new elements are left for the caller to fill in place.
+void array_resize(Array& arr, u32 count)
+{
+    array_reserve(arr, count);
+    arr.element_count = count;
+    arr._head_ptr = arr.base_ptr + (size_t)arr.element_size * count;
+}
+
+
+// Gives back the memory past the last element
+void array_shrink_to_fit(Array& arr)
+{
+    u32 count = arr.element_count > 0 ? arr.element_count : 1;
+    if (count < arr.max_element_count)
+        array_realloc(arr, (size_t)count * arr.element_size);
+}
+
+
 bool array_check_bounds(Array& arr, u32 count)
 {
-    if (arr.element_count + count > arr.max_element_count)
-    {
-        print("Not enough memory to perform addition.");
-        return false;
-    }
-    return true;
+    return arr.element_count + count <= arr.max_element_count;
 }
 
 
 void array_extend(Array& arr, void* elements, u32 count)
 {
-    if(array_check_bounds(arr, count))
-    {
-        memcpy((void*)arr._head_ptr, elements, arr.element_size * count);
-        arr._head_ptr += arr.element_size * count;
-        arr.element_count += count;
-    }
-    else
-    {
-        //size_t new_size = arr.resize_func(&arr);
-        size_t new_size = arr._block_size * 2;
-        array_realloc(arr, new_size);
-    }
+    array_grow(arr, count);
+    memcpy((void*)arr._head_ptr, elements, (size_t)arr.element_size * count);
+    arr._head_ptr += (size_t)arr.element_size * count;
+    arr.element_count += count;
 }
 
 
@@ -80,21 +112,33 @@ void array_append(Array& arr, void* element)
 }
 
 
+// Appends one element for the caller to fill in place and returns it, the
+// pointer stays valid until the array grows again
+void* array_push(Array& arr)
+{
+    array_grow(arr, 1);
+    void* element = arr._head_ptr;
+    arr._head_ptr += arr.element_size;
+    arr.element_count++;
+    return element;
+}
+
+
+// Removes the last element and returns it, the pointer stays valid until
+// the next append
 void* array_pop(Array& arr)
 {
     if (arr.element_count > 0)
     {
-        void* addr = arr._head_ptr;
         arr.element_count--;
         arr._head_ptr -= arr.element_size;
-        return addr;
-        //u32 byte_offset = arr.element_size * ;
-        //return (void*) (arr.base_ptr + byte_offset);
+        return arr._head_ptr;
     }
     return NULL;
 }
 
 
+// Overwrites the element at index
 void array_insert(Array& arr, void* element, u32 index)
 {
     u32 byte_offset = index * arr.element_size;
@@ -104,21 +148,64 @@ void array_insert(Array& arr, void* element, u32 index)
 
 void* array_get_index(Array& arr, u32 index)
 {
-    u32 byte_offset = arr.element_size * index;
+    size_t byte_offset = (size_t)arr.element_size * index;
     return (void*) (arr.base_ptr + byte_offset);
 }
 
 
+// Empties the array and keeps its memory
 void array_clear(Array& arr)
 {
-    free(arr.base_ptr);
-    array_init(arr, arr.element_size, arr.max_element_count);
+    arr.element_count = 0;
+    arr._head_ptr = arr.base_ptr;
 }
 
 
 void array_free(Array& arr)
 {
     free(arr.base_ptr);
+    arr.base_ptr = NULL;
+    arr._head_ptr = NULL;
+    arr.element_count = 0;
+    arr.max_element_count = 0;
+    arr._block_size = 0;
 }
-#endif // ARRAYH
 
+
+// Typed view over the byte based API, for code that wants arr[i] instead
+// of casting array_get_index. The Array stays usable with the functions
+// above.
+template <typename T>
+struct TypedArray
+{
+    Array array;
+
+    T& operator[](u32 index) { return ((T*)array.base_ptr)[index]; }
+    T* begin() { return (T*)array.base_ptr; }
+    T* end() { return (T*)array.base_ptr + array.element_count; }
+    u32 count() { return array.element_count; }
+};
+
+
+template <typename T>
+void typed_array_init(TypedArray<T>& arr, u32 max_element_count)
+{
+    array_init(arr.array, sizeof(T), max_element_count);
+}
+
+
+template <typename T>
+T& typed_array_append(TypedArray<T>& arr, const T& element)
+{
+    T* slot = (T*)array_push(arr.array);
+    *slot = element;
+    return *slot;
+}
+
+
+template <typename T>
+void typed_array_free(TypedArray<T>& arr)
+{
+    array_free(arr.array);
+}
+#endif // ARRAYH
@@ -0,0 +1,92 @@
+#ifndef ASSETREGISTRYH
+#define ASSETREGISTRYH
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "hashmap.h"
+#include "io/meshcache.h"
+#include "io/objloader.h"
+
+// Loaded geometry shared by name. Files are looked up by path first and by
+// content hash second, so copies of one file under different names are
+// also loaded and uploaded once. Procedural meshes register under a name
+// of their own, see cube_create_mesh.
+// NOTE(kk): Entries are never removed, a geometry nobody uses only gives
+// up its GPU buffers and is uploaded again by the next mesh_create.
+
+typedef struct AssetRegistry
+{
+    HashMap by_name;          // path or name -> MeshGeometry*
+    HashMap by_content_hash;  // file content hash -> MeshGeometry*
+    bool initialized;
+} AssetRegistry;
+
+static AssetRegistry asset_registry;
+
+
+void asset_registry_init(AssetRegistry &registry)
+{
+    if (registry.initialized)
+        return;
+    hashmap_init(registry.by_name, HASHMAP_KEY_STRING, sizeof(MeshGeometry*), 64);
+    hashmap_init(registry.by_content_hash, HASHMAP_KEY_U64, sizeof(MeshGeometry*), 64);
+    registry.initialized = true;
+}
+
+
+MeshGeometry* asset_registry_find(const char* name)
+{
+    asset_registry_init(asset_registry);
+    MeshGeometry** geometry = (MeshGeometry**)hashmap_get_string(asset_registry.by_name, name);
+    return geometry ? *geometry : NULL;
+}
+
+
+void asset_registry_add(const char* name, MeshGeometry* geometry)
+{
+    asset_registry_init(asset_registry);
+    const char* key = strdup(name);
+    hashmap_put_string(asset_registry.by_name, key, &geometry);
+}
+
+
+// Geometry of the OBJ file, loaded on first use. Returns geometry without
+// vertices when the file can't be loaded, that one isn't registered.
+MeshGeometry* asset_registry_load_obj(const char* file_path)
+{
+    MeshGeometry* geometry = asset_registry_find(file_path);
+    if (geometry)
+        return geometry;
+
+    u64 content_hash;
+    bool hashed = meshcache_hash_file(file_path, content_hash);
+    if (hashed)
+    {
+        MeshGeometry** shared = (MeshGeometry**)hashmap_get(asset_registry.by_content_hash, content_hash);
+        if (shared)
+        {
+            asset_registry_add(file_path, *shared);
+            return *shared;
+        }
+    }
+
+    geometry = objloader_create_geometry(file_path);
+    if (!hashed || geometry->vertex_array_length == 0)
+        return geometry;
+
+    asset_registry_add(file_path, geometry);
+    hashmap_put(asset_registry.by_content_hash, content_hash, &geometry);
+    return geometry;
+}
+
+
+// New mesh of the OBJ file at the origin, every mesh of the same file
+// shares one geometry
+Mesh asset_registry_create_mesh(const char* file_path)
+{
+    return mesh_create(asset_registry_load_obj(file_path));
+}
+
+#endif // ASSETREGISTRYH
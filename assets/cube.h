@@ -82,15 +82,18 @@ static GLfloat cube_colors[] = {
 };
 
 
+// Every cube shares one geometry
 Mesh cube_create_mesh()
 {
-    Mesh mesh;
-    mesh.vertex_array_length = sizeof(cube_vertices) / sizeof(*cube_vertices);
-    mesh.vertex_positions = cube_vertices;
-    mesh.vertex_colors = cube_colors;
-    mesh.vertex_normals = NULL;
-    mesh.model_matrix  = glm::mat4(1.0);
-    return mesh;
+    MeshGeometry* geometry = asset_registry_find("cube");
+    if (!geometry)
+    {
+        geometry = mesh_geometry_create(cube_vertices, cube_colors, NULL,
+                                        sizeof(cube_vertices) / sizeof(*cube_vertices),
+                                        NULL, 0, 3);
+        asset_registry_add("cube", geometry);
+    }
+    return mesh_create(geometry);
 }
 
 
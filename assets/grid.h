@@ -58,13 +58,10 @@ Mesh grid_create_mesh()
         grid_color[i + 5] = 0.7f;
     }
 
-    Mesh grid_mesh;
-    grid_mesh.vertex_positions = grid_verts;
-    grid_mesh.vertex_colors = grid_color;
-    grid_mesh.vertex_normals = NULL;
-    grid_mesh.vertex_array_length = sizeof(grid_verts) / sizeof(GLfloat);
-    grid_mesh.model_matrix = glm::mat4(1.0);
-    return grid_mesh;
+    MeshGeometry* geometry = mesh_geometry_create(grid_verts, grid_color, NULL,
+                                                  sizeof(grid_verts) / sizeof(GLfloat),
+                                                  NULL, 0, 3);
+    return mesh_create(geometry);
 }
 
 #endif // GRIDH
@@ -0,0 +1,169 @@
+// Array append microbenchmark. Appends floats the way the OBJ loader fills
+// its vertex arrays, one at a time and three at a time, through the byte
+// based API, through TypedArray and into an array reserved and touched up
+// front.
+// Results go to stdout.
+//
+// bench_array [options]
+//   -n, --count n   floats appended per run (default 30000000)
+//   --repeats n     runs per method, the fastest counts (default 5)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "types.h"
+#include "debug.h"
+#include "array.h"
+
+
+double bench_now()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1000000000.0;
+}
+
+
+void print_usage()
+{
+    printf("Usage: bench_array [-n count] [--repeats n]\n");
+}
+
+
+double bench_append(u32 count, float &checksum)
+{
+    Array arr;
+    array_init(arr, sizeof(float), 16);
+    double start = bench_now();
+    for (u32 i=0; i < count; ++i)
+    {
+        float value = (float)i;
+        array_append(arr, &value);
+    }
+    double seconds = bench_now() - start;
+    checksum += *(float*)array_get_index(arr, count - 1);
+    array_free(arr);
+    return seconds;
+}
+
+
+double bench_extend3(u32 count, float &checksum)
+{
+    Array arr;
+    array_init(arr, sizeof(float), 16);
+    double start = bench_now();
+    for (u32 i=0; i + 3 <= count; i += 3)
+    {
+        float vertex[3] = {(float)i, (float)(i + 1), (float)(i + 2)};
+        array_extend(arr, vertex, 3);
+    }
+    double seconds = bench_now() - start;
+    checksum += *(float*)array_get_index(arr, arr.element_count - 1);
+    array_free(arr);
+    return seconds;
+}
+
+
+double bench_typed_append(u32 count, float &checksum)
+{
+    TypedArray<float> arr;
+    typed_array_init(arr, 16);
+    double start = bench_now();
+    for (u32 i=0; i < count; ++i)
+    {
+        typed_array_append(arr, (float)i);
+    }
+    double seconds = bench_now() - start;
+    checksum += arr[count - 1];
+    typed_array_free(arr);
+    return seconds;
+}
+
+
+double bench_reserved_append(u32 count, float &checksum)
+{
+    Array arr;
+    array_init(arr, sizeof(float), 16);
+    // NOTE(kk): Touched up front, otherwise the first use page faults
+    // cost as much as the copies reserving saves
+    array_reserve(arr, count);
+    memset(arr.base_ptr, 0, (size_t)count * sizeof(float));
+    double start = bench_now();
+    for (u32 i=0; i < count; ++i)
+    {
+        float value = (float)i;
+        array_append(arr, &value);
+    }
+    double seconds = bench_now() - start;
+    checksum += *(float*)array_get_index(arr, count - 1);
+    array_free(arr);
+    return seconds;
+}
+
+
+typedef double bench_func(u32 count, float &checksum);
+
+typedef struct BenchMethod
+{
+    const char* name;
+    bench_func* func;
+} BenchMethod;
+
+static BenchMethod bench_methods[] = {
+    {"array_append", bench_append},
+    {"array_extend x3", bench_extend3},
+    {"typed_array_append", bench_typed_append},
+    {"reserved append", bench_reserved_append},
+};
+#define BENCH_METHOD_COUNT (sizeof(bench_methods) / sizeof(*bench_methods))
+
+
+int main(int argc, char** argv)
+{
+    u32 count = 30000000;
+    u32 repeat_count = 5;
+    for (int i=1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if ((strcmp(arg, "-n") == 0 || strcmp(arg, "--count") == 0) && value)
+            count = strtoul(value, NULL, 10);
+        else if (strcmp(arg, "--repeats") == 0 && value)
+            repeat_count = strtoul(value, NULL, 10);
+        else
+        {
+            print_usage();
+            return 1;
+        }
+        i++;
+    }
+
+    if (count < 3 || repeat_count == 0)
+    {
+        print_usage();
+        return 1;
+    }
+
+    double best_seconds[BENCH_METHOD_COUNT];
+    float checksum = 0;
+    for (u32 i=0; i < BENCH_METHOD_COUNT; ++i)
+    {
+        best_seconds[i] = 0;
+        for (u32 j=0; j < repeat_count; ++j)
+        {
+            double seconds = bench_methods[i].func(count, checksum);
+            if (j == 0 || seconds < best_seconds[i])
+                best_seconds[i] = seconds;
+        }
+    }
+
+    printf("%u floats, best of %u runs (checksum %g)\n", count, repeat_count, checksum);
+    for (u32 i=0; i < BENCH_METHOD_COUNT; ++i)
+    {
+        printf("%-20s %8.2f ms  %6.2f ns/float\n", bench_methods[i].name,
+               best_seconds[i] * 1000.0, best_seconds[i] * 1000000000.0 / count);
+    }
+    return 0;
+}
@@ -0,0 +1,278 @@
+// Bounding box batch benchmark and check. Draws the boxes of a scattered
+// set of rotated cubes once through one BBoxBatch call and once a
+// bbox_batch_draw per box, and prints both times. Checks that:
+//   the pixels of both ways are identical,
+//   every projected box corner inside the view was drawn,
+//   the batch holds the same GL objects over all frames and none are left
+//   after bbox_batch_free (DEBUG builds, which count them).
+// Runs without a window on a surfaceless EGL context, e.g. Mesa llvmpipe
+// with LIBGL_ALWAYS_SOFTWARE=1. Exits with 1 when a check fails.
+//
+// bench_bbox [options]
+//   -n, --boxes n     boxes per frame (default 1024)
+//   --frames n        frames per way (default 100)
+//   -w, --width n     framebuffer width (default 256)
+//   -h, --height n    framebuffer height (default 256)
+//   --seed n          xorshift32 seed of the scene (default 10)
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <cmath>
+#include <limits.h>
+#include <pthread.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include "types.h"
+#include "debug.h"
+#include "bench_gl.h"
+#include "ray.c"
+#include "bvh.h"
+#include "camera.h"
+#include "array.h"
+#include "mesh.c"
+#include "shader.h"
+
+#include "io/objloader.h"
+#include "asset_registry.h"
+
+#include "assets/cube.h"
+
+
+void print_usage()
+{
+    printf("Usage: bench_bbox [-n boxes] [--frames n] [-w width] [-h height] [--seed n]\n");
+}
+
+
+float bench_random(xorshift32_state &state)
+{
+    return xorshift32(&state) / float(UINT_MAX);
+}
+
+
+void bench_read_pixels(u8* pixels, u32 width, u32 height)
+{
+    glFinish();
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+}
+
+
+// NOTE(kk): A line doesn't always light the pixel its end falls in, one
+// of the 3x3 around it counts
+bool bench_pixel_drawn(u8* pixels, u32 width, u32 height, int x, int y)
+{
+    for (int dy=-1; dy <= 1; ++dy)
+    {
+        for (int dx=-1; dx <= 1; ++dx)
+        {
+            int px = x + dx;
+            int py = y + dy;
+            if (px < 0 || py < 0 || px >= (int)width || py >= (int)height)
+                continue;
+            if (pixels[(py * width + px) * 4] != 0)
+                return true;
+        }
+    }
+    return false;
+}
+
+
+// Box corners in front of the camera and a pixel away from the edges that
+// have nothing drawn around them
+u32 bench_check_corners(Mesh* meshes, u32 box_count, glm::mat4 vp, u8* pixels, u32 width, u32 height)
+{
+    u32 missing_count = 0;
+    for (u32 i=0; i < box_count; ++i)
+    {
+        float* bbox = meshes[i].geometry->bbox;
+        for (u32 corner=0; corner < 8; ++corner)
+        {
+            glm::vec4 position = glm::vec4(bbox[(corner & 1) ? 3 : 0],
+                                           bbox[(corner & 2) ? 4 : 1],
+                                           bbox[(corner & 4) ? 5 : 2], 1.0f);
+            glm::vec4 clip = vp * meshes[i].model_matrix * position;
+            if (clip.w <= 0.0f)
+                continue;
+
+            float x = (clip.x / clip.w * 0.5f + 0.5f) * width;
+            float y = (clip.y / clip.w * 0.5f + 0.5f) * height;
+            if (x < 1.0f || y < 1.0f || x > width - 1.0f || y > height - 1.0f)
+                continue;
+            if (!bench_pixel_drawn(pixels, width, height, (int)x, (int)y))
+                missing_count++;
+        }
+    }
+    return missing_count;
+}
+
+
+int main(int argc, char** argv)
+{
+    u32 box_count = 1024;
+    u32 frame_count = 100;
+    u32 width = 256;
+    u32 height = 256;
+    u32 seed = 10;
+    for (int i=1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if ((strcmp(arg, "-n") == 0 || strcmp(arg, "--boxes") == 0) && value)
+            box_count = strtoul(value, NULL, 10);
+        else if (strcmp(arg, "--frames") == 0 && value)
+            frame_count = strtoul(value, NULL, 10);
+        else if ((strcmp(arg, "-w") == 0 || strcmp(arg, "--width") == 0) && value)
+            width = strtoul(value, NULL, 10);
+        else if ((strcmp(arg, "-h") == 0 || strcmp(arg, "--height") == 0) && value)
+            height = strtoul(value, NULL, 10);
+        else if (strcmp(arg, "--seed") == 0 && value)
+            seed = strtoul(value, NULL, 10);
+        else
+        {
+            print_usage();
+            return 1;
+        }
+        i++;
+    }
+
+    // xorshift32 never leaves zero
+    if (box_count == 0 || frame_count == 0 || width == 0 || height == 0 || seed == 0)
+    {
+        print_usage();
+        return 1;
+    }
+
+    if (!bench_create_context())
+    {
+        printf("Can't create a GL context\n");
+        return 1;
+    }
+    printf("%s, %s\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+    bench_create_framebuffer(width, height);
+    // Every box is the same color, without depth testing the order they
+    // are drawn in doesn't change a pixel
+    glDisable(GL_DEPTH_TEST);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    GLuint program = create_shader("shaders/bbox.vert", "shaders/default.frag");
+    MeshGeometry* geometry = mesh_geometry_create(cube_vertices, cube_colors, NULL,
+                                                  sizeof(cube_vertices) / sizeof(*cube_vertices),
+                                                  NULL, 0, 3);
+
+    // Rotated and scaled cubes scattered in front of the camera, some
+    // reaching past the edges of the view
+    xorshift32_state state;
+    state.a = seed;
+    Mesh* meshes = (Mesh*)malloc(box_count * sizeof(Mesh));
+    for (u32 i=0; i < box_count; ++i)
+    {
+        meshes[i] = mesh_create(geometry);
+        glm::vec3 position = glm::vec3(bench_random(state) * 24.0f - 12.0f,
+                                       bench_random(state) * 24.0f - 12.0f,
+                                       bench_random(state) * -10.0f);
+        glm::vec3 axis = glm::vec3(bench_random(state) - 0.5f, bench_random(state) - 0.5f, 0.25f);
+        glm::mat4 model_matrix = glm::translate(glm::mat4(1.0f), position);
+        model_matrix = glm::rotate(model_matrix, bench_random(state) * 6.0f, glm::normalize(axis));
+        meshes[i].model_matrix = glm::scale(model_matrix, glm::vec3(0.2f + bench_random(state)));
+    }
+
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)width / height, 0.1f, 100.0f);
+    glm::mat4 vp = projection * glm::lookAt(glm::vec3(0.0f, 0.0f, 25.0f), glm::vec3(0.0f), glm::vec3(0, 1, 0));
+
+    u32 pixel_size = width * height * 4;
+    u8* batched_pixels = (u8*)malloc(pixel_size);
+    u8* single_pixels = (u8*)malloc(pixel_size);
+
+#ifdef DEBUG
+    DebugAllocTotals before_totals = debug_alloc_totals();
+#endif
+    BBoxBatch batch;
+    bbox_batch_init(batch);
+#ifdef DEBUG
+    DebugAllocTotals init_totals = debug_alloc_totals();
+#endif
+
+    // One call for all boxes. The first frames draw fewer boxes so the
+    // instance buffer grows in between.
+    u32 leaked_frames = 0;
+    double start_time = bench_now();
+    for (u32 frame=0; frame < frame_count; ++frame)
+    {
+        glClear(GL_COLOR_BUFFER_BIT);
+        u32 frame_box_count = frame < 3 ? box_count >> (3 - frame) : box_count;
+        for (u32 i=0; i < frame_box_count; ++i)
+        {
+            bbox_batch_add(batch, meshes[i]);
+        }
+        bbox_batch_draw(batch, program, vp);
+#ifdef DEBUG
+        DebugAllocTotals totals = debug_alloc_totals();
+        if (totals.live_count[DEBUG_ALLOC_GL_BUFFER] != init_totals.live_count[DEBUG_ALLOC_GL_BUFFER] ||
+            totals.live_count[DEBUG_ALLOC_GL_VERTEX_ARRAY] != init_totals.live_count[DEBUG_ALLOC_GL_VERTEX_ARRAY])
+            leaked_frames++;
+#endif
+    }
+    bench_read_pixels(batched_pixels, width, height);
+    double batched_time = (bench_now() - start_time) * 1000.0 / frame_count;
+
+    // The same boxes a call each
+    start_time = bench_now();
+    for (u32 frame=0; frame < frame_count; ++frame)
+    {
+        glClear(GL_COLOR_BUFFER_BIT);
+        for (u32 i=0; i < box_count; ++i)
+        {
+            bbox_batch_add(batch, meshes[i]);
+            bbox_batch_draw(batch, program, vp);
+        }
+    }
+    bench_read_pixels(single_pixels, width, height);
+    double single_time = (bench_now() - start_time) * 1000.0 / frame_count;
+
+    bbox_batch_free(batch);
+
+    u32 drawn_count = 0;
+    u32 differing_count = 0;
+    for (u32 i=0; i < pixel_size; i += 4)
+    {
+        if (batched_pixels[i] != 0)
+            drawn_count++;
+        if (memcmp(batched_pixels + i, single_pixels + i, 4) != 0)
+            differing_count++;
+    }
+    u32 missing_count = bench_check_corners(meshes, box_count, vp, batched_pixels, width, height);
+
+    printf("%u boxes, %u frames, %ux%u\n", box_count, frame_count, width, height);
+    printf("batched        %8.3f ms/frame\n", batched_time);
+    printf("box by box     %8.3f ms/frame\n", single_time);
+    printf("%u pixels drawn, %u differ, %u corners missing\n", drawn_count, differing_count, missing_count);
+
+    bool failed = drawn_count == 0 || differing_count != 0 || missing_count != 0;
+#ifdef DEBUG
+    DebugAllocTotals after_totals = debug_alloc_totals();
+    u64 leaked_buffers = after_totals.live_count[DEBUG_ALLOC_GL_BUFFER] - before_totals.live_count[DEBUG_ALLOC_GL_BUFFER];
+    u64 leaked_arrays = after_totals.live_count[DEBUG_ALLOC_GL_VERTEX_ARRAY] - before_totals.live_count[DEBUG_ALLOC_GL_VERTEX_ARRAY];
+    printf("%u frames with other GL objects, %lu buffers and %lu vertex arrays left after free\n",
+           leaked_frames, (unsigned long)leaked_buffers, (unsigned long)leaked_arrays);
+    failed = failed || leaked_frames != 0 || leaked_buffers != 0 || leaked_arrays != 0;
+#endif
+    if (glGetError() != GL_NO_ERROR)
+    {
+        printf("GL error\n");
+        failed = true;
+    }
+    printf("%s\n", failed ? "FAILED" : "ok");
+
+    free(batched_pixels);
+    free(single_pixels);
+    free(meshes);
+    return failed ? 1 : 0;
+}
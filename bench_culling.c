@@ -0,0 +1,146 @@
+// Frustum culling benchmark. Spawns cubes on the radius 100 sphere like the
+// editor's cube_create_random_on_sphere, looks at them from the editor's
+// start camera and times the culler's box updates and frustum tests. Every
+// result is checked against frustum_test_box on each box.
+//
+// bench_culling [options]
+//   --cubes n      cube instances (default 100000)
+//   --seed n       xorshift32 seed of the cube positions (default 10)
+//   --frames n     culled frames, the camera turns a little each (default 100)
+
+#define HEADLESS
+
+#include <cmath>
+#include <limits.h>
+#include <pthread.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include "types.h"
+#include "debug.h"
+#include "ray.c"
+#include "bvh.h"
+#include "camera.h"
+#include "array.h"
+#include "mesh.c"
+#include "tlas.h"
+#include "culling.h"
+#include "render.c"
+
+#include "asset_registry.h"
+
+#include "assets/cube.h"
+
+
+// Meshes that frustum_test_box doesn't put outside, compared to visible
+bool bench_check_visible(Culler &culler, Frustum &frustum)
+{
+    u32* visible = (u32*)culler.visible.base_ptr;
+    u32 visible_index = 0;
+    for (u32 i=0; i < culler.count; ++i)
+    {
+        float bbox[6] = {culler.min_x[i], culler.min_y[i], culler.min_z[i],
+                         culler.max_x[i], culler.max_y[i], culler.max_z[i]};
+        if (frustum_test_box(frustum, bbox) == FRUSTUM_OUTSIDE)
+            continue;
+        if (visible_index >= culler.visible.element_count || visible[visible_index] != i ||
+            !bitset_test(culler.visible_bits, i))
+            return false;
+        visible_index++;
+    }
+    return visible_index == culler.visible.element_count &&
+           visible_index == bitset_count(culler.visible_bits);
+}
+
+
+int main(int argc, char** argv)
+{
+    u32 cube_count = 100000;
+    u32 seed = 10;
+    u32 frame_count = 100;
+    for (int i=1; i + 1 < argc; i += 2)
+    {
+        const char* arg = argv[i];
+        u32 value = atoi(argv[i + 1]);
+        if (strcmp(arg, "--cubes") == 0)
+            cube_count = value;
+        else if (strcmp(arg, "--seed") == 0)
+            seed = value;
+        else if (strcmp(arg, "--frames") == 0)
+            frame_count = value;
+        else
+        {
+            fprintf(stderr, "Usage: %s [--cubes n] [--seed n] [--frames n]\n", argv[0]);
+            return 1;
+        }
+    }
+    // xorshift32 never leaves zero
+    if (seed == 0)
+        seed = 1;
+
+    Array meshes;
+    array_init(meshes, sizeof(Mesh), cube_count > 16 ? cube_count : 16);
+    xorshift32_state state;
+    state.a = seed;
+    for (u32 i=0; i < cube_count; ++i)
+    {
+        Mesh cube_mesh = cube_create_random_on_sphere(state);
+        array_append(meshes, &cube_mesh);
+    }
+
+    Culler culler;
+    culler_init(culler);
+    u32 scene_version = 0;
+    double start_time = render_time_now();
+    culler_update(culler, meshes, scene_version);
+    printf("%u cubes\n", cube_count);
+    printf("update all      %8.3f ms\n", (render_time_now() - start_time) * 1000.0);
+
+    start_time = render_time_now();
+    culler_update(culler, meshes, scene_version);
+    printf("unchanged       %8.3f ms\n", (render_time_now() - start_time) * 1000.0);
+
+    // Move every hundredth cube
+    for (u32 i=0; i < cube_count; i += 100)
+    {
+        Mesh* mesh = (Mesh*)array_get_index(meshes, i);
+        mesh->model_matrix = glm::translate(mesh->model_matrix, glm::vec3(1.0f, 0.0f, 0.0f));
+    }
+    scene_version++;
+    start_time = render_time_now();
+    u32 updated_count = culler_update(culler, meshes, scene_version);
+    printf("update moved    %8.3f ms, %u boxes\n", (render_time_now() - start_time) * 1000.0, updated_count);
+
+    // The editor's start camera, turning around the origin
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 10000.0f);
+    double cull_seconds = 0.0;
+    u64 visible_total = 0;
+    u32 mismatch_count = 0;
+    for (u32 frame=0; frame < frame_count; ++frame)
+    {
+        float angle = 2.0f * M_PI * frame / frame_count;
+        glm::vec3 position = glm::vec3(cos(angle) * 14.0f, 8.0f, sin(angle) * 14.0f);
+        glm::mat4 vp = projection * glm::lookAt(position, glm::vec3(0.0f), glm::vec3(0, 1, 0));
+
+        start_time = render_time_now();
+        Frustum frustum = frustum_from_rect(vp, -1.0f, -1.0f, 1.0f, 1.0f);
+        visible_total += culler_cull(culler, frustum);
+        cull_seconds += render_time_now() - start_time;
+
+        if (!bench_check_visible(culler, frustum))
+            mismatch_count++;
+    }
+    u32 visible_average = (u32)(visible_total / frame_count);
+    printf("cull            %8.3f ms avg, %u drawn, %u culled avg, %u mismatches\n",
+           cull_seconds * 1000.0 / frame_count, visible_average, cube_count - visible_average,
+           mismatch_count);
+
+    culler_free(culler);
+    return 0;
+}
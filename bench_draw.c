@@ -0,0 +1,265 @@
+// Draw call benchmark. Draws a shuffled scene of small meshes with a few
+// programs and geometries, once the way drawMesh used to (program, uniform
+// lookups and unbinds per mesh), once through the sorted RenderQueue with
+// uniform programs and once with the instanced programs, which the queue
+// draws with one call per program and geometry. Prints the submit and frame
+// times. The geometries are cubes so the driver
+// overhead per draw, not rasterization, dominates. Runs without a window on a surfaceless EGL
+// context, e.g. Mesa llvmpipe with LIBGL_ALWAYS_SOFTWARE=1.
+//
+// bench_draw [options]
+//   -n, --draws n     meshes per frame (default 4096)
+//   --frames n        frames per method, after 2 warm up frames (default 50)
+//   --geometries n    cube geometries, each with its own vertex array (default 8)
+//   -w, --width n     framebuffer width (default 256)
+//   -h, --height n    framebuffer height (default 256)
+//   --seed n          xorshift32 seed of the scene (default 10)
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <cmath>
+#include <limits.h>
+#include <pthread.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include "types.h"
+#include "debug.h"
+#include "bench_gl.h"
+#include "ray.c"
+#include "bvh.h"
+#include "camera.h"
+#include "array.h"
+#include "mesh.c"
+#include "shader.h"
+#include "render_queue.h"
+#include "job_pool.h"
+
+#include "io/objloader.h"
+#include "asset_registry.h"
+
+#include "assets/cube.h"
+
+static const char* bench_programs[][2] = {
+    {"shaders/default.vert", "shaders/default.frag"},
+    {"shaders/default.vert", "shaders/lambert.frag"},
+    {"shaders/outline.vert", "shaders/outline.frag"},
+    {"shaders/default.vert", "shaders/selection.frag"},
+};
+#define BENCH_PROGRAM_COUNT (sizeof(bench_programs) / sizeof(*bench_programs))
+
+// Same programs taking the model matrix per instance
+static const char* bench_instanced_programs[][2] = {
+    {"shaders/default_instanced.vert", "shaders/default.frag"},
+    {"shaders/default_instanced.vert", "shaders/lambert.frag"},
+    {"shaders/outline_instanced.vert", "shaders/outline.frag"},
+    {"shaders/default_instanced.vert", "shaders/selection.frag"},
+};
+
+
+typedef struct BenchDraw
+{
+    u32 program;  // into bench_programs
+    Mesh mesh;
+} BenchDraw;
+
+
+void print_usage()
+{
+    printf("Usage: bench_draw [-n draws] [--frames n] [--geometries n] [-w width] [-h height] [--seed n]\n");
+}
+
+
+// What drawMesh did before the render queue
+void bench_draw_direct(BenchDraw* draws, u32 draw_count, GLuint* programs, glm::mat4 vp,
+                       glm::vec3 camera_position, float time)
+{
+    for (u32 i=0; i < draw_count; ++i)
+    {
+        GLuint program = programs[draws[i].program];
+        Mesh &mesh = draws[i].mesh;
+        glUseProgram(program);
+
+        glm::mat4 mvp = vp * mesh.model_matrix;
+        GLuint matrix_id = glGetUniformLocation(program, "MVP");
+        glUniformMatrix4fv(matrix_id, 1, GL_FALSE, &mvp[0][0]);
+
+        GLuint uniform_camera_pos = glGetUniformLocation(program, "camera_position");
+        if(uniform_camera_pos)
+            glUniform3fv(uniform_camera_pos, 1, &camera_position[0]);
+
+        GLuint time_id = glGetUniformLocation(program, "time");
+        glUniform1f(time_id, time);
+
+        glBindVertexArray(mesh.geometry->vao);
+        mesh_draw_elements(*mesh.geometry, GL_TRIANGLES);
+        glBindVertexArray(0);
+        glUseProgram(0);
+    }
+}
+
+
+// programs maps the scene's programs to the ones drawn with
+void bench_draw_queue(RenderQueue &queue, BenchDraw* draws, u32 draw_count, GLuint* programs,
+                      glm::mat4 vp, glm::vec3 camera_position, float time)
+{
+    for (u32 i=0; i < draw_count; ++i)
+    {
+        render_queue_push(queue, programs[draws[i].program], draws[i].mesh, GL_TRIANGLES);
+    }
+    render_queue_flush(queue, vp, camera_position, time);
+}
+
+
+int main(int argc, char** argv)
+{
+    u32 draw_count = 4096;
+    u32 frame_count = 50;
+    u32 geometry_count = 8;
+    u32 width = 256;
+    u32 height = 256;
+    u32 seed = 10;
+    for (int i=1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if ((strcmp(arg, "-n") == 0 || strcmp(arg, "--draws") == 0) && value)
+            draw_count = strtoul(value, NULL, 10);
+        else if (strcmp(arg, "--frames") == 0 && value)
+            frame_count = strtoul(value, NULL, 10);
+        else if (strcmp(arg, "--geometries") == 0 && value)
+            geometry_count = strtoul(value, NULL, 10);
+        else if ((strcmp(arg, "-w") == 0 || strcmp(arg, "--width") == 0) && value)
+            width = strtoul(value, NULL, 10);
+        else if ((strcmp(arg, "-h") == 0 || strcmp(arg, "--height") == 0) && value)
+            height = strtoul(value, NULL, 10);
+        else if (strcmp(arg, "--seed") == 0 && value)
+            seed = strtoul(value, NULL, 10);
+        else
+        {
+            print_usage();
+            return 1;
+        }
+        i++;
+    }
+
+    // xorshift32 never leaves zero
+    if (draw_count == 0 || frame_count == 0 || geometry_count == 0 || width == 0 || height == 0 || seed == 0)
+    {
+        print_usage();
+        return 1;
+    }
+
+    if (!bench_create_context())
+    {
+        printf("Can't create a GL context\n");
+        return 1;
+    }
+    printf("%s, %s\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+    bench_create_framebuffer(width, height);
+    glEnable(GL_DEPTH_TEST);
+
+    GLuint programs[BENCH_PROGRAM_COUNT];
+    GLuint instanced_programs[BENCH_PROGRAM_COUNT];
+    for (u32 i=0; i < BENCH_PROGRAM_COUNT; ++i)
+    {
+        programs[i] = create_shader(bench_programs[i][0], bench_programs[i][1]);
+        instanced_programs[i] = create_shader(bench_instanced_programs[i][0], bench_instanced_programs[i][1]);
+    }
+
+    Mesh* geometries = (Mesh*)malloc(geometry_count * sizeof(Mesh));
+    for (u32 i=0; i < geometry_count; ++i)
+    {
+        MeshGeometry* geometry = mesh_geometry_create(cube_vertices, cube_colors, NULL,
+                                                      sizeof(cube_vertices) / sizeof(*cube_vertices),
+                                                      NULL, 0, 3);
+        geometries[i] = mesh_create(geometry);
+    }
+
+    // Meshes on a grid in front of the camera, program and geometry random
+    // so consecutive draws rarely share state
+    xorshift32_state state;
+    state.a = seed;
+    BenchDraw* draws = (BenchDraw*)malloc(draw_count * sizeof(BenchDraw));
+    u32 side = (u32)ceilf(sqrtf((float)draw_count));
+    for (u32 i=0; i < draw_count; ++i)
+    {
+        draws[i].program = xorshift32(&state) % BENCH_PROGRAM_COUNT;
+        draws[i].mesh = geometries[xorshift32(&state) % geometry_count];
+        glm::vec3 position = glm::vec3((float)(i % side) - side * 0.5f, (float)(i / side) - side * 0.5f, 0.0f);
+        draws[i].mesh.model_matrix = glm::scale(glm::translate(glm::mat4(1.0f), position), glm::vec3(0.3f));
+    }
+
+    glm::vec3 camera_position = glm::vec3(0.0f, 0.0f, side * 1.2f);
+    glm::mat4 vp = glm::perspective(glm::radians(45.0f), (float)width / height, 0.1f, 10000.0f) *
+                   glm::lookAt(camera_position, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+    RenderQueue queue;
+    render_queue_init(queue);
+
+    const char* method_names[] = {"direct", "render queue", "instanced"};
+    u32 draw_calls[3] = {draw_count, 0, 0};
+    double submit_seconds[3] = {};
+    double frame_seconds[3] = {};
+    for (u32 method=0; method < 3; ++method)
+    {
+        queue.draw_count = 0;
+        queue.program_changes = 0;
+        queue.vertex_array_changes = 0;
+        for (u32 frame=0; frame < frame_count + 2; ++frame)
+        {
+            double start = bench_now();
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            if (method == 0)
+                bench_draw_direct(draws, draw_count, programs, vp, camera_position, (float)frame);
+            else
+                bench_draw_queue(queue, draws, draw_count, method == 1 ? programs : instanced_programs,
+                                 vp, camera_position, (float)frame);
+            double submitted = bench_now();
+            glFinish();
+            double finished = bench_now();
+
+            // The first frames compile shader variants, don't count them
+            if (frame >= 2)
+            {
+                submit_seconds[method] += submitted - start;
+                frame_seconds[method] += finished - start;
+            }
+        }
+
+        u32 counted_frames = frame_count + 2;
+        if (method > 0)
+        {
+            draw_calls[method] = queue.draw_count / counted_frames;
+            printf("%s: %.1f program and %.1f vertex array binds per frame\n", method_names[method],
+                   (double)queue.program_changes / counted_frames,
+                   (double)queue.vertex_array_changes / counted_frames);
+        }
+    }
+
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR)
+        printf("GL error 0x%x\n", error);
+
+    printf("%u meshes, %u programs, %u geometries, %ux%u, %u frames\n",
+           draw_count, (u32)BENCH_PROGRAM_COUNT, geometry_count, width, height, frame_count);
+    for (u32 i=0; i < 3; ++i)
+    {
+        printf("%-14s %7u draw calls  submit %8.3f ms  frame %8.3f ms  %6.2f M meshes/s submitted\n",
+               method_names[i], draw_calls[i],
+               submit_seconds[i] * 1000.0 / frame_count, frame_seconds[i] * 1000.0 / frame_count,
+               draw_count * frame_count / submit_seconds[i] / 1000000.0);
+    }
+
+    render_queue_free(queue);
+    free(draws);
+    free(geometries);
+    return 0;
+}
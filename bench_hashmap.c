@@ -0,0 +1,214 @@
+// Hash map microbenchmark. Times lookups, inserts and removes of HashMap
+// with string and u64 keys against a strcmp scan over the keys, what
+// string lookups used to be, for growing key counts. Results go to stdout.
+//
+// bench_hashmap [options]
+//   -n, --ops n     lookups per key count (default 1000000)
+//   --seed n        xorshift32 seed of the lookup order (default 10)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "types.h"
+#include "debug.h"
+#include "hashmap.h"
+
+#define BENCH_KEY_LENGTH 32
+#define BENCH_MAX_SCAN_KEYS 4096
+
+static const u32 bench_key_counts[] = {16, 256, 4096, 65536};
+#define BENCH_KEY_COUNT_COUNT (sizeof(bench_key_counts) / sizeof(*bench_key_counts))
+
+
+double bench_now()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1000000000.0;
+}
+
+
+void print_usage()
+{
+    printf("Usage: bench_hashmap [-n ops] [--seed n]\n");
+}
+
+
+// Keys look like asset paths, every other one is a miss
+char* bench_make_keys(u32 key_count)
+{
+    char* keys = (char*)malloc((size_t)key_count * 2 * BENCH_KEY_LENGTH);
+    for (u32 i=0; i < key_count * 2; ++i)
+    {
+        snprintf(keys + (size_t)i * BENCH_KEY_LENGTH, BENCH_KEY_LENGTH, "assets/mesh_%u.obj", i * 2654435761u);
+    }
+    return keys;
+}
+
+
+u32* bench_make_order(u32 key_count, u32 op_count, u32 seed)
+{
+    xorshift32_state state;
+    state.a = seed;
+    u32* order = (u32*)malloc(op_count * sizeof(u32));
+    for (u32 i=0; i < op_count; ++i)
+    {
+        order[i] = xorshift32(&state) % (key_count * 2);
+    }
+    return order;
+}
+
+
+// Nanoseconds per operation
+inline double bench_ns(double seconds, u32 op_count)
+{
+    return seconds * 1000000000.0 / op_count;
+}
+
+
+// Compares against the key_count inserted keys, the even ones
+double bench_scan_lookups(char* keys, u32 key_count, u32* order, u32 op_count, u32 &found)
+{
+    double start = bench_now();
+    for (u32 i=0; i < op_count; ++i)
+    {
+        const char* key = keys + (size_t)order[i] * BENCH_KEY_LENGTH;
+        for (u32 j=0; j < key_count; ++j)
+        {
+            if (strcmp(keys + (size_t)j * 2 * BENCH_KEY_LENGTH, key) == 0)
+            {
+                found++;
+                break;
+            }
+        }
+    }
+    return bench_now() - start;
+}
+
+
+double bench_hashmap_string_lookups(HashMap &map, char* keys, u32* order, u32 op_count, u32 &found)
+{
+    double start = bench_now();
+    for (u32 i=0; i < op_count; ++i)
+    {
+        if (hashmap_get_string(map, keys + (size_t)order[i] * BENCH_KEY_LENGTH))
+            found++;
+    }
+    return bench_now() - start;
+}
+
+
+double bench_hashmap_u64_lookups(HashMap &map, u32* order, u32 op_count, u32 &found)
+{
+    double start = bench_now();
+    for (u32 i=0; i < op_count; ++i)
+    {
+        if (hashmap_get(map, (u64)order[i] * 2654435761u))
+            found++;
+    }
+    return bench_now() - start;
+}
+
+
+void bench_key_count(u32 key_count, u32 op_count, u32 seed)
+{
+    char* keys = bench_make_keys(key_count);
+    u32* order = bench_make_order(key_count, op_count, seed);
+
+    // Even keys go in, odd keys are misses
+    HashMap string_map;
+    hashmap_init(string_map, HASHMAP_KEY_STRING, sizeof(u32), 0);
+    double start = bench_now();
+    for (u32 i=0; i < key_count; ++i)
+    {
+        hashmap_put_string(string_map, keys + (size_t)i * 2 * BENCH_KEY_LENGTH, &i);
+    }
+    double string_insert_seconds = bench_now() - start;
+
+    HashMap u64_map;
+    hashmap_init(u64_map, HASHMAP_KEY_U64, sizeof(u32), 0);
+    start = bench_now();
+    for (u32 i=0; i < key_count; ++i)
+    {
+        hashmap_put(u64_map, (u64)(i * 2) * 2654435761u, &i);
+    }
+    double u64_insert_seconds = bench_now() - start;
+
+    u32 string_found = 0;
+    u32 u64_found = 0;
+    double string_seconds = bench_hashmap_string_lookups(string_map, keys, order, op_count, string_found);
+    double u64_seconds = bench_hashmap_u64_lookups(u64_map, order, op_count, u64_found);
+
+    // The scan is quadratic, keep it to sizes where it finishes
+    char scan_text[32] = "-";
+    u32 scan_found = string_found;
+    if (key_count <= BENCH_MAX_SCAN_KEYS)
+    {
+        scan_found = 0;
+        double scan_seconds = bench_scan_lookups(keys, key_count, order, op_count, scan_found);
+        snprintf(scan_text, sizeof(scan_text), "%.1f", bench_ns(scan_seconds, op_count));
+    }
+
+    start = bench_now();
+    for (u32 i=0; i < key_count; ++i)
+    {
+        hashmap_remove(u64_map, (u64)(i * 2) * 2654435761u);
+    }
+    double u64_remove_seconds = bench_now() - start;
+
+    if (string_found != u64_found || string_found != scan_found || u64_map.count != 0)
+        printf("Lookup results differ\n");
+
+    printf("%8u  %10s  %8.1f  %8.1f  %8.1f  %8.1f  %8.1f\n",
+           key_count, scan_text,
+           bench_ns(string_seconds, op_count),
+           bench_ns(u64_seconds, op_count),
+           bench_ns(string_insert_seconds, key_count),
+           bench_ns(u64_insert_seconds, key_count),
+           bench_ns(u64_remove_seconds, key_count));
+
+    hashmap_free(string_map);
+    hashmap_free(u64_map);
+    free(order);
+    free(keys);
+}
+
+
+int main(int argc, char** argv)
+{
+    u32 op_count = 1000000;
+    u32 seed = 10;
+    for (int i=1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if ((strcmp(arg, "-n") == 0 || strcmp(arg, "--ops") == 0) && value)
+            op_count = strtoul(value, NULL, 10);
+        else if (strcmp(arg, "--seed") == 0 && value)
+            seed = strtoul(value, NULL, 10);
+        else
+        {
+            print_usage();
+            return 1;
+        }
+        i++;
+    }
+
+    // xorshift32 never leaves zero
+    if (op_count == 0 || seed == 0)
+    {
+        print_usage();
+        return 1;
+    }
+
+    printf("ns per operation, half of the lookups miss\n");
+    printf("%8s  %10s  %8s  %8s  %8s  %8s  %8s\n",
+           "keys", "scan get", "str get", "u64 get", "str put", "u64 put", "u64 del");
+    for (u32 i=0; i < BENCH_KEY_COUNT_COUNT; ++i)
+    {
+        bench_key_count(bench_key_counts[i], op_count, seed);
+    }
+    return 0;
+}
@@ -0,0 +1,531 @@
+// Ray tracing benchmark. Renders fixed scenes along fixed camera orbits with
+// the render view's bucket renderer and writes the results as JSON, so runs
+// on different commits can be compared. Build with -DRAY_STATS to also count
+// BVH nodes and triangle tests, the counters cost some speed.
+// Before timing a scene its first frame is rendered with every packet width
+// the CPU supports and compared pixel for pixel to one ray at a time. Pixels
+// may only differ where two triangles are hit at the very same distance and
+// the widths test them in another order, the run fails otherwise.
+//
+// bench_raytrace [options] [scene ...]
+//   scenes                suzanne3, teapot, teapot2, cubes (default all)
+//   -o, --output path     JSON file (default bench_raytrace.json)
+//   -w, --width n         image width (default 640)
+//   -h, --height n        image height (default 480)
+//   -t, --threads n       render threads, 0 means one per core, at least 2 (default 0)
+//   --pin                 pin render threads to cores
+//   --packet n            ray packet width 1, 4 or 8 (default widest supported)
+//   --order cost|spiral   bucket order (default spiral)
+//   --frames n            camera positions along the orbit (default 8)
+//   --repeats n           passes per camera position (default 3)
+//   --cubes n             cubes in the cubes scene (default 512)
+//   --seed n              xorshift32 seed of the cubes scene (default 10)
+//   --label text          stored in the JSON, e.g. the commit hash
+
+#define HEADLESS
+
+#include <cmath>
+#include <limits.h>
+#include <pthread.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include "types.h"
+#include "debug.h"
+#include "ray.c"
+#include "bvh.h"
+#include "camera.h"
+#include "array.h"
+#include "mesh.c"
+#include "tlas.h"
+#include "ray_packet.c"
+#include "job_pool.h"
+#include "render.c"
+
+#include "io/objloader.h"
+#include "asset_registry.h"
+
+#include "assets/cube.h"
+
+
+// Camera orbit around target, height is relative to the target
+typedef struct BenchScene
+{
+    const char* name;
+    glm::vec3 target;
+    float radius;
+    float height;
+} BenchScene;
+
+
+static BenchScene bench_scenes[] = {
+    {"suzanne3", glm::vec3(0, 5, 0), 9.0f, 2.0f},
+    {"teapot", glm::vec3(0, 1.5f, 0), 7.0f, 3.0f},
+    {"teapot2", glm::vec3(0, 0, 0), 32.0f, 12.0f},
+    {"cubes", glm::vec3(-40, -30, 0), 45.0f, 10.0f},
+};
+#define BENCH_SCENE_COUNT (sizeof(bench_scenes) / sizeof(*bench_scenes))
+
+
+typedef struct BenchResult
+{
+    u32 triangle_count;
+    u32 ray_count;
+    double seconds;
+    double* frame_mrays;
+    double* bucket_seconds;
+    u32 bucket_count;
+    u32 bucket_capacity;
+    RayStats stats;
+} BenchResult;
+
+
+void print_usage()
+{
+    printf("Usage: bench_raytrace [-o out.json] [-w width] [-h height] [-t threads] [--pin]\n"
+           "                      [--packet 1|4|8] [--order cost|spiral] [--frames n] [--repeats n]\n"
+           "                      [--cubes n] [--seed n] [--label text] [scene ...]\n"
+           "Scenes: suzanne3, teapot, teapot2, cubes\n");
+}
+
+
+bool bench_add_obj(Array &meshes, const char* file_path, glm::vec3 offset)
+{
+    Mesh mesh = asset_registry_create_mesh(file_path);
+    if (mesh.geometry->vertex_array_length == 0)
+    {
+        printf("Failed to load %s\n", file_path);
+        return false;
+    }
+    mesh.model_matrix = glm::translate(mesh.model_matrix, offset);
+    array_append(meshes, &mesh);
+    return true;
+}
+
+
+// Same cubes as pressing up in the editor, starting from seed
+void bench_add_cubes(Array &meshes, u32 cube_count, u32 seed)
+{
+    xorshift32_state state;
+    state.a = seed;
+    for (u32 i=0; i < cube_count; ++i)
+    {
+        Mesh cube_mesh = cube_create_random_on_plane(state);
+        array_append(meshes, &cube_mesh);
+    }
+}
+
+
+bool bench_load_scene(const char* name, Array &meshes, u32 cube_count, u32 seed)
+{
+    if (strcmp(name, "suzanne3") == 0)
+    {
+        return bench_add_obj(meshes, "assets/suzanne.obj", glm::vec3(0, 5, 0)) &&
+               bench_add_obj(meshes, "assets/suzanne.obj", glm::vec3(5, 5, 0)) &&
+               bench_add_obj(meshes, "assets/suzanne.obj", glm::vec3(-5, 5, 0));
+    }
+    if (strcmp(name, "teapot") == 0)
+        return bench_add_obj(meshes, "assets/teapot.obj", glm::vec3(0));
+    if (strcmp(name, "teapot2") == 0)
+        return bench_add_obj(meshes, "assets/teapot2.obj", glm::vec3(0));
+    if (strcmp(name, "cubes") == 0)
+    {
+        bench_add_cubes(meshes, cube_count, seed);
+        return true;
+    }
+    return false;
+}
+
+
+void bench_orbit_camera(BenchScene &scene, u32 frame, u32 frame_count, float aspect_ratio, Camera &camera)
+{
+    float angle = 2.0f * M_PI * frame / frame_count;
+    camera.position = scene.target + glm::vec3(cos(angle) * scene.radius,
+                                               scene.height,
+                                               sin(angle) * scene.radius);
+    camera.target = scene.target;
+    camera.fov = 45.0f;
+    camera.aspect_ratio = aspect_ratio;
+    camera_update(camera);
+}
+
+
+void bench_add_pass(BenchResult &result, RenderPass &pass)
+{
+    if (result.bucket_count + pass.request_count > result.bucket_capacity)
+    {
+        result.bucket_capacity = (result.bucket_count + pass.request_count) * 2;
+        result.bucket_seconds = (double*)realloc(result.bucket_seconds, sizeof(double) * result.bucket_capacity);
+    }
+    for (u32 i=0; i < pass.request_count; ++i)
+    {
+        RenderRequest &rr = pass.requests[i];
+        result.bucket_seconds[result.bucket_count++] = rr.seconds;
+        result.stats.nodes_visited += rr.stats.nodes_visited;
+        result.stats.triangle_tests += rr.stats.triangle_tests;
+    }
+}
+
+
+int bench_compare_double(const void* a, const void* b)
+{
+    double da = *(double*)a;
+    double db = *(double*)b;
+    return (da > db) - (da < db);
+}
+
+
+// Nearest rank percentile of sorted values
+double bench_percentile(double* sorted, u32 count, double percent)
+{
+    if (count == 0)
+        return 0;
+    u32 rank = (u32)ceil(percent / 100.0 * count);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+
+void bench_run_scene(BenchScene &scene, Array &meshes, ImageBuffer image,
+                     u32 frame_count, u32 repeat_count, BenchResult &result)
+{
+    memset(&result, 0, sizeof(result));
+    result.frame_mrays = (double*)calloc(frame_count, sizeof(double));
+    for (u32 i=0; i < meshes.element_count; ++i)
+    {
+        Mesh* mesh = (Mesh*)array_get_index(meshes, i);
+        MeshGeometry* geometry = mesh->geometry;
+        result.triangle_count += geometry->indices ? geometry->index_count / 3 : geometry->vertex_array_length / 9;
+    }
+
+    float aspect_ratio = (float)image.width / (float)image.height;
+    RenderPass pass = {};
+    Camera camera;
+
+    // Builds the BVHs and warms the caches, not timed
+    bench_orbit_camera(scene, 0, frame_count, aspect_ratio, camera);
+    render_pass_start(pass, image, camera, meshes);
+    job_pool_wait(job_pool, pass.counter);
+    render_pass_finish(pass, image);
+
+    for (u32 frame=0; frame < frame_count; ++frame)
+    {
+        bench_orbit_camera(scene, frame, frame_count, aspect_ratio, camera);
+        double frame_seconds = 0;
+        for (u32 repeat=0; repeat < repeat_count; ++repeat)
+        {
+            double start_time = render_time_now();
+            render_pass_start(pass, image, camera, meshes);
+            job_pool_wait(job_pool, pass.counter);
+            frame_seconds += render_time_now() - start_time;
+            render_pass_finish(pass, image);
+            bench_add_pass(result, pass);
+        }
+        u32 frame_rays = image.width * image.height * repeat_count;
+        result.frame_mrays[frame] = frame_rays / (frame_seconds * 1000000.0);
+        result.ray_count += frame_rays;
+        result.seconds += frame_seconds;
+    }
+
+    qsort(result.bucket_seconds, result.bucket_count, sizeof(double), bench_compare_double);
+    free(pass.requests);
+    free(pass.tile_costs);
+}
+
+
+// Closest hit distance of the ray through pixel x, y, traced in a packet
+// holding only copies of it
+float bench_trace_pixel(Camera &camera, ImageBuffer image, u32 x, u32 y, u32 packet_width)
+{
+    Ray r = camera_shoot_ray(camera, x / (float)image.width, y / (float)image.height);
+    RayPacket packet;
+    packet.width = packet_width;
+    for (u32 lane=0; lane < packet_width; ++lane)
+    {
+        ray_packet_set(packet, lane, r, RAY_MAX_DISTANCE);
+    }
+    ray_packet_intersect(scene_tlas, packet, 0.001f);
+    return packet.t[0];
+}
+
+
+// Renders the first frame at every supported packet width and compares it to
+// one ray at a time, returns the pixels that differ by more than a tie
+u32 bench_check_packets(BenchScene &scene, Array &meshes, u32 width, u32 height, u32 frame_count)
+{
+    u32 packet_widths[3] = {1, 4, 8};
+    ImageBuffer images[3];
+    Camera camera;
+    bench_orbit_camera(scene, 0, frame_count, (float)width / (float)height, camera);
+
+    u32 saved_packet_width = ray_packet_width;
+    u32 image_count = 0;
+    for (u32 i=0; i < 3 && packet_widths[i] <= ray_packet_max_width; ++i)
+    {
+        ImageBuffer &image = images[image_count++];
+        image.width = width;
+        image.height = height;
+        image.buffer = (u32*)calloc(width * height, sizeof(u32));
+
+        ray_packet_width = packet_widths[i];
+        RenderPass pass = {};
+        render_pass_start(pass, image, camera, meshes);
+        job_pool_wait(job_pool, pass.counter);
+        render_pass_finish(pass, image);
+        free(pass.requests);
+        free(pass.tile_costs);
+    }
+    ray_packet_width = saved_packet_width;
+
+    u32 mismatch_total = 0;
+    for (u32 i=1; i < image_count; ++i)
+    {
+        u32 tie_count = 0;
+        u32 mismatch_count = 0;
+        for (u32 y=0; y < height; ++y)
+        {
+            for (u32 x=0; x < width; ++x)
+            {
+                if (*get_image_pixel(images[i], x, y) == *get_image_pixel(images[0], x, y))
+                    continue;
+                // NOTE(kk): Same distance, another triangle was tested first
+                if (bench_trace_pixel(camera, images[0], x, y, packet_widths[i]) ==
+                    bench_trace_pixel(camera, images[0], x, y, 1))
+                    tie_count++;
+                else
+                    mismatch_count++;
+            }
+        }
+        printf("%-10s %u wide packets against 1: %u ties, %u mismatches\n",
+               scene.name, packet_widths[i], tie_count, mismatch_count);
+        mismatch_total += mismatch_count;
+    }
+
+    for (u32 i=0; i < image_count; ++i)
+    {
+        free(images[i].buffer);
+    }
+    return mismatch_total;
+}
+
+
+void bench_write_scene_json(FILE* fp, BenchScene &scene, u32 instance_count, BenchResult &result,
+                            u32 frame_count, bool last)
+{
+    fprintf(fp, "    {\n");
+    fprintf(fp, "      \"name\": \"%s\",\n", scene.name);
+    fprintf(fp, "      \"instances\": %u,\n", instance_count);
+    fprintf(fp, "      \"triangles\": %u,\n", result.triangle_count);
+    fprintf(fp, "      \"rays\": %u,\n", result.ray_count);
+    fprintf(fp, "      \"seconds\": %.6f,\n", result.seconds);
+    fprintf(fp, "      \"mrays_per_second\": %.4f,\n", result.ray_count / (result.seconds * 1000000.0));
+#ifdef RAY_STATS
+    fprintf(fp, "      \"nodes_visited_per_ray\": %.4f,\n", result.stats.nodes_visited / (double)result.ray_count);
+    fprintf(fp, "      \"triangle_tests_per_ray\": %.4f,\n", result.stats.triangle_tests / (double)result.ray_count);
+#else
+    fprintf(fp, "      \"nodes_visited_per_ray\": null,\n");
+    fprintf(fp, "      \"triangle_tests_per_ray\": null,\n");
+#endif
+    fprintf(fp, "      \"buckets\": %u,\n", result.bucket_count);
+    fprintf(fp, "      \"bucket_ms_p50\": %.4f,\n", bench_percentile(result.bucket_seconds, result.bucket_count, 50) * 1000.0);
+    fprintf(fp, "      \"bucket_ms_p99\": %.4f,\n", bench_percentile(result.bucket_seconds, result.bucket_count, 99) * 1000.0);
+    fprintf(fp, "      \"frame_mrays_per_second\": [");
+    for (u32 i=0; i < frame_count; ++i)
+    {
+        fprintf(fp, "%s%.4f", i ? ", " : "", result.frame_mrays[i]);
+    }
+    fprintf(fp, "]\n");
+    fprintf(fp, "    }%s\n", last ? "" : ",");
+}
+
+
+int main(int argc, char** argv)
+{
+    const char* output_path = "bench_raytrace.json";
+    const char* label = "";
+    u32 width = 640;
+    u32 height = 480;
+    u32 thread_count = 0;
+    bool pin_threads = false;
+    u32 packet_width = 0;
+    u32 frame_count = 8;
+    u32 repeat_count = 3;
+    u32 cube_count = 512;
+    u32 seed = 10;
+    bool selected[BENCH_SCENE_COUNT] = {};
+    bool any_selected = false;
+    render_bucket_order = BUCKET_ORDER_SPIRAL;
+
+    for (int i=1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        bool has_value = true;
+
+        if ((strcmp(arg, "-o") == 0 || strcmp(arg, "--output") == 0) && value)
+            output_path = value;
+        else if ((strcmp(arg, "-w") == 0 || strcmp(arg, "--width") == 0) && value)
+            width = atoi(value);
+        else if ((strcmp(arg, "-h") == 0 || strcmp(arg, "--height") == 0) && value)
+            height = atoi(value);
+        else if ((strcmp(arg, "-t") == 0 || strcmp(arg, "--threads") == 0) && value)
+            thread_count = atoi(value);
+        else if (strcmp(arg, "--packet") == 0 && value)
+            packet_width = atoi(value);
+        else if (strcmp(arg, "--frames") == 0 && value)
+            frame_count = atoi(value);
+        else if (strcmp(arg, "--repeats") == 0 && value)
+            repeat_count = atoi(value);
+        else if (strcmp(arg, "--cubes") == 0 && value)
+            cube_count = atoi(value);
+        else if (strcmp(arg, "--seed") == 0 && value)
+            seed = strtoul(value, NULL, 10);
+        else if (strcmp(arg, "--label") == 0 && value)
+            label = value;
+        else if (strcmp(arg, "--order") == 0 && value && strcmp(value, "cost") == 0)
+            render_bucket_order = BUCKET_ORDER_COST;
+        else if (strcmp(arg, "--order") == 0 && value && strcmp(value, "spiral") == 0)
+            render_bucket_order = BUCKET_ORDER_SPIRAL;
+        else
+        {
+            has_value = false;
+            u32 scene_index = 0;
+            while (scene_index < BENCH_SCENE_COUNT && strcmp(arg, bench_scenes[scene_index].name) != 0)
+            {
+                scene_index++;
+            }
+
+            if (strcmp(arg, "--pin") == 0)
+            {
+                pin_threads = true;
+            }
+            else if (scene_index < BENCH_SCENE_COUNT)
+            {
+                selected[scene_index] = true;
+                any_selected = true;
+            }
+            else
+            {
+                print_usage();
+                return 1;
+            }
+        }
+
+        if (has_value)
+            i++;
+    }
+
+    // xorshift32 never leaves zero, packet width 0 means the widest
+    bool packet_valid = packet_width == 0 || packet_width == 1 || packet_width == 4 || packet_width == 8;
+    if (width == 0 || height == 0 || frame_count == 0 || repeat_count == 0 || seed == 0 || !packet_valid)
+    {
+        print_usage();
+        return 1;
+    }
+
+    render_init_packet_width(packet_width);
+
+    job_pool_init(job_pool, thread_count, pin_threads);
+
+    ImageBuffer image;
+    image.width = width;
+    image.height = height;
+    image.buffer = (u32*)calloc(width * height, sizeof(u32));
+
+    FILE* fp = fopen(output_path, "w");
+    if (fp == NULL)
+    {
+        perror("Error opening file");
+        return 1;
+    }
+
+    u32 scene_count = 0;
+    for (u32 i=0; i < BENCH_SCENE_COUNT; ++i)
+    {
+        if (!any_selected || selected[i])
+            scene_count++;
+    }
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"label\": \"%s\",\n", label);
+    fprintf(fp, "  \"width\": %u,\n", width);
+    fprintf(fp, "  \"height\": %u,\n", height);
+    fprintf(fp, "  \"threads\": %u,\n", job_pool.worker_count);
+    fprintf(fp, "  \"packet_width\": %u,\n", ray_packet_width);
+    fprintf(fp, "  \"bucket_order\": \"%s\",\n", BucketOrderNames[render_bucket_order]);
+    fprintf(fp, "  \"frames\": %u,\n", frame_count);
+    fprintf(fp, "  \"repeats\": %u,\n", repeat_count);
+    fprintf(fp, "  \"cubes\": %u,\n", cube_count);
+    fprintf(fp, "  \"seed\": %u,\n", seed);
+#ifdef RAY_STATS
+    fprintf(fp, "  \"ray_stats\": true,\n");
+#else
+    fprintf(fp, "  \"ray_stats\": false,\n");
+#endif
+    fprintf(fp, "  \"scenes\": [\n");
+
+    bool failed = false;
+    bool packets_differ = false;
+    u32 scenes_written = 0;
+    for (u32 i=0; i < BENCH_SCENE_COUNT && !failed; ++i)
+    {
+        if (any_selected && !selected[i])
+            continue;
+
+        BenchScene &scene = bench_scenes[i];
+        Array meshes;
+        array_init(meshes, sizeof(Mesh), cube_count > 16 ? cube_count : 16);
+        if (!bench_load_scene(scene.name, meshes, cube_count, seed))
+        {
+            failed = true;
+            array_free(meshes);
+            break;
+        }
+
+        if (bench_check_packets(scene, meshes, width, height, frame_count) > 0)
+            packets_differ = true;
+
+        BenchResult result;
+        bench_run_scene(scene, meshes, image, frame_count, repeat_count, result);
+        scenes_written++;
+        bench_write_scene_json(fp, scene, meshes.element_count, result, frame_count,
+                               scenes_written == scene_count);
+
+        printf("%-10s %7u tris %5u instances  %8.2f Mrays/s  bucket p50 %.3f ms p99 %.3f ms",
+               scene.name, result.triangle_count, meshes.element_count,
+               result.ray_count / (result.seconds * 1000000.0),
+               bench_percentile(result.bucket_seconds, result.bucket_count, 50) * 1000.0,
+               bench_percentile(result.bucket_seconds, result.bucket_count, 99) * 1000.0);
+#ifdef RAY_STATS
+        printf("  %.1f nodes/ray %.1f tris/ray",
+               result.stats.nodes_visited / (double)result.ray_count,
+               result.stats.triangle_tests / (double)result.ray_count);
+#endif
+        printf("\n");
+
+        free(result.frame_mrays);
+        free(result.bucket_seconds);
+        array_free(meshes);
+    }
+
+    fprintf(fp, "  ]\n");
+    fprintf(fp, "}\n");
+    fclose(fp);
+
+    job_pool_shutdown(job_pool);
+    free(image.buffer);
+    if (failed)
+        return 1;
+    printf("Wrote %s\n", output_path);
+    if (packets_differ)
+    {
+        printf("Packet widths render different pixels\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,348 @@
+// Selection benchmark. Times point picks and marquee selections with the
+// selector in selection.h on a field of cube instances, and checks every
+// answer against testing all instances one by one, marquees by triangles
+// against clipping every triangle in world space.
+//
+// bench_selection [options]
+//   --cubes n      cube instances (default 100000)
+//   --seed n       xorshift32 seed of the cube positions (default 10)
+//   --picks n      point picks, spread over the view (default 1024)
+//   --marquees n   marquee rectangles per mode (default 64)
+//
+// Then times the editor's selection set operations with every cube selected.
+
+#define HEADLESS
+
+#include <cmath>
+#include <limits.h>
+#include <pthread.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include "types.h"
+#include "debug.h"
+#include "ray.c"
+#include "bvh.h"
+#include "camera.h"
+#include "array.h"
+#include "mesh.c"
+#include "tlas.h"
+#include "selection.h"
+#include "selection_set.h"
+#include "render.c"
+
+#include "asset_registry.h"
+
+#include "assets/cube.h"
+
+
+// Turned cubes spread through a box that grows with the count, so the
+// density and the depth complexity of the view stay about the same. Their
+// world boxes stick out past the corners, which marquees by triangles have
+// to tell apart.
+void bench_add_cubes(Array &meshes, u32 cube_count, u32 seed)
+{
+    xorshift32_state state;
+    state.a = seed;
+    float extent = 4.0f * cbrtf((float)cube_count);
+    for (u32 i=0; i < cube_count; ++i)
+    {
+        Mesh cube_mesh = cube_create_mesh();
+        glm::vec3 position;
+        for (u32 axis=0; axis < 3; ++axis)
+        {
+            position[axis] = (xorshift32(&state) / float(UINT_MAX) - 0.5f) * extent;
+        }
+        glm::vec3 axis = glm::vec3(xorshift32(&state) / float(UINT_MAX) - 0.5f, 0.5f,
+                                   xorshift32(&state) / float(UINT_MAX) - 0.5f);
+        float angle = xorshift32(&state) / float(UINT_MAX) * 3.0f;
+        cube_mesh.model_matrix = glm::translate(cube_mesh.model_matrix, position);
+        cube_mesh.model_matrix = glm::rotate(cube_mesh.model_matrix, angle, glm::normalize(axis));
+        array_append(meshes, &cube_mesh);
+    }
+}
+
+
+// Closest hit over all instances
+u32 bench_pick_reference(TLAS &tlas, Ray &ray)
+{
+    HitRecord closest_hit;
+    closest_hit.t = FLT_MAX;
+    u32 mesh_index = UINT_MAX;
+    for (u32 i=0; i < tlas.instance_count; ++i)
+    {
+        if (tlas_intersect_instance(&tlas.instances[i], ray, 0.0f, closest_hit))
+            mesh_index = tlas.instances[i].mesh_index;
+    }
+    return mesh_index;
+}
+
+
+// Clips the world space triangle by each plane in turn, true when anything
+// is left. Written apart from frustum_test_triangle so it can check it.
+bool bench_clip_triangle(Frustum &frustum, glm::vec3* triangle)
+{
+    glm::vec3 polygon[9];
+    glm::vec3 clipped[9];
+    u32 count = 3;
+    for (u32 i=0; i < 3; ++i)
+    {
+        polygon[i] = triangle[i];
+    }
+    for (u32 i=0; i < 6 && count > 0; ++i)
+    {
+        glm::vec4 plane = frustum.planes[i];
+        u32 clipped_count = 0;
+        for (u32 j=0; j < count; ++j)
+        {
+            glm::vec3 p = polygon[j];
+            glm::vec3 q = polygon[(j + 1) % count];
+            float p_distance = plane.x * p.x + plane.y * p.y + plane.z * p.z + plane.w;
+            float q_distance = plane.x * q.x + plane.y * q.y + plane.z * q.z + plane.w;
+            if (p_distance >= 0.0f)
+                clipped[clipped_count++] = p;
+            if ((p_distance < 0.0f) != (q_distance < 0.0f))
+            {
+                float t = p_distance / (p_distance - q_distance);
+                clipped[clipped_count++] = p + t * (q - p);
+            }
+        }
+        count = clipped_count;
+        memcpy(polygon, clipped, sizeof(glm::vec3) * count);
+    }
+    return count > 0;
+}
+
+
+// Every instance one by one, triangles are taken from the mesh geometry and
+// clipped in world space, nothing of the selector's BVHs is used
+u32 bench_marquee_reference(Array &meshes, TLAS &tlas, Frustum &frustum, u32 mode, Bitset &selected)
+{
+    u32 count = 0;
+    for (u32 i=0; i < meshes.element_count; ++i)
+    {
+        Mesh &mesh = *(Mesh*)array_get_index(meshes, i);
+        bool hit = false;
+        if (mode == SELECTION_BOUNDS)
+        {
+            hit = frustum_test_box(frustum, tlas.instance_bounds + i * 6) != FRUSTUM_OUTSIDE;
+        }
+        else
+        {
+            MeshGeometry &geometry = *mesh.geometry;
+            u32 corner_count = geometry.indices ? geometry.index_count : geometry.vertex_array_length / 3;
+            for (u32 corner=0; corner + 2 < corner_count && !hit; corner += 3)
+            {
+                glm::vec3 triangle[3];
+                for (u32 j=0; j < 3; ++j)
+                {
+                    u32 vertex = geometry.indices ? geometry.indices[corner + j] : corner + j;
+                    float* position = geometry.vertex_positions + vertex * 3;
+                    triangle[j] = glm::vec3(mesh.model_matrix * glm::vec4(position[0], position[1], position[2], 1.0f));
+                }
+                hit = bench_clip_triangle(frustum, triangle);
+            }
+        }
+
+        if (hit)
+        {
+            bitset_set(selected, i);
+            count++;
+        }
+    }
+    return count;
+}
+
+
+bool bench_bitsets_equal(Bitset &a, Bitset &b)
+{
+    return a.word_count == b.word_count &&
+           memcmp(a.words, b.words, a.word_count * sizeof(u64)) == 0;
+}
+
+
+int main(int argc, char** argv)
+{
+    u32 cube_count = 100000;
+    u32 seed = 10;
+    u32 pick_count = 1024;
+    u32 marquee_count = 64;
+    for (int i=1; i + 1 < argc; i += 2)
+    {
+        const char* arg = argv[i];
+        u32 value = atoi(argv[i + 1]);
+        if (strcmp(arg, "--cubes") == 0)
+            cube_count = value;
+        else if (strcmp(arg, "--seed") == 0)
+            seed = value;
+        else if (strcmp(arg, "--picks") == 0)
+            pick_count = value;
+        else if (strcmp(arg, "--marquees") == 0)
+            marquee_count = value;
+        else
+        {
+            fprintf(stderr, "Usage: %s [--cubes n] [--seed n] [--picks n] [--marquees n]\n", argv[0]);
+            return 1;
+        }
+    }
+    // xorshift32 never leaves zero
+    if (seed == 0)
+        seed = 1;
+
+    Array meshes;
+    array_init(meshes, sizeof(Mesh), cube_count > 16 ? cube_count : 16);
+    bench_add_cubes(meshes, cube_count, seed);
+
+    float aspect_ratio = 16.0f / 9.0f;
+    Camera camera;
+    camera.position = glm::vec3(0.0f, 0.0f, 6.0f * cbrtf((float)cube_count));
+    camera.target = glm::vec3(0.0f);
+    camera.fov = 45.0f;
+    camera.aspect_ratio = aspect_ratio;
+    camera_update(camera);
+    glm::mat4 vp = glm::perspective(glm::radians(camera.fov), aspect_ratio, 0.1f, 1000.0f) *
+                   glm::lookAt(camera.position, camera.target, glm::vec3(0, 1, 0));
+
+    Selector selector;
+    selection_init(selector);
+    double start_time = render_time_now();
+    selection_update(selector, meshes, 1);
+    double build_seconds = render_time_now() - start_time;
+    printf("%u cubes, %u triangles each\n", cube_count, selector.tlas.instances[0].blas->triangle_count);
+    printf("update          %8.3f ms\n", build_seconds * 1000.0);
+
+    start_time = render_time_now();
+    selection_update(selector, meshes, 1);
+    printf("unchanged       %8.3f ms\n", (render_time_now() - start_time) * 1000.0);
+
+    // Move every hundredth cube, what the editor's per frame sync refits
+    for (u32 i=0; i < cube_count; i += 100)
+    {
+        Mesh* mesh = (Mesh*)array_get_index(meshes, i);
+        mesh->model_matrix = glm::translate(mesh->model_matrix, glm::vec3(0.5f, 0.0f, 0.0f));
+    }
+    start_time = render_time_now();
+    selection_update(selector, meshes, 2);
+    printf("update moved    %8.3f ms, %u cubes\n", (render_time_now() - start_time) * 1000.0,
+           selector.moved.element_count);
+
+    // Picks on a grid over the view
+    u32 grid_size = (u32)ceilf(sqrtf((float)pick_count));
+    u32 hit_count = 0;
+    u32 mismatch_count = 0;
+    double pick_seconds = 0.0;
+    for (u32 i=0; i < pick_count; ++i)
+    {
+        float u = ((i % grid_size) + 0.5f) / grid_size;
+        float v = ((i / grid_size) + 0.5f) / grid_size;
+        Ray ray = camera_shoot_ray(camera, u, v);
+
+        start_time = render_time_now();
+        u32 mesh_index = selection_pick(selector, ray);
+        pick_seconds += render_time_now() - start_time;
+
+        hit_count += mesh_index != UINT_MAX;
+        if (mesh_index != bench_pick_reference(selector.tlas, ray))
+            mismatch_count++;
+    }
+    printf("pick            %8.3f ms avg, %u of %u hit, %u mismatches\n",
+           pick_seconds * 1000.0 / pick_count, hit_count, pick_count, mismatch_count);
+
+    // Rectangles from a few pixels to most of the view
+    const char* mode_names[] = {"marquee bounds", "marquee tris"};
+    Bitset selected, reference;
+    bitset_init(selected, cube_count);
+    bitset_init(reference, cube_count);
+    xorshift32_state state;
+    for (u32 mode=SELECTION_BOUNDS; mode <= SELECTION_TRIANGLES; ++mode)
+    {
+        // The same rectangles for both modes
+        state.a = seed;
+        double marquee_seconds = 0.0;
+        double max_seconds = 0.0;
+        u64 selected_count = 0;
+        mismatch_count = 0;
+        for (u32 i=0; i < marquee_count; ++i)
+        {
+            float size = 0.01f + 1.5f * xorshift32(&state) / float(UINT_MAX);
+            float x0 = -1.0f + (2.0f - size) * xorshift32(&state) / float(UINT_MAX);
+            float y0 = -1.0f + (2.0f - size) * xorshift32(&state) / float(UINT_MAX);
+
+            start_time = render_time_now();
+            Frustum frustum = frustum_from_rect(vp, x0, y0, x0 + size, y0 + size);
+            bitset_clear(selected);
+            u32 count = selection_marquee(selector, frustum, mode, selected);
+            double seconds = render_time_now() - start_time;
+            marquee_seconds += seconds;
+            max_seconds = seconds > max_seconds ? seconds : max_seconds;
+            selected_count += count;
+
+            bitset_clear(reference);
+            u32 reference_count = bench_marquee_reference(meshes, selector.tlas, frustum, mode, reference);
+            if (count != reference_count || !bench_bitsets_equal(selected, reference))
+                mismatch_count++;
+        }
+        printf("%-15s %8.3f ms avg, %8.3f ms max, %llu selected avg, %u mismatches\n",
+               mode_names[mode], marquee_seconds * 1000.0 / marquee_count, max_seconds * 1000.0,
+               (unsigned long long)(selected_count / marquee_count), mismatch_count);
+    }
+
+    // Select all, a frame's worth of membership tests and iterating, invert
+    // twice and drop the upper half, checked against a bitset
+    SelectionSet set;
+    selection_set_init(set, 16);
+    start_time = render_time_now();
+    selection_set_add_range(set, 0, cube_count);
+    printf("set select all  %8.3f ms\n", (render_time_now() - start_time) * 1000.0);
+
+    start_time = render_time_now();
+    u32 member_count = 0;
+    for (u32 i=0; i < cube_count; ++i)
+    {
+        member_count += selection_set_contains(set, i);
+    }
+    u64 member_sum = 0;
+    for (u32 i=0; i < set.count; ++i)
+    {
+        member_sum += set.dense[i];
+    }
+    printf("set test, iter  %8.3f ms, %u members\n", (render_time_now() - start_time) * 1000.0, member_count);
+
+    start_time = render_time_now();
+    for (u32 pass=0; pass < 2; ++pass)
+    {
+        for (u32 i=0; i < cube_count; i += 1 + pass)
+        {
+            selection_set_toggle(set, i);
+        }
+    }
+    selection_set_remove_range(set, cube_count / 2, cube_count);
+    printf("set toggle      %8.3f ms\n", (render_time_now() - start_time) * 1000.0);
+
+    // Even members survive the toggles, then only the lower half
+    bitset_clear(reference);
+    for (u32 i=0; i < cube_count / 2; i += 2)
+    {
+        bitset_set(reference, i);
+    }
+    bitset_clear(selected);
+    for (u32 i=0; i < set.count; ++i)
+    {
+        bitset_set(selected, set.dense[i]);
+    }
+    bool set_matches = set.count == bitset_count(reference) && bench_bitsets_equal(selected, reference) &&
+                       member_sum == (u64)cube_count * (cube_count - 1) / 2;
+    printf("set             %s\n", set_matches ? "matches" : "MISMATCH");
+
+    selection_set_free(set);
+    bitset_free(selected);
+    bitset_free(reference);
+    selection_free(selector);
+    return 0;
+}
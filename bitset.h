@@ -0,0 +1,128 @@
+#ifndef BITSETH
+#define BITSETH
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+
+// Fixed size set of small integers, one bit each. Testing and setting are
+// a shift and a mask, iterating skips empty words 64 bits at a time.
+
+
+typedef struct Bitset
+{
+    u64* words;
+    u32 bit_count;
+    u32 word_count;
+} Bitset;
+
+
+inline u32 bitset_word_count(u32 bit_count)
+{
+    return (bit_count + 63) / 64;
+}
+
+
+void bitset_init(Bitset &set, u32 bit_count)
+{
+    set.bit_count = bit_count;
+    set.word_count = bitset_word_count(bit_count);
+    set.words = (u64*)calloc(set.word_count > 0 ? set.word_count : 1, sizeof(u64));
+}
+
+
+// Wraps zeroed words the caller owns, e.g. from an arena. Such a set can't
+// be resized or freed.
+Bitset bitset_from_words(u64* words, u32 bit_count)
+{
+    Bitset set;
+    set.words = words;
+    set.bit_count = bit_count;
+    set.word_count = bitset_word_count(bit_count);
+    return set;
+}
+
+
+// Keeps the bits below both sizes, new bits are 0
+void bitset_resize(Bitset &set, u32 bit_count)
+{
+    u32 word_count = bitset_word_count(bit_count);
+    if (word_count > set.word_count)
+    {
+        set.words = (u64*)realloc(set.words, word_count * sizeof(u64));
+        memset(set.words + set.word_count, 0, (word_count - set.word_count) * sizeof(u64));
+    }
+    set.word_count = word_count;
+    set.bit_count = bit_count;
+
+    // Bits past the end stay 0 so counting and iterating can ignore them
+    if (bit_count % 64)
+        set.words[word_count - 1] &= ((u64)1 << (bit_count % 64)) - 1;
+}
+
+
+inline void bitset_set(Bitset &set, u32 bit)
+{
+    set.words[bit >> 6] |= (u64)1 << (bit & 63);
+}
+
+
+inline void bitset_unset(Bitset &set, u32 bit)
+{
+    set.words[bit >> 6] &= ~((u64)1 << (bit & 63));
+}
+
+
+inline bool bitset_test(Bitset &set, u32 bit)
+{
+    return bit < set.bit_count && (set.words[bit >> 6] >> (bit & 63)) & 1;
+}
+
+
+void bitset_clear(Bitset &set)
+{
+    memset(set.words, 0, set.word_count * sizeof(u64));
+}
+
+
+u32 bitset_count(Bitset &set)
+{
+    u32 count = 0;
+    for (u32 i=0; i < set.word_count; ++i)
+    {
+        count += __builtin_popcountll(set.words[i]);
+    }
+    return count;
+}
+
+
+// Finds the first set bit at or after bit, for iterating:
+// for (u32 i=0; bitset_next(set, i); ++i)
+bool bitset_next(Bitset &set, u32 &bit)
+{
+    if (bit >= set.bit_count)
+        return false;
+
+    u32 word_index = bit >> 6;
+    u64 word = set.words[word_index] & (~(u64)0 << (bit & 63));
+    while (!word)
+    {
+        if (++word_index >= set.word_count)
+            return false;
+        word = set.words[word_index];
+    }
+    bit = word_index * 64 + __builtin_ctzll(word);
+    return true;
+}
+
+
+void bitset_free(Bitset &set)
+{
+    free(set.words);
+    set.words = NULL;
+    set.bit_count = 0;
+    set.word_count = 0;
+}
+
+#endif // BITSETH
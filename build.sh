@@ -11,3 +11,27 @@ else
     clang++ -O2 -g -lfreetype -lglew -lglfw -I/usr/local/opt/freetype/include/freetype2 -framework OpenGL main.c -o build/build.out
 fi
 
+# Offline renderer, no GL, GLFW or FreeType needed
+clang++ -O2 -g -pthread render_cli.c -o build/render_cli.out
+
+# Ray tracing benchmark, checks the packet widths against one ray at a time. The RAY_STATS build also counts nodes and triangle tests per ray
+clang++ -O2 -g -pthread bench_raytrace.c -o build/bench_raytrace.out
+clang++ -O2 -g -pthread -D RAY_STATS bench_raytrace.c -o build/bench_raytrace_stats.out
+
+# Hash map microbenchmark against a strcmp scan
+clang++ -O2 -g bench_hashmap.c -o build/bench_hashmap.out
+
+# Array append microbenchmark
+clang++ -O2 -g bench_array.c -o build/bench_array.out
+
+# Draw call benchmark, needs EGL so it builds on Linux with Mesa, LIBGL_ALWAYS_SOFTWARE=1 runs it on llvmpipe
+clang++ -O2 -g -pthread bench_draw.c -o build/bench_draw.out -lEGL -lGL
+
+# Bounding box batch benchmark, checks its pixels against drawing box by box and, in the DEBUG build, its GL objects
+clang++ -O2 -g -pthread -D DEBUG bench_bbox.c -o build/bench_bbox.out -lEGL -lGL
+
+# CPU picking and marquee selection benchmark, checks the results against testing every instance
+clang++ -O2 -g -pthread bench_selection.c -o build/bench_selection.out
+
+# Frustum culling benchmark, checks the culled set against testing every box
+clang++ -O2 -g -pthread bench_culling.c -o build/bench_culling.out
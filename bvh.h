@@ -0,0 +1,409 @@
+#ifndef BVHH
+#define BVHH
+
+#include <float.h>
+
+#include "types.h"
+#include "triangle_store.h"
+
+// Binned SAH bounding volume hierarchy. Meshes get one over their triangles,
+// the scene TLAS reuses the same builder over instance bounds.
+// https://jacco.ompf2.com/2022/04/21/how-to-build-a-bvh-part-3-quick-builds/
+
+#define BVH_BIN_COUNT 12
+#define BVH_MAX_LEAF_SIZE 4
+#define BVH_STACK_SIZE 64
+
+
+typedef struct BVHNode
+{
+    float bbox[6];
+    u32 left_first;      // left child index for inner nodes, first triangle for leaves
+    u32 triangle_count;  // 0 for inner nodes, right child is always left_first + 1
+} BVHNode;
+
+
+typedef struct BVH
+{
+    BVHNode* nodes;
+    u32 node_count;
+    u32* triangle_indices;
+    u32 triangle_count;
+    TriangleStore triangles;  // mesh triangles in leaf order, empty for the TLAS
+} BVH;
+
+
+typedef struct BVHBin
+{
+    float bbox[6];
+    u32 triangle_count;
+} BVHBin;
+
+
+void bvh_bbox_reset(float* bbox)
+{
+    bbox[0] = FLT_MAX;
+    bbox[1] = FLT_MAX;
+    bbox[2] = FLT_MAX;
+    bbox[3] = -FLT_MAX;
+    bbox[4] = -FLT_MAX;
+    bbox[5] = -FLT_MAX;
+}
+
+
+void bvh_bbox_grow(float* bbox, const float* point)
+{
+    for (u32 axis=0; axis < 3; ++axis)
+    {
+        bbox[axis] = point[axis] < bbox[axis] ? point[axis] : bbox[axis];
+        bbox[axis + 3] = point[axis] > bbox[axis + 3] ? point[axis] : bbox[axis + 3];
+    }
+}
+
+
+void bvh_bbox_merge(float* bbox, const float* other)
+{
+    bvh_bbox_grow(bbox, other);
+    bvh_bbox_grow(bbox, other + 3);
+}
+
+
+float bvh_bbox_area(const float* bbox)
+{
+    float x = bbox[3] - bbox[0];
+    float y = bbox[4] - bbox[1];
+    float z = bbox[5] - bbox[2];
+    if (x < 0 || y < 0 || z < 0)
+        return 0.0f;
+    return 2.0f * (x * y + y * z + z * x);
+}
+
+
+float bvh_bbox_centroid(const float* bbox, u32 axis)
+{
+    return (bbox[axis] + bbox[axis + 3]) * 0.5f;
+}
+
+
+void bvh_update_node_bounds(BVH &bvh, const float* primitive_bounds, u32 node_index)
+{
+    BVHNode* node = &bvh.nodes[node_index];
+    bvh_bbox_reset(node->bbox);
+    for (u32 i=0; i < node->triangle_count; ++i)
+    {
+        u32 primitive = bvh.triangle_indices[node->left_first + i];
+        bvh_bbox_merge(node->bbox, primitive_bounds + primitive * 6);
+    }
+}
+
+
+// Returns the SAH cost of the best split, split_axis is set to -1 when no
+// split beats keeping the node as a leaf
+float bvh_find_best_split(BVH &bvh, const float* primitive_bounds, BVHNode* node,
+                          i32 &split_axis, float &split_position)
+{
+    float best_cost = FLT_MAX;
+    split_axis = -1;
+
+    for (u32 axis=0; axis < 3; ++axis)
+    {
+        float centroid_min = FLT_MAX;
+        float centroid_max = -FLT_MAX;
+        for (u32 i=0; i < node->triangle_count; ++i)
+        {
+            u32 primitive = bvh.triangle_indices[node->left_first + i];
+            float c = bvh_bbox_centroid(primitive_bounds + primitive * 6, axis);
+            centroid_min = c < centroid_min ? c : centroid_min;
+            centroid_max = c > centroid_max ? c : centroid_max;
+        }
+        if (centroid_min == centroid_max)
+            continue;
+
+        BVHBin bins[BVH_BIN_COUNT];
+        for (u32 b=0; b < BVH_BIN_COUNT; ++b)
+        {
+            bvh_bbox_reset(bins[b].bbox);
+            bins[b].triangle_count = 0;
+        }
+
+        float bin_scale = BVH_BIN_COUNT / (centroid_max - centroid_min);
+        for (u32 i=0; i < node->triangle_count; ++i)
+        {
+            u32 primitive = bvh.triangle_indices[node->left_first + i];
+            const float* bbox = primitive_bounds + primitive * 6;
+            u32 b = (u32)((bvh_bbox_centroid(bbox, axis) - centroid_min) * bin_scale);
+            if (b > BVH_BIN_COUNT - 1)
+                b = BVH_BIN_COUNT - 1;
+
+            bins[b].triangle_count++;
+            bvh_bbox_merge(bins[b].bbox, bbox);
+        }
+
+        // Sweep from both sides to get the area and count left and right of every plane
+        float left_area[BVH_BIN_COUNT - 1];
+        float right_area[BVH_BIN_COUNT - 1];
+        u32 left_count[BVH_BIN_COUNT - 1];
+        u32 right_count[BVH_BIN_COUNT - 1];
+
+        float left_box[6];
+        float right_box[6];
+        bvh_bbox_reset(left_box);
+        bvh_bbox_reset(right_box);
+        u32 left_sum = 0;
+        u32 right_sum = 0;
+        for (u32 i=0; i < BVH_BIN_COUNT - 1; ++i)
+        {
+            left_sum += bins[i].triangle_count;
+            left_count[i] = left_sum;
+            if (bins[i].triangle_count)
+                bvh_bbox_merge(left_box, bins[i].bbox);
+            left_area[i] = bvh_bbox_area(left_box);
+
+            u32 r = BVH_BIN_COUNT - 1 - i;
+            right_sum += bins[r].triangle_count;
+            right_count[r - 1] = right_sum;
+            if (bins[r].triangle_count)
+                bvh_bbox_merge(right_box, bins[r].bbox);
+            right_area[r - 1] = bvh_bbox_area(right_box);
+        }
+
+        float bin_width = (centroid_max - centroid_min) / BVH_BIN_COUNT;
+        for (u32 i=0; i < BVH_BIN_COUNT - 1; ++i)
+        {
+            if (left_count[i] == 0 || right_count[i] == 0)
+                continue;
+
+            float cost = left_count[i] * left_area[i] + right_count[i] * right_area[i];
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                split_axis = axis;
+                split_position = centroid_min + bin_width * (i + 1);
+            }
+        }
+    }
+    return best_cost;
+}
+
+
+// Builds the hierarchy over any kind of primitive given as float[6] boxes.
+// Node and index storage is reused when the BVH already has enough room.
+void bvh_build_from_bounds(BVH &bvh, const float* primitive_bounds, u32 primitive_count)
+{
+    u32 max_node_count = primitive_count > 0 ? 2 * primitive_count - 1 : 1;
+    if (!bvh.nodes || bvh.triangle_count < primitive_count)
+    {
+        // A binary tree with N leaves never needs more than 2N - 1 nodes
+        bvh.nodes = (BVHNode*)realloc(bvh.nodes, sizeof(BVHNode) * max_node_count);
+        bvh.triangle_indices = (u32*)realloc(bvh.triangle_indices, sizeof(u32) * (primitive_count > 0 ? primitive_count : 1));
+    }
+    bvh.triangle_count = primitive_count;
+    bvh.node_count = 1;
+
+    for (u32 i=0; i < primitive_count; ++i)
+    {
+        bvh.triangle_indices[i] = i;
+    }
+
+    BVHNode* root = &bvh.nodes[0];
+    root->left_first = 0;
+    root->triangle_count = primitive_count;
+    bvh_update_node_bounds(bvh, primitive_bounds, 0);
+
+    u32 stack[BVH_STACK_SIZE];
+    u32 stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0)
+    {
+        u32 node_index = stack[--stack_size];
+        BVHNode* node = &bvh.nodes[node_index];
+        if (node->triangle_count <= 2)
+            continue;
+
+        i32 axis;
+        float split_position;
+        float split_cost = bvh_find_best_split(bvh, primitive_bounds, node, axis, split_position);
+        float leaf_cost = node->triangle_count * bvh_bbox_area(node->bbox);
+
+        if (axis < 0)
+            continue;
+        if (split_cost >= leaf_cost && node->triangle_count <= BVH_MAX_LEAF_SIZE)
+            continue;
+
+        // Partition the primitive indices in place around the split plane
+        i32 i = node->left_first;
+        i32 j = i + node->triangle_count - 1;
+        while (i <= j)
+        {
+            u32 primitive = bvh.triangle_indices[i];
+            if (bvh_bbox_centroid(primitive_bounds + primitive * 6, axis) < split_position)
+            {
+                i++;
+            }
+            else
+            {
+                bvh.triangle_indices[i] = bvh.triangle_indices[j];
+                bvh.triangle_indices[j] = primitive;
+                j--;
+            }
+        }
+
+        u32 left_count = i - node->left_first;
+        if (left_count == 0 || left_count == node->triangle_count)
+            continue;
+
+        u32 left_index = bvh.node_count;
+        bvh.node_count += 2;
+
+        BVHNode* left = &bvh.nodes[left_index];
+        left->left_first = node->left_first;
+        left->triangle_count = left_count;
+
+        BVHNode* right = &bvh.nodes[left_index + 1];
+        right->left_first = i;
+        right->triangle_count = node->triangle_count - left_count;
+
+        node->left_first = left_index;
+        node->triangle_count = 0;
+
+        bvh_update_node_bounds(bvh, primitive_bounds, left_index);
+        bvh_update_node_bounds(bvh, primitive_bounds, left_index + 1);
+
+        if (stack_size + 2 <= BVH_STACK_SIZE)
+        {
+            stack[stack_size++] = left_index;
+            stack[stack_size++] = left_index + 1;
+        }
+    }
+}
+
+
+// Recomputes node boxes for moved primitives without changing the topology.
+// Children are always stored after their parent, so a reverse sweep is bottom-up.
+void bvh_refit(BVH &bvh, const float* primitive_bounds)
+{
+    for (i32 i=bvh.node_count - 1; i >= 0; --i)
+    {
+        BVHNode* node = &bvh.nodes[i];
+        if (node->triangle_count > 0)
+        {
+            bvh_update_node_bounds(bvh, primitive_bounds, i);
+        }
+        else
+        {
+            bvh_bbox_reset(node->bbox);
+            bvh_bbox_merge(node->bbox, bvh.nodes[node->left_first].bbox);
+            bvh_bbox_merge(node->bbox, bvh.nodes[node->left_first + 1].bbox);
+        }
+    }
+}
+
+
+// indices holds three vertex indices per triangle, NULL means every three
+// vertices of vertex_positions are a triangle
+BVH* bvh_build(float* vertex_positions, u32* indices, u32 triangle_count)
+{
+    float* triangle_bounds = (float*)malloc(sizeof(float) * 6 * (triangle_count > 0 ? triangle_count : 1));
+    for (u32 i=0; i < triangle_count; ++i)
+    {
+        float* bbox = triangle_bounds + i * 6;
+        bvh_bbox_reset(bbox);
+        for (u32 corner=0; corner < 3; ++corner)
+        {
+            bvh_bbox_grow(bbox, triangle_get_vertex(vertex_positions, indices, i, corner));
+        }
+    }
+
+    BVH* bvh = (BVH*)calloc(1, sizeof(BVH));
+    bvh_build_from_bounds(*bvh, triangle_bounds, triangle_count);
+    free(triangle_bounds);
+
+    // Leaves index straight into the store from here on
+    triangle_store_build(bvh->triangles, vertex_positions, indices, bvh->triangle_indices, triangle_count);
+
+    print("BVH built: %u triangles, %u nodes", triangle_count, bvh->node_count);
+    return bvh;
+}
+
+
+void bvh_free(BVH* bvh)
+{
+    free(bvh->nodes);
+    free(bvh->triangle_indices);
+    triangle_store_free(bvh->triangles);
+    free(bvh);
+}
+
+
+// Returns the closest hit of the ray with the mesh triangles in (t_min, t_max)
+bool bvh_intersect(BVH &bvh, Ray &ray, float t_min, float t_max, HitRecord &rec)
+{
+    if (bvh.triangle_count == 0)
+        return false;
+
+    glm::vec3 inverse_direction = glm::vec3(1.0f / ray.direction.x,
+                                            1.0f / ray.direction.y,
+                                            1.0f / ray.direction.z);
+    bool hit = false;
+    float closest = t_max;
+
+    u32 stack[BVH_STACK_SIZE];
+    u32 stack_size = 0;
+
+    BVHNode* node = &bvh.nodes[0];
+    if (ray_intersect_box_distance(ray, inverse_direction, node->bbox, closest) == FLT_MAX)
+        return false;
+
+    while (true)
+    {
+        RAY_STATS_ADD(nodes_visited, 1);
+        if (node->triangle_count > 0)
+        {
+            RAY_STATS_ADD(triangle_tests, node->triangle_count);
+            u32 last = node->left_first + node->triangle_count;
+            for (u32 i=node->left_first; i < last; ++i)
+            {
+                if (triangle_store_intersect(bvh.triangles, i, ray, t_min, closest, rec))
+                {
+                    closest = rec.t;
+                    hit = true;
+                }
+            }
+
+            if (stack_size == 0)
+                break;
+            node = &bvh.nodes[stack[--stack_size]];
+            continue;
+        }
+
+        // Visit the nearer child first and defer the other one
+        u32 near_index = node->left_first;
+        u32 far_index = node->left_first + 1;
+        float near_distance = ray_intersect_box_distance(ray, inverse_direction, bvh.nodes[near_index].bbox, closest);
+        float far_distance = ray_intersect_box_distance(ray, inverse_direction, bvh.nodes[far_index].bbox, closest);
+        if (far_distance < near_distance)
+        {
+            u32 temp_index = near_index;
+            near_index = far_index;
+            far_index = temp_index;
+            swapf(near_distance, far_distance);
+        }
+
+        if (near_distance == FLT_MAX)
+        {
+            if (stack_size == 0)
+                break;
+            node = &bvh.nodes[stack[--stack_size]];
+        }
+        else
+        {
+            node = &bvh.nodes[near_index];
+            if (far_distance != FLT_MAX)
+                stack[stack_size++] = far_index;
+        }
+    }
+    return hit;
+}
+
+#endif // BVHH
@@ -1,3 +1,6 @@
+#ifndef CAMERAH
+#define CAMERAH
+
 #include <glm/glm.hpp>
 
 typedef struct Camera
@@ -112,3 +115,5 @@ Ray camera_shoot_ray(Camera &cam, float s, float t)
     r.direction = direction;
     return r;
 }
+
+#endif // CAMERAH
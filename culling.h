@@ -0,0 +1,245 @@
+#ifndef CULLINGH
+#define CULLINGH
+
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "array.h"
+#include "bitset.h"
+#include "frustum.h"
+#include "tlas.h"
+
+// View frustum culling for the raster passes. The culler keeps the world
+// space box of every mesh, one array per component so four boxes are tested
+// against a plane at once. Boxes are only recomputed for meshes whose matrix
+// or geometry changed, and only looked for when the scene version moved.
+// culler_cull leaves the meshes that may be visible in visible, as a list
+// for the passes that draw them all and as bits for the ones that test a
+// few.
+
+
+typedef struct Culler
+{
+    float* min_x;
+    float* min_y;
+    float* min_z;
+    float* max_x;
+    float* max_y;
+    float* max_z;
+    glm::mat4* model_matrices;    // the boxes were computed with
+    MeshGeometry** geometries;
+    u32 count;
+    u32 capacity;                 // a multiple of 4, so four boxes always load
+    u32 scene_version;
+    bool valid;
+
+    Array visible;                // u32 mesh indices
+    Bitset visible_bits;
+    u32 culled_count;
+} Culler;
+
+
+void culler_init(Culler &culler)
+{
+    memset(&culler, 0, sizeof(Culler));
+    array_init(culler.visible, sizeof(u32), 64);
+    bitset_init(culler.visible_bits, 0);
+}
+
+
+void culler_free(Culler &culler)
+{
+    float* components[6] = {culler.min_x, culler.min_y, culler.min_z,
+                            culler.max_x, culler.max_y, culler.max_z};
+    for (u32 i=0; i < 6; ++i)
+    {
+        free(components[i]);
+    }
+    free(culler.model_matrices);
+    free(culler.geometries);
+    array_free(culler.visible);
+    bitset_free(culler.visible_bits);
+    culler.capacity = 0;
+    culler.count = 0;
+    culler.valid = false;
+}
+
+
+void culler_reserve(Culler &culler, u32 count)
+{
+    if (count <= culler.capacity)
+        return;
+
+    u32 capacity = (count * 2 + 3) & ~3u;
+    float** components[6] = {&culler.min_x, &culler.min_y, &culler.min_z,
+                             &culler.max_x, &culler.max_y, &culler.max_z};
+    for (u32 i=0; i < 6; ++i)
+    {
+        *components[i] = (float*)realloc(*components[i], sizeof(float) * capacity);
+    }
+    culler.model_matrices = (glm::mat4*)realloc(culler.model_matrices, sizeof(glm::mat4) * capacity);
+    culler.geometries = (MeshGeometry**)realloc(culler.geometries, sizeof(MeshGeometry*) * capacity);
+    culler.capacity = capacity;
+}
+
+
+// Boxes past count are empty, min above max, and masked off by culler_cull
+void culler_clear_tail(Culler &culler)
+{
+    for (u32 i=culler.count; i < culler.capacity; ++i)
+    {
+        culler.min_x[i] = culler.min_y[i] = culler.min_z[i] = FLT_MAX;
+        culler.max_x[i] = culler.max_y[i] = culler.max_z[i] = -FLT_MAX;
+    }
+}
+
+
+// Syncs the boxes with the meshes when scene_version moved since the last
+// call, cheap otherwise. Returns how many boxes were recomputed.
+u32 culler_update(Culler &culler, Array &meshes, u32 scene_version)
+{
+    if (culler.valid && culler.scene_version == scene_version)
+        return 0;
+
+    u32 mesh_count = meshes.element_count;
+    culler_reserve(culler, mesh_count);
+
+    u32 updated_count = 0;
+    for (u32 i=0; i < mesh_count; ++i)
+    {
+        Mesh* mesh = (Mesh*)array_get_index(meshes, i);
+        if (i < culler.count && culler.geometries[i] == mesh->geometry &&
+            culler.model_matrices[i] == mesh->model_matrix)
+            continue;
+
+        float bbox[6];
+        tlas_get_instance_bounds(mesh->geometry->bbox, mesh->model_matrix, bbox);
+        culler.min_x[i] = bbox[0];
+        culler.min_y[i] = bbox[1];
+        culler.min_z[i] = bbox[2];
+        culler.max_x[i] = bbox[3];
+        culler.max_y[i] = bbox[4];
+        culler.max_z[i] = bbox[5];
+        culler.model_matrices[i] = mesh->model_matrix;
+        culler.geometries[i] = mesh->geometry;
+        updated_count++;
+    }
+    culler.count = mesh_count;
+    culler_clear_tail(culler);
+
+    culler.scene_version = scene_version;
+    culler.valid = true;
+    return updated_count;
+}
+
+
+// Per plane what the four wide test needs, the broadcast plane and the box
+// corners furthest along its normal
+typedef struct CullPlane
+{
+    float normal[3];
+    float w;
+    const float* corner[3];
+} CullPlane;
+
+
+// NOTE(kk): The corner furthest along the normal picks min or max by the
+// sign of the normal, the same for every box
+void culler_get_planes(Culler &culler, Frustum &frustum, CullPlane* planes)
+{
+    float* mins[3] = {culler.min_x, culler.min_y, culler.min_z};
+    float* maxs[3] = {culler.max_x, culler.max_y, culler.max_z};
+    for (u32 i=0; i < 6; ++i)
+    {
+        for (u32 axis=0; axis < 3; ++axis)
+        {
+            planes[i].normal[axis] = frustum.planes[i][axis];
+            planes[i].corner[axis] = frustum.planes[i][axis] >= 0.0f ? maxs[axis] : mins[axis];
+        }
+        planes[i].w = frustum.planes[i].w;
+    }
+}
+
+
+// Same test as frustum_test_box != FRUSTUM_OUTSIDE, adding in the same
+// order, bit i of the result is box first + i
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+inline u32 culler_test_4(CullPlane* planes, u32 first)
+{
+    __m128 outside = _mm_setzero_ps();
+    for (u32 i=0; i < 6; ++i)
+    {
+        CullPlane &plane = planes[i];
+        __m128 distance = _mm_set1_ps(plane.w);
+        distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(plane.normal[0]), _mm_loadu_ps(plane.corner[0] + first)));
+        distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(plane.normal[1]), _mm_loadu_ps(plane.corner[1] + first)));
+        distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(plane.normal[2]), _mm_loadu_ps(plane.corner[2] + first)));
+        outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, _mm_setzero_ps()));
+    }
+    return ~_mm_movemask_ps(outside) & 0xF;
+}
+
+#else
+
+inline u32 culler_test_4(CullPlane* planes, u32 first)
+{
+    u32 mask = 0xF;
+    for (u32 lane=0; lane < 4; ++lane)
+    {
+        for (u32 i=0; i < 6; ++i)
+        {
+            CullPlane &plane = planes[i];
+            float distance = plane.w;
+            for (u32 axis=0; axis < 3; ++axis)
+            {
+                distance += plane.normal[axis] * plane.corner[axis][first + lane];
+            }
+            if (distance < 0.0f)
+            {
+                mask &= ~(1u << lane);
+                break;
+            }
+        }
+    }
+    return mask;
+}
+
+#endif // x86
+
+
+// Fills visible with the meshes whose box isn't fully outside the frustum,
+// returns how many
+u32 culler_cull(Culler &culler, Frustum &frustum)
+{
+    array_resize(culler.visible, culler.count);
+    bitset_resize(culler.visible_bits, culler.count);
+    bitset_clear(culler.visible_bits);
+
+    CullPlane planes[6];
+    culler_get_planes(culler, frustum, planes);
+
+    u32* visible = (u32*)culler.visible.base_ptr;
+    u32 visible_count = 0;
+    for (u32 first=0; first < culler.count; first += 4)
+    {
+        u32 mask = culler_test_4(planes, first);
+        if (culler.count - first < 4)
+            mask &= (1u << (culler.count - first)) - 1;
+        while (mask)
+        {
+            u32 i = first + __builtin_ctz(mask);
+            mask &= mask - 1;
+            visible[visible_count++] = i;
+            bitset_set(culler.visible_bits, i);
+        }
+    }
+    array_resize(culler.visible, visible_count);
+    culler.culled_count = culler.count - visible_count;
+    return visible_count;
+}
+
+#endif // CULLINGH
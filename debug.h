@@ -1,49 +1,487 @@
 #ifndef DEBUGH
 #define DEBUGH
 
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "types.h"
 
 #define print(format, ...) \
     printf("%s\t| %s:%d\t| " format "\n", __FUNCTION__, __FILE__, __LINE__, ##__VA_ARGS__)
-#endif
+
+// Allocation tracker, only in DEBUG builds. The macros at the end route
+// malloc, calloc, realloc and free through it. Every live allocation sits
+// in a table keyed by its pointer, so free knows the size and callsite
+// without a header in front of the memory, and every callsite (file:line)
+// keeps its live bytes, live count, peak and total count. GL buffers and
+// vertex arrays are counted the same way through debug_gl_created and
+// debug_gl_deleted, keyed by their names. Memory the macros didn't hand
+// out (posix_memalign, strdup, libraries) passes through free untouched.
+// Whatever is still live at exit is reported by callsite.
+// Define DEBUG_ALLOC_LOG_SIZE to also keep the last events in a ring buffer.
+
+#define DEBUG_ALLOC_HEAP 0
+#define DEBUG_ALLOC_GL_BUFFER 1
+#define DEBUG_ALLOC_GL_VERTEX_ARRAY 2
+#define DEBUG_ALLOC_KIND_COUNT 3
 
 #ifdef DEBUG
 
+// Power of two, callsites past half of it share one extra slot at the end
+#define DEBUG_MAX_ALLOC_SITES 4096
+
+static const char* DebugAllocKindNames[] = {"heap", "gl buffer", "gl vertex array"};
+
+typedef struct DebugAllocSite
+{
+    const char* file;
+    u32 line;
+    u32 kind;
+    size_t live_bytes;
+    size_t peak_bytes;
+    u64 live_count;
+    u64 total_count;
+} DebugAllocSite;
+
+
+typedef struct DebugAllocation
+{
+    u64 key;    // pointer or tagged GL name, 0 marks an empty slot
+    size_t size;
+    u32 site;
+} DebugAllocation;
+
+
+typedef struct DebugAllocTotals
+{
+    size_t live_bytes;
+    size_t peak_bytes;
+    u64 live_count[DEBUG_ALLOC_KIND_COUNT];
+    u64 total_count[DEBUG_ALLOC_KIND_COUNT];
+} DebugAllocTotals;
+
+
+#ifdef DEBUG_ALLOC_LOG_SIZE
+#define DEBUG_ALLOC_EVENT_ADD 0
+#define DEBUG_ALLOC_EVENT_REMOVE 1
+
+typedef struct DebugAllocEvent
+{
+    u64 key;
+    size_t size;
+    u32 site;
+    u32 type;
+} DebugAllocEvent;
+
+static DebugAllocEvent debug_alloc_log[DEBUG_ALLOC_LOG_SIZE];
+static u64 debug_alloc_log_count = 0;
+#endif
+
+static DebugAllocSite debug_alloc_sites[DEBUG_MAX_ALLOC_SITES + 1];
+static u32 debug_alloc_site_count = 0;
+static DebugAllocation* debug_allocations = NULL;
+static u32 debug_allocation_capacity = 0;
+static u32 debug_allocation_count = 0;
+static DebugAllocTotals debug_alloc_totals_ = {};
+static bool debug_alloc_report_registered = false;
+static pthread_mutex_t debug_alloc_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void debug_alloc_report();
+
+
+inline u64 debug_alloc_hash(u64 key)
+{
+    // splitmix64 finalizer
+    key ^= key >> 30;
+    key *= 0xBF58476D1CE4E5B9ULL;
+    key ^= key >> 27;
+    key *= 0x94D049BB133111EBULL;
+    key ^= key >> 31;
+    return key;
+}
+
+
+// GL names live in their own range, user space pointers never set bit 63
+inline u64 debug_gl_key(u32 kind, u32 name)
+{
+    return (1ULL << 63) | ((u64)kind << 32) | name;
+}
+
+
+// Callers hold debug_alloc_mutex
+u32 debug_alloc_site(const char* file, u32 line, u32 kind)
+{
+    u32 mask = DEBUG_MAX_ALLOC_SITES - 1;
+    u32 slot = (u32)debug_alloc_hash(((u64)(size_t)file << 16) ^ line ^ ((u64)kind << 60)) & mask;
+    while (debug_alloc_sites[slot].file)
+    {
+        DebugAllocSite &site = debug_alloc_sites[slot];
+        if (site.file == file && site.line == line && site.kind == kind)
+            return slot;
+        slot = (slot + 1) & mask;
+    }
+
+    if (debug_alloc_site_count + 1 >= DEBUG_MAX_ALLOC_SITES / 2)
+    {
+        slot = DEBUG_MAX_ALLOC_SITES;
+        debug_alloc_sites[slot].file = "(other)";
+        debug_alloc_sites[slot].kind = kind;
+        return slot;
+    }
+    debug_alloc_sites[slot].file = file;
+    debug_alloc_sites[slot].line = line;
+    debug_alloc_sites[slot].kind = kind;
+    debug_alloc_site_count++;
+    return slot;
+}
+
+
+// Slot of key, or of the empty slot where it would go
+u32 debug_allocation_find(u64 key)
+{
+    u32 mask = debug_allocation_capacity - 1;
+    u32 slot = (u32)debug_alloc_hash(key) & mask;
+    while (debug_allocations[slot].key && debug_allocations[slot].key != key)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+
+void debug_allocations_grow()
+{
+    DebugAllocation* old = debug_allocations;
+    u32 old_capacity = debug_allocation_capacity;
+    debug_allocation_capacity = old_capacity ? old_capacity * 2 : 1024;
+    debug_allocations = (DebugAllocation*)calloc(debug_allocation_capacity, sizeof(DebugAllocation));
+    for (u32 i=0; i < old_capacity; ++i)
+    {
+        if (old[i].key)
+            debug_allocations[debug_allocation_find(old[i].key)] = old[i];
+    }
+    free(old);
+}
+
+
+#ifdef DEBUG_ALLOC_LOG_SIZE
+void debug_alloc_log_event(u32 type, u64 key, size_t size, u32 site)
+{
+    DebugAllocEvent &event = debug_alloc_log[debug_alloc_log_count++ % DEBUG_ALLOC_LOG_SIZE];
+    event.type = type;
+    event.key = key;
+    event.size = size;
+    event.site = site;
+}
+#endif
+
+
+void debug_track_add(u64 key, size_t size, const char* file, u32 line, u32 kind)
+{
+    pthread_mutex_lock(&debug_alloc_mutex);
+    if (!debug_alloc_report_registered)
+    {
+        debug_alloc_report_registered = true;
+        atexit(debug_alloc_report);
+    }
+    if ((debug_allocation_count + 1) * 2 > debug_allocation_capacity)
+        debug_allocations_grow();
+
+    u32 site_index = debug_alloc_site(file, line, kind);
+    DebugAllocSite &site = debug_alloc_sites[site_index];
+    site.live_bytes += size;
+    site.live_count++;
+    site.total_count++;
+    if (site.live_bytes > site.peak_bytes)
+        site.peak_bytes = site.live_bytes;
+
+    DebugAllocTotals &totals = debug_alloc_totals_;
+    totals.live_count[kind]++;
+    totals.total_count[kind]++;
+    if (kind == DEBUG_ALLOC_HEAP)
+    {
+        totals.live_bytes += size;
+        if (totals.live_bytes > totals.peak_bytes)
+            totals.peak_bytes = totals.live_bytes;
+    }
+
+    u32 slot = debug_allocation_find(key);
+    if (!debug_allocations[slot].key)
+        debug_allocation_count++;
+    debug_allocations[slot].key = key;
+    debug_allocations[slot].size = size;
+    debug_allocations[slot].site = site_index;
+#ifdef DEBUG_ALLOC_LOG_SIZE
+    debug_alloc_log_event(DEBUG_ALLOC_EVENT_ADD, key, size, site_index);
+#endif
+    pthread_mutex_unlock(&debug_alloc_mutex);
+}
+
+
+// False when key wasn't handed out by the tracker. removed gets the entry
+// when given.
+bool debug_track_remove(u64 key, DebugAllocation* removed = NULL)
+{
+    pthread_mutex_lock(&debug_alloc_mutex);
+    u32 slot = debug_allocation_capacity ? debug_allocation_find(key) : 0;
+    if (!debug_allocation_capacity || !debug_allocations[slot].key)
+    {
+        pthread_mutex_unlock(&debug_alloc_mutex);
+        return false;
+    }
+
+    DebugAllocation allocation = debug_allocations[slot];
+    if (removed)
+        *removed = allocation;
+    DebugAllocSite &site = debug_alloc_sites[allocation.site];
+    site.live_bytes -= allocation.size;
+    site.live_count--;
+    debug_alloc_totals_.live_count[site.kind]--;
+    if (site.kind == DEBUG_ALLOC_HEAP)
+        debug_alloc_totals_.live_bytes -= allocation.size;
+#ifdef DEBUG_ALLOC_LOG_SIZE
+    debug_alloc_log_event(DEBUG_ALLOC_EVENT_REMOVE, key, allocation.size, allocation.site);
+#endif
+
+    // Shift the rest of the run back, linear probing without tombstones
+    u32 mask = debug_allocation_capacity - 1;
+    u32 next = (slot + 1) & mask;
+    while (debug_allocations[next].key)
+    {
+        u32 home = (u32)debug_alloc_hash(debug_allocations[next].key) & mask;
+        if (((next - home) & mask) >= ((next - slot) & mask))
+        {
+            debug_allocations[slot] = debug_allocations[next];
+            slot = next;
+        }
+        next = (next + 1) & mask;
+    }
+    debug_allocations[slot].key = 0;
+    debug_allocation_count--;
+    pthread_mutex_unlock(&debug_alloc_mutex);
+    return true;
+}
+
+
 void* debug_malloc(size_t size, const char* file, u32 line)
 {
     void* ptr = malloc(size);
-    print("Allocating %lu bytes in file:%s:%i @%p", size, file, line, ptr);
+    if (ptr)
+        debug_track_add((u64)(size_t)ptr, size, file, line, DEBUG_ALLOC_HEAP);
     return ptr;
 }
 
 void* debug_calloc(size_t number_of_items, size_t size, const char* file, u32 line)
 {
     void* ptr = calloc(number_of_items, size);
-    print("Allocating %lu bytes in file:%s:%i @%p", size, file, line, ptr);
+    if (ptr)
+        debug_track_add((u64)(size_t)ptr, number_of_items * size, file, line, DEBUG_ALLOC_HEAP);
     return ptr;
 }
 
 void* debug_realloc(void* ptr, size_t size, const char* file, u32 line)
 {
+    // NOTE(kk): Untracked before realloc gives the block back, another
+    // thread may get the same address and track it in between
+    DebugAllocation old_allocation;
+    bool tracked = ptr && debug_track_remove((u64)(size_t)ptr, &old_allocation);
+
     void* result = realloc(ptr, size);
-    print("Reallocating %lu bytes in file:%s:%i @%p->@%p", size, file, line, ptr, result);
+    if (result)
+    {
+        debug_track_add((u64)(size_t)result, size, file, line, DEBUG_ALLOC_HEAP);
+    }
+    else if (tracked && size > 0)
+    {
+        // Failed, the old block is still there
+        pthread_mutex_lock(&debug_alloc_mutex);
+        DebugAllocSite site = debug_alloc_sites[old_allocation.site];
+        pthread_mutex_unlock(&debug_alloc_mutex);
+        debug_track_add(old_allocation.key, old_allocation.size, site.file, site.line, DEBUG_ALLOC_HEAP);
+    }
     return result;
 }
 
-void debug_free(void* ptr, const char* file, u32 line)
+void debug_free(void* ptr, const char* /*file*/, u32 /*line*/)
 {
-    print("Freeing memory location %p in file:%s:%i", ptr, file, line);
+    if (ptr)
+        debug_track_remove((u64)(size_t)ptr);
     return free(ptr);
 }
 
 
-#ifdef DEBUG
+void debug_gl_created(u32 kind, u32 count, const u32* names, const char* file, u32 line)
+{
+    for (u32 i=0; i < count; ++i)
+    {
+        if (names[i])
+            debug_track_add(debug_gl_key(kind, names[i]), 0, file, line, kind);
+    }
+}
+
+
+void debug_gl_deleted(u32 kind, u32 count, const u32* names)
+{
+    for (u32 i=0; i < count; ++i)
+    {
+        if (names[i])
+            debug_track_remove(debug_gl_key(kind, names[i]));
+    }
+}
+
+
+DebugAllocTotals debug_alloc_totals()
+{
+    pthread_mutex_lock(&debug_alloc_mutex);
+    DebugAllocTotals totals = debug_alloc_totals_;
+    pthread_mutex_unlock(&debug_alloc_mutex);
+    return totals;
+}
+
+
+// Copies the callsites of kind with the most live memory into out, heap
+// sites ordered by live bytes and GL sites by live objects. Returns how
+// many were written.
+u32 debug_alloc_top_sites(u32 kind, DebugAllocSite* out, u32 max_count)
+{
+    u32 count = 0;
+    pthread_mutex_lock(&debug_alloc_mutex);
+    for (u32 i=0; i <= DEBUG_MAX_ALLOC_SITES; ++i)
+    {
+        DebugAllocSite &site = debug_alloc_sites[i];
+        if (!site.file || site.kind != kind || site.live_count == 0)
+            continue;
+
+        u64 weight = kind == DEBUG_ALLOC_HEAP ? site.live_bytes : site.live_count;
+        u32 j = count < max_count ? count++ : max_count;
+        while (j > 0)
+        {
+            DebugAllocSite &above = out[j - 1];
+            u64 above_weight = kind == DEBUG_ALLOC_HEAP ? above.live_bytes : above.live_count;
+            if (above_weight >= weight)
+                break;
+            if (j < max_count)
+                out[j] = above;
+            j--;
+        }
+        if (j < max_count)
+            out[j] = site;
+    }
+    pthread_mutex_unlock(&debug_alloc_mutex);
+    return count;
+}
+
+
+// Every callsite with something still live, at exit this is the leak report
+void debug_alloc_report()
+{
+    DebugAllocTotals totals = debug_alloc_totals();
+    print("Heap: %zu bytes live in %llu allocations, peak %zu bytes, %llu allocations in total",
+          totals.live_bytes, (unsigned long long)totals.live_count[DEBUG_ALLOC_HEAP],
+          totals.peak_bytes, (unsigned long long)totals.total_count[DEBUG_ALLOC_HEAP]);
+
+    pthread_mutex_lock(&debug_alloc_mutex);
+    for (u32 i=0; i <= DEBUG_MAX_ALLOC_SITES; ++i)
+    {
+        DebugAllocSite &site = debug_alloc_sites[i];
+        if (!site.file || site.live_count == 0)
+            continue;
+        print("Live %s at %s:%u: %llu objects, %zu bytes, peak %zu bytes, %llu in total",
+              DebugAllocKindNames[site.kind], site.file, site.line,
+              (unsigned long long)site.live_count, site.live_bytes, site.peak_bytes,
+              (unsigned long long)site.total_count);
+    }
+    pthread_mutex_unlock(&debug_alloc_mutex);
+}
+
+
+#ifdef DEBUG_ALLOC_LOG_SIZE
+// The last DEBUG_ALLOC_LOG_SIZE events, oldest first
+void debug_alloc_print_log()
+{
+    pthread_mutex_lock(&debug_alloc_mutex);
+    u64 first = debug_alloc_log_count > DEBUG_ALLOC_LOG_SIZE ? debug_alloc_log_count - DEBUG_ALLOC_LOG_SIZE : 0;
+    for (u64 i=first; i < debug_alloc_log_count; ++i)
+    {
+        DebugAllocEvent &event = debug_alloc_log[i % DEBUG_ALLOC_LOG_SIZE];
+        DebugAllocSite &site = debug_alloc_sites[event.site];
+        print("%s %s %llx, %zu bytes at %s:%u",
+              event.type == DEBUG_ALLOC_EVENT_ADD ? "+" : "-", DebugAllocKindNames[site.kind],
+              (unsigned long long)event.key, event.size, site.file, site.line);
+    }
+    pthread_mutex_unlock(&debug_alloc_mutex);
+}
+#endif
+
 
 #define malloc(size) debug_malloc(size, __FILE__, __LINE__)
 #define calloc(number_of_items, size) debug_calloc(number_of_items, size, __FILE__, __LINE__)
 #define realloc(ptr, size) debug_realloc(ptr, size, __FILE__, __LINE__)
 #define free(ptr) debug_free(ptr, __FILE__, __LINE__)
 
-#endif
+#define debug_gl_created(kind, count, names) debug_gl_created(kind, count, names, __FILE__, __LINE__)
+
+#else
+
+#define debug_gl_created(kind, count, names)
+#define debug_gl_deleted(kind, count, names)
+
+#endif // DEBUG
+
+
+// Arena usage, kept in every build so arenas can be sized from production
+// runs. Arenas register themselves when they are created.
+#define DEBUG_MAX_ARENAS 64
+
+typedef struct DebugArenaStats
+{
+    const char* name;
+    size_t capacity;    // bytes currently reserved
+    size_t used;        // bytes handed out since the last reset
+    size_t high_water;  // most bytes ever in use at once
+    u32 block_count;
+    u32 reset_count;
+} DebugArenaStats;
+
+static DebugArenaStats* debug_arenas[DEBUG_MAX_ARENAS];
+static u32 debug_arena_count = 0;
+static pthread_mutex_t debug_arena_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+void debug_register_arena(DebugArenaStats* stats)
+{
+    pthread_mutex_lock(&debug_arena_mutex);
+    if (debug_arena_count < DEBUG_MAX_ARENAS)
+        debug_arenas[debug_arena_count++] = stats;
+    pthread_mutex_unlock(&debug_arena_mutex);
+}
+
+
+void debug_unregister_arena(DebugArenaStats* stats)
+{
+    pthread_mutex_lock(&debug_arena_mutex);
+    for (u32 i=0; i < debug_arena_count; ++i)
+    {
+        if (debug_arenas[i] == stats)
+        {
+            debug_arenas[i] = debug_arenas[--debug_arena_count];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&debug_arena_mutex);
+}
+
+
+void debug_print_arena_stats()
+{
+    pthread_mutex_lock(&debug_arena_mutex);
+    for (u32 i=0; i < debug_arena_count; ++i)
+    {
+        DebugArenaStats* stats = debug_arenas[i];
+        print("Arena %s: high water %zu bytes, reserved %zu bytes in %u blocks, %u resets",
+              stats->name, stats->high_water, stats->capacity, stats->block_count, stats->reset_count);
+    }
+    pthread_mutex_unlock(&debug_arena_mutex);
+}
 
 #endif // DEBUGH
@@ -0,0 +1,160 @@
+#ifndef FRUSTUMH
+#define FRUSTUMH
+
+#include <glm/glm.hpp>
+
+#include "types.h"
+
+// Frustums as six planes in the space of the boxes they test, built from a
+// view projection matrix and a rectangle of the view. The planes aren't
+// normalized, the tests only look at the sign of the distance.
+
+// Results of frustum_test_box
+#define FRUSTUM_OUTSIDE 0
+#define FRUSTUM_INTERSECTS 1
+#define FRUSTUM_INSIDE 2
+
+// Bit i stands for planes[i]. Hierarchies pass down the planes a parent box
+// still straddles, whatever is inside a box is inside the planes it is.
+#define FRUSTUM_ALL_PLANES 0x3F
+
+// Points p with dot(plane.xyz, p) + plane.w >= 0 for every plane are inside
+typedef struct Frustum
+{
+    glm::vec4 planes[6];
+} Frustum;
+
+
+// Frustum of the part of the view inside the rectangle, x0 < x1 and
+// y0 < y1 in normalized device coordinates. The whole view is -1 to 1.
+Frustum frustum_from_rect(glm::mat4 vp, float x0, float y0, float x1, float y1)
+{
+    glm::vec4 rows[4];
+    for (u32 i=0; i < 4; ++i)
+    {
+        rows[i] = glm::vec4(vp[0][i], vp[1][i], vp[2][i], vp[3][i]);
+    }
+
+    // NOTE(kk): x0 <= x/w is x - x0 * w >= 0 in clip space, same for the
+    // other sides
+    Frustum frustum;
+    frustum.planes[0] = rows[0] - x0 * rows[3];
+    frustum.planes[1] = x1 * rows[3] - rows[0];
+    frustum.planes[2] = rows[1] - y0 * rows[3];
+    frustum.planes[3] = y1 * rows[3] - rows[1];
+    frustum.planes[4] = rows[3] + rows[2];
+    frustum.planes[5] = rows[3] - rows[2];
+    return frustum;
+}
+
+
+// The frustum in the space model_matrix maps to world space, planes not in
+// plane_mask are left out
+Frustum frustum_transform(Frustum &frustum, glm::mat4 &model_matrix, u32 plane_mask = FRUSTUM_ALL_PLANES)
+{
+    Frustum result;
+    for (u32 i=0; i < 6; ++i)
+    {
+        if (!(plane_mask & (1u << i)))
+            continue;
+        // NOTE(kk): transpose(model_matrix) * plane, a dot per column
+        glm::vec4 &plane = frustum.planes[i];
+        result.planes[i] = glm::vec4(glm::dot(model_matrix[0], plane), glm::dot(model_matrix[1], plane),
+                                     glm::dot(model_matrix[2], plane), glm::dot(model_matrix[3], plane));
+    }
+    return result;
+}
+
+
+// Tests the box against the planes in plane_mask and clears the bits of the
+// ones it is inside of, INSIDE once none are left
+int frustum_test_box(Frustum &frustum, const float* bbox, u32 &plane_mask)
+{
+    for (u32 planes=plane_mask; planes; planes &= planes - 1)
+    {
+        u32 i = __builtin_ctz(planes);
+        glm::vec4 &plane = frustum.planes[i];
+        // Corners furthest along and against the plane normal
+        float far_distance = plane.w;
+        float near_distance = plane.w;
+        for (u32 axis=0; axis < 3; ++axis)
+        {
+            u32 far_side = plane[axis] >= 0.0f ? 3 : 0;
+            far_distance += plane[axis] * bbox[axis + far_side];
+            near_distance += plane[axis] * bbox[axis + 3 - far_side];
+        }
+
+        if (far_distance < 0.0f)
+            return FRUSTUM_OUTSIDE;
+        if (near_distance >= 0.0f)
+            plane_mask &= ~(1u << i);
+    }
+    return plane_mask ? FRUSTUM_INTERSECTS : FRUSTUM_INSIDE;
+}
+
+
+int frustum_test_box(Frustum &frustum, const float* bbox)
+{
+    u32 plane_mask = FRUSTUM_ALL_PLANES;
+    return frustum_test_box(frustum, bbox, plane_mask);
+}
+
+
+// True when some of the triangle is inside the planes in plane_mask. Planes
+// with corners on both sides cut off what is behind them in turn, every cut
+// adds at most a corner.
+bool frustum_test_triangle(Frustum &frustum, glm::vec3 a, glm::vec3 b, glm::vec3 c,
+                           u32 plane_mask = FRUSTUM_ALL_PLANES)
+{
+    u32 straddled_planes = 0;
+    for (u32 planes=plane_mask; planes; planes &= planes - 1)
+    {
+        u32 i = __builtin_ctz(planes);
+        glm::vec4 &plane = frustum.planes[i];
+        glm::vec3 normal = glm::vec3(plane);
+        u32 inside_count = (glm::dot(normal, a) + plane.w >= 0.0f) +
+                           (glm::dot(normal, b) + plane.w >= 0.0f) +
+                           (glm::dot(normal, c) + plane.w >= 0.0f);
+        if (inside_count == 0)
+            return false;
+        if (inside_count < 3)
+            straddled_planes |= 1u << i;
+    }
+    // NOTE(kk): A single cut always leaves the corners in front of the plane
+    if ((straddled_planes & (straddled_planes - 1)) == 0)
+        return true;
+
+    glm::vec3 polygons[2][9];
+    polygons[0][0] = a;
+    polygons[0][1] = b;
+    polygons[0][2] = c;
+    u32 corner_count = 3;
+    u32 current = 0;
+    for (u32 planes=straddled_planes; planes; planes &= planes - 1)
+    {
+        glm::vec4 &plane = frustum.planes[__builtin_ctz(planes)];
+        glm::vec3 normal = glm::vec3(plane);
+        glm::vec3* corners = polygons[current];
+        glm::vec3* clipped = polygons[current ^ 1];
+        u32 clipped_count = 0;
+        float distance = glm::dot(normal, corners[0]) + plane.w;
+        for (u32 j=0; j < corner_count; ++j)
+        {
+            glm::vec3 &next = corners[j + 1 < corner_count ? j + 1 : 0];
+            float next_distance = glm::dot(normal, next) + plane.w;
+            if (distance >= 0.0f)
+                clipped[clipped_count++] = corners[j];
+            if ((distance >= 0.0f) != (next_distance >= 0.0f))
+                clipped[clipped_count++] = corners[j] + (next - corners[j]) * (distance / (distance - next_distance));
+            distance = next_distance;
+        }
+
+        if (clipped_count == 0)
+            return false;
+        corner_count = clipped_count;
+        current ^= 1;
+    }
+    return true;
+}
+
+#endif // FRUSTUMH
@@ -0,0 +1,319 @@
+#ifndef HASHMAPH
+#define HASHMAPH
+
+#include <alloca.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+
+// Open addressing hash map with Robin Hood probing. Keys are either u64
+// integers or C strings, values are fixed size byte blocks copied into the
+// map. Every slot stores the hash of its key, 0 marks an empty slot, so
+// lookups compare hashes before keys and rehashing never hashes again.
+// Removal shifts the following entries back instead of leaving tombstones.
+// NOTE(kk): String keys are not copied, they have to outlive the map.
+// Pointers returned by get and put are valid until the next put or remove.
+
+#define HASHMAP_KEY_U64 0
+#define HASHMAP_KEY_STRING 1
+
+// Grow when more than 7/8 of the slots are used
+#define HASHMAP_LOAD_NUMERATOR 7
+#define HASHMAP_LOAD_DENOMINATOR 8
+
+
+typedef struct HashMap
+{
+    u32 key_type;
+    u32 value_size;
+    u32 count;
+    u32 capacity;  // power of two, or 0 before the first put
+    u32* hashes;
+    u64* keys;     // the integer, or the string pointer
+    byte* values;
+} HashMap;
+
+
+inline u32 hashmap_hash_u64(u64 key)
+{
+    // splitmix64 finalizer
+    key ^= key >> 30;
+    key *= 0xBF58476D1CE4E5B9ULL;
+    key ^= key >> 27;
+    key *= 0x94D049BB133111EBULL;
+    key ^= key >> 31;
+    u32 hash = (u32)key;
+    return hash ? hash : 1;
+}
+
+
+inline u32 hashmap_hash_string(const char* key)
+{
+    // FNV-1a
+    u32 hash = 2166136261u;
+    for (const byte* c = (const byte*)key; *c; ++c)
+    {
+        hash = (hash ^ *c) * 16777619u;
+    }
+    return hash ? hash : 1;
+}
+
+
+inline u32 hashmap_hash_key(HashMap &map, u64 key)
+{
+    if (map.key_type == HASHMAP_KEY_STRING)
+        return hashmap_hash_string((const char*)key);
+    return hashmap_hash_u64(key);
+}
+
+
+inline bool hashmap_keys_equal(HashMap &map, u64 a, u64 b)
+{
+    if (map.key_type == HASHMAP_KEY_STRING)
+        return a == b || strcmp((const char*)a, (const char*)b) == 0;
+    return a == b;
+}
+
+
+inline u32 hashmap_probe_distance(HashMap &map, u32 hash, u32 slot)
+{
+    return (slot - hash) & (map.capacity - 1);
+}
+
+
+inline void* hashmap_value(HashMap &map, u32 slot)
+{
+    return map.values + (size_t)slot * map.value_size;
+}
+
+
+void hashmap_init(HashMap &map, u32 key_type, u32 value_size, u32 capacity)
+{
+    map = {};
+    map.key_type = key_type;
+    map.value_size = value_size;
+    if (capacity > 0)
+    {
+        u32 slot_count = 8;
+        while (slot_count * HASHMAP_LOAD_NUMERATOR / HASHMAP_LOAD_DENOMINATOR < capacity)
+            slot_count *= 2;
+        map.capacity = slot_count;
+        map.hashes = (u32*)calloc(slot_count, sizeof(u32));
+        map.keys = (u64*)malloc(slot_count * sizeof(u64));
+        map.values = (byte*)malloc((size_t)slot_count * value_size);
+    }
+}
+
+
+// Slot of key, or capacity when it isn't in the map
+u32 hashmap_find(HashMap &map, u64 key, u32 hash)
+{
+    if (map.count == 0)
+        return map.capacity;
+
+    u32 mask = map.capacity - 1;
+    u32 slot = hash & mask;
+    for (u32 distance=0; ; ++distance)
+    {
+        u32 slot_hash = map.hashes[slot];
+        // Robin Hood keeps runs ordered by distance, a closer entry means
+        // key would have been placed before it
+        if (slot_hash == 0 || hashmap_probe_distance(map, slot_hash, slot) < distance)
+            return map.capacity;
+        if (slot_hash == hash && hashmap_keys_equal(map, map.keys[slot], key))
+            return slot;
+        slot = (slot + 1) & mask;
+    }
+}
+
+
+// Places an entry that is known not to be in the map yet, returns its slot
+u32 hashmap_insert_new(HashMap &map, u64 key, u32 hash, void* value)
+{
+    u32 mask = map.capacity - 1;
+    u32 slot = hash & mask;
+    u32 distance = 0;
+    u32 result = map.capacity;
+
+    byte* carried_value = (byte*)alloca(map.value_size);
+    byte* swap_value = (byte*)alloca(map.value_size);
+    memcpy(carried_value, value, map.value_size);
+
+    while (true)
+    {
+        u32 slot_hash = map.hashes[slot];
+        if (slot_hash == 0)
+        {
+            map.hashes[slot] = hash;
+            map.keys[slot] = key;
+            memcpy(hashmap_value(map, slot), carried_value, map.value_size);
+            return result == map.capacity ? slot : result;
+        }
+
+        // Take the slot from an entry closer to its home and carry that
+        // one further
+        u32 slot_distance = hashmap_probe_distance(map, slot_hash, slot);
+        if (slot_distance < distance)
+        {
+            u64 slot_key = map.keys[slot];
+            memcpy(swap_value, hashmap_value(map, slot), map.value_size);
+
+            map.hashes[slot] = hash;
+            map.keys[slot] = key;
+            memcpy(hashmap_value(map, slot), carried_value, map.value_size);
+            if (result == map.capacity)
+                result = slot;
+
+            hash = slot_hash;
+            key = slot_key;
+            byte* temp = carried_value;
+            carried_value = swap_value;
+            swap_value = temp;
+            distance = slot_distance;
+        }
+        slot = (slot + 1) & mask;
+        distance++;
+    }
+}
+
+
+// Moves every entry into a table of capacity slots, capacity has to be a
+// power of two above count
+void hashmap_rehash(HashMap &map, u32 capacity)
+{
+    HashMap old = map;
+    map.capacity = capacity;
+    map.count = old.count;
+    map.hashes = (u32*)calloc(capacity, sizeof(u32));
+    map.keys = (u64*)malloc(capacity * sizeof(u64));
+    map.values = (byte*)malloc((size_t)capacity * map.value_size);
+
+    for (u32 i=0; i < old.capacity; ++i)
+    {
+        if (old.hashes[i])
+            hashmap_insert_new(map, old.keys[i], old.hashes[i], hashmap_value(old, i));
+    }
+
+    free(old.hashes);
+    free(old.keys);
+    free(old.values);
+}
+
+
+// Makes room for count entries without growing again
+void hashmap_reserve(HashMap &map, u32 count)
+{
+    u32 capacity = map.capacity ? map.capacity : 8;
+    while (capacity * HASHMAP_LOAD_NUMERATOR / HASHMAP_LOAD_DENOMINATOR < count)
+        capacity *= 2;
+    if (capacity != map.capacity)
+        hashmap_rehash(map, capacity);
+}
+
+
+void* hashmap_get(HashMap &map, u64 key)
+{
+    u32 slot = hashmap_find(map, key, hashmap_hash_key(map, key));
+    return slot < map.capacity ? hashmap_value(map, slot) : NULL;
+}
+
+
+// Inserts or overwrites, returns the stored value
+void* hashmap_put(HashMap &map, u64 key, void* value)
+{
+    u32 hash = hashmap_hash_key(map, key);
+    u32 slot = hashmap_find(map, key, hash);
+    if (slot < map.capacity)
+    {
+        memcpy(hashmap_value(map, slot), value, map.value_size);
+        return hashmap_value(map, slot);
+    }
+
+    hashmap_reserve(map, map.count + 1);
+    map.count++;
+    return hashmap_value(map, hashmap_insert_new(map, key, hash, value));
+}
+
+
+bool hashmap_remove(HashMap &map, u64 key)
+{
+    u32 slot = hashmap_find(map, key, hashmap_hash_key(map, key));
+    if (slot >= map.capacity)
+        return false;
+
+    // Shift the rest of the run back by one so lookups never need a
+    // tombstone to keep probing
+    u32 mask = map.capacity - 1;
+    u32 next = (slot + 1) & mask;
+    while (map.hashes[next] && hashmap_probe_distance(map, map.hashes[next], next) > 0)
+    {
+        map.hashes[slot] = map.hashes[next];
+        map.keys[slot] = map.keys[next];
+        memcpy(hashmap_value(map, slot), hashmap_value(map, next), map.value_size);
+        slot = next;
+        next = (next + 1) & mask;
+    }
+    map.hashes[slot] = 0;
+    map.count--;
+    return true;
+}
+
+
+inline void* hashmap_get_string(HashMap &map, const char* key)
+{
+    return hashmap_get(map, (u64)key);
+}
+
+
+inline void* hashmap_put_string(HashMap &map, const char* key, void* value)
+{
+    return hashmap_put(map, (u64)key, value);
+}
+
+
+inline bool hashmap_remove_string(HashMap &map, const char* key)
+{
+    return hashmap_remove(map, (u64)key);
+}
+
+
+// Walks the entries, start with slot 0 and call until it returns false
+bool hashmap_next(HashMap &map, u32 &slot, u64 &out_key, void* &out_value)
+{
+    for (; slot < map.capacity; ++slot)
+    {
+        if (map.hashes[slot])
+        {
+            out_key = map.keys[slot];
+            out_value = hashmap_value(map, slot);
+            slot++;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// Empties the map and keeps its capacity
+void hashmap_clear(HashMap &map)
+{
+    if (map.hashes)
+        memset(map.hashes, 0, map.capacity * sizeof(u32));
+    map.count = 0;
+}
+
+
+void hashmap_free(HashMap &map)
+{
+    free(map.hashes);
+    free(map.keys);
+    free(map.values);
+    map.hashes = NULL;
+    map.keys = NULL;
+    map.values = NULL;
+    map.capacity = 0;
+    map.count = 0;
+}
+
+#endif // HASHMAPH
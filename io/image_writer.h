@@ -0,0 +1,260 @@
+#ifndef IMAGEWRITERH
+#define IMAGEWRITERH
+
+#include <stdio.h>
+#include <string.h>
+
+
+// Minimal writers for RGBA8 pixels (R in the lowest byte) stored top row
+// first. PNG is written with uncompressed deflate blocks and EXR as
+// uncompressed 32 bit float scanlines, so neither needs zlib.
+// NOTE(kk): Multi byte values are written in host order, EXR expects
+// little endian which is what we build for.
+
+
+void image_write_u32_be(FILE* fp, u32 value)
+{
+    byte data[4] = {(byte)(value >> 24), (byte)(value >> 16), (byte)(value >> 8), (byte)value};
+    fwrite(data, 1, 4, fp);
+}
+
+
+u32 image_crc32(u32 crc, const byte* data, size_t size)
+{
+    static u32 table[256];
+    static bool table_ready = false;
+    if (!table_ready)
+    {
+        for (u32 n=0; n < 256; ++n)
+        {
+            u32 c = n;
+            for (u32 k=0; k < 8; ++k)
+            {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+        table_ready = true;
+    }
+
+    crc = ~crc;
+    for (size_t i=0; i < size; ++i)
+    {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+
+void image_write_png_chunk(FILE* fp, const char* type, const byte* data, u32 size)
+{
+    image_write_u32_be(fp, size);
+    fwrite(type, 1, 4, fp);
+    if (size)
+        fwrite(data, 1, size, fp);
+
+    u32 crc = image_crc32(0, (const byte*)type, 4);
+    crc = image_crc32(crc, data, size);
+    image_write_u32_be(fp, crc);
+}
+
+
+bool image_write_ppm(const char* file_path, const u32* pixels, u32 width, u32 height)
+{
+    FILE* fp = fopen(file_path, "wb");
+    if (fp == NULL)
+    {
+        perror("Error opening file");
+        return false;
+    }
+
+    fprintf(fp, "P6\n%u %u\n255\n", width, height);
+    byte* row = (byte*)malloc(width * 3);
+    for (u32 y=0; y < height; ++y)
+    {
+        const u32* src = pixels + y * width;
+        for (u32 x=0; x < width; ++x)
+        {
+            row[x * 3 + 0] = src[x] & 0xFF;
+            row[x * 3 + 1] = (src[x] >> 8) & 0xFF;
+            row[x * 3 + 2] = (src[x] >> 16) & 0xFF;
+        }
+        fwrite(row, 1, width * 3, fp);
+    }
+    free(row);
+    fclose(fp);
+    return true;
+}
+
+
+bool image_write_png(const char* file_path, const u32* pixels, u32 width, u32 height)
+{
+    FILE* fp = fopen(file_path, "wb");
+    if (fp == NULL)
+    {
+        perror("Error opening file");
+        return false;
+    }
+
+    const byte signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    fwrite(signature, 1, 8, fp);
+
+    byte header[13];
+    header[0] = width >> 24; header[1] = width >> 16; header[2] = width >> 8; header[3] = width;
+    header[4] = height >> 24; header[5] = height >> 16; header[6] = height >> 8; header[7] = height;
+    header[8] = 8;   // bit depth
+    header[9] = 6;   // RGBA
+    header[10] = 0;  // deflate
+    header[11] = 0;  // adaptive filtering, every row uses filter 0
+    header[12] = 0;  // no interlace
+    image_write_png_chunk(fp, "IHDR", header, 13);
+
+    // Filter byte + row, packed into stored deflate blocks of at most 64k
+    size_t row_size = 1 + (size_t)width * 4;
+    size_t raw_size = row_size * height;
+    size_t block_count = (raw_size + 65534) / 65535;
+    size_t zlib_size = 2 + raw_size + block_count * 5 + 4;
+    byte* zlib = (byte*)malloc(zlib_size);
+    byte* out = zlib;
+    *out++ = 0x78;
+    *out++ = 0x01;
+
+    u32 adler_a = 1;
+    u32 adler_b = 0;
+    size_t remaining = raw_size;
+    size_t raw_offset = 0;
+    while (remaining > 0)
+    {
+        u32 block_size = remaining > 65535 ? 65535 : (u32)remaining;
+        remaining -= block_size;
+        *out++ = remaining == 0 ? 1 : 0;
+        *out++ = block_size & 0xFF;
+        *out++ = block_size >> 8;
+        *out++ = ~block_size & 0xFF;
+        *out++ = (~block_size >> 8) & 0xFF;
+
+        for (u32 i=0; i < block_size; ++i, ++raw_offset)
+        {
+            size_t y = raw_offset / row_size;
+            size_t column = raw_offset % row_size;
+            byte value = 0;
+            if (column > 0)
+                value = ((const byte*)(pixels + y * width))[column - 1];
+
+            *out++ = value;
+            adler_a = (adler_a + value) % 65521;
+            adler_b = (adler_b + adler_a) % 65521;
+        }
+    }
+    u32 adler = (adler_b << 16) | adler_a;
+    *out++ = adler >> 24;
+    *out++ = adler >> 16;
+    *out++ = adler >> 8;
+    *out++ = adler;
+
+    image_write_png_chunk(fp, "IDAT", zlib, (u32)(out - zlib));
+    image_write_png_chunk(fp, "IEND", NULL, 0);
+    free(zlib);
+    fclose(fp);
+    return true;
+}
+
+
+void image_write_exr_attribute(FILE* fp, const char* name, const char* type, const void* data, u32 size)
+{
+    fwrite(name, 1, strlen(name) + 1, fp);
+    fwrite(type, 1, strlen(type) + 1, fp);
+    fwrite(&size, 4, 1, fp);
+    fwrite(data, 1, size, fp);
+}
+
+
+// Channels are stored as linear floats of the 8 bit values
+bool image_write_exr(const char* file_path, const u32* pixels, u32 width, u32 height)
+{
+    FILE* fp = fopen(file_path, "wb");
+    if (fp == NULL)
+    {
+        perror("Error opening file");
+        return false;
+    }
+
+    const byte magic[8] = {0x76, 0x2F, 0x31, 0x01, 2, 0, 0, 0};
+    fwrite(magic, 1, 8, fp);
+
+    // Channel list, sorted by name as the format requires
+    const char* channel_names[4] = {"A", "B", "G", "R"};
+    byte channels[4 * 18 + 1];
+    byte* c = channels;
+    for (u32 i=0; i < 4; ++i)
+    {
+        *c++ = channel_names[i][0];
+        *c++ = 0;
+        i32 pixel_type = 2;  // FLOAT
+        memcpy(c, &pixel_type, 4); c += 4;
+        memset(c, 0, 4); c += 4;  // pLinear + reserved
+        i32 sampling = 1;
+        memcpy(c, &sampling, 4); c += 4;
+        memcpy(c, &sampling, 4); c += 4;
+    }
+    *c++ = 0;
+    image_write_exr_attribute(fp, "channels", "chlist", channels, (u32)(c - channels));
+
+    byte compression = 0;
+    image_write_exr_attribute(fp, "compression", "compression", &compression, 1);
+    i32 window[4] = {0, 0, (i32)width - 1, (i32)height - 1};
+    image_write_exr_attribute(fp, "dataWindow", "box2i", window, 16);
+    image_write_exr_attribute(fp, "displayWindow", "box2i", window, 16);
+    byte line_order = 0;
+    image_write_exr_attribute(fp, "lineOrder", "lineOrder", &line_order, 1);
+    float pixel_aspect_ratio = 1.0f;
+    image_write_exr_attribute(fp, "pixelAspectRatio", "float", &pixel_aspect_ratio, 4);
+    float screen_window_center[2] = {0.0f, 0.0f};
+    image_write_exr_attribute(fp, "screenWindowCenter", "v2f", screen_window_center, 8);
+    float screen_window_width = 1.0f;
+    image_write_exr_attribute(fp, "screenWindowWidth", "float", &screen_window_width, 4);
+    fputc(0, fp);
+
+    // One scanline per chunk, the offset table points at each of them
+    u32 line_size = width * 4 * sizeof(float);
+    u64 offset = ftell(fp) + (u64)height * sizeof(u64);
+    for (u32 y=0; y < height; ++y)
+    {
+        fwrite(&offset, sizeof(u64), 1, fp);
+        offset += 8 + line_size;
+    }
+
+    float* line = (float*)malloc(line_size);
+    for (u32 y=0; y < height; ++y)
+    {
+        const u32* src = pixels + y * width;
+        for (u32 x=0; x < width; ++x)
+        {
+            line[0 * width + x] = ((src[x] >> 24) & 0xFF) / 255.0f;
+            line[1 * width + x] = ((src[x] >> 16) & 0xFF) / 255.0f;
+            line[2 * width + x] = ((src[x] >> 8) & 0xFF) / 255.0f;
+            line[3 * width + x] = (src[x] & 0xFF) / 255.0f;
+        }
+        i32 line_y = y;
+        fwrite(&line_y, 4, 1, fp);
+        fwrite(&line_size, 4, 1, fp);
+        fwrite(line, 1, line_size, fp);
+    }
+    free(line);
+    fclose(fp);
+    return true;
+}
+
+
+// Picks the format from the file extension, defaults to PNG
+bool image_write(const char* file_path, const u32* pixels, u32 width, u32 height)
+{
+    const char* extension = strrchr(file_path, '.');
+    if (extension && strcmp(extension, ".ppm") == 0)
+        return image_write_ppm(file_path, pixels, width, height);
+    if (extension && strcmp(extension, ".exr") == 0)
+        return image_write_exr(file_path, pixels, width, height);
+    return image_write_png(file_path, pixels, width, height);
+}
+
+#endif // IMAGEWRITERH
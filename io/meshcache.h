@@ -0,0 +1,355 @@
+#ifndef MESHCACHEH
+#define MESHCACHEH
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../types.h"
+#include "../debug.h"
+
+// Binary mesh cache written next to a source asset, "suzanne.obj" is cached
+// as "suzanne.obj.meshcache". The file is a header followed by the vertex
+// positions, normals, uvs and triangle indices, each array starting on a 16
+// byte boundary so it can be used straight from the mapping.
+// The cache is valid while the source has the recorded size and either the
+// recorded mtime or, when only the mtime moved, the recorded content hash.
+// NOTE(kk): Values are stored in host byte order, caches are not meant to
+// be moved between machines.
+
+#define MESHCACHE_MAGIC 0x48534D4Bu  // "KMSH"
+#define MESHCACHE_VERSION 1
+#define MESHCACHE_EXTENSION ".meshcache"
+#define MESHCACHE_ALIGNMENT 16
+
+#define MESHCACHE_HAS_NORMALS 1
+#define MESHCACHE_HAS_UVS 2
+
+
+typedef struct MeshCacheHeader
+{
+    u32 magic;
+    u32 version;
+    u64 source_size;
+    i64 source_mtime_ns;
+    u64 source_hash;
+    u32 vertex_count;
+    u32 index_count;
+    u32 flags;
+    u32 reserved0;
+    float bbox[6];
+    u32 reserved1[2];
+    // Byte offsets from the start of the file, zero when the array is absent
+    u64 positions_offset;
+    u64 normals_offset;
+    u64 uvs_offset;
+    u64 indices_offset;
+    u64 file_size;
+    u64 reserved2;
+} MeshCacheHeader;
+
+static_assert(sizeof(MeshCacheHeader) % MESHCACHE_ALIGNMENT == 0, "Mesh cache header breaks array alignment");
+
+
+// A mapped cache file, the arrays point into the mapping
+typedef struct MeshCache
+{
+    void* map;
+    size_t map_size;
+    MeshCacheHeader* header;
+    float* positions;
+    float* normals;
+    float* uvs;
+    u32* indices;
+} MeshCache;
+
+
+inline i64 meshcache_mtime_ns(struct stat &file_stat)
+{
+#ifdef __APPLE__
+    return (i64)file_stat.st_mtimespec.tv_sec * 1000000000 + file_stat.st_mtimespec.tv_nsec;
+#else
+    return (i64)file_stat.st_mtim.tv_sec * 1000000000 + file_stat.st_mtim.tv_nsec;
+#endif
+}
+
+
+// FNV-1a over 8 byte words, the tail is zero padded
+u64 meshcache_hash(const byte* data, size_t size)
+{
+    u64 hash = 14695981039346656037ULL;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        u64 word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 1099511628211ULL;
+    }
+    if (i < size)
+    {
+        u64 word = 0;
+        memcpy(&word, data + i, size - i);
+        hash = (hash ^ word) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+// Hashes the whole file, false if it can't be read
+bool meshcache_hash_file(const char* file_path, u64 &out_hash)
+{
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    size_t size = file_stat.st_size;
+    if (size == 0)
+    {
+        close(fd);
+        out_hash = meshcache_hash(NULL, 0);
+        return true;
+    }
+
+    void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    out_hash = meshcache_hash((const byte*)data, size);
+    munmap(data, size);
+    return true;
+}
+
+
+// Writes the path of the cache that belongs to source_path, false if it
+// doesn't fit
+bool meshcache_path(const char* source_path, char* out_path, size_t out_size)
+{
+    int length = snprintf(out_path, out_size, "%s%s", source_path, MESHCACHE_EXTENSION);
+    return length > 0 && (size_t)length < out_size;
+}
+
+
+inline bool meshcache_array_fits(u64 offset, u64 size, u64 file_size)
+{
+    if (offset == 0)
+        return size == 0;
+    return offset % MESHCACHE_ALIGNMENT == 0 && offset <= file_size && size <= file_size - offset;
+}
+
+
+void meshcache_close(MeshCache &cache)
+{
+    if (cache.map)
+        munmap(cache.map, cache.map_size);
+    cache = {};
+}
+
+
+// Maps the cache of source_path if it is still valid for the source. The
+// mapping stays alive until meshcache_close.
+bool meshcache_open(const char* source_path, MeshCache &out_cache)
+{
+    out_cache = {};
+
+    char cache_path[PATH_MAX];
+    if (!meshcache_path(source_path, cache_path, sizeof(cache_path)))
+        return false;
+
+    struct stat source_stat;
+    if (stat(source_path, &source_stat) != 0)
+        return false;
+
+    int fd = open(cache_path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat cache_stat;
+    if (fstat(fd, &cache_stat) != 0 || (size_t)cache_stat.st_size < sizeof(MeshCacheHeader))
+    {
+        close(fd);
+        return false;
+    }
+
+    size_t map_size = cache_stat.st_size;
+    void* map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    MeshCacheHeader* header = (MeshCacheHeader*)map;
+    u64 vertex_floats = (u64)header->vertex_count * 3;
+    bool valid = header->magic == MESHCACHE_MAGIC &&
+                 header->version == MESHCACHE_VERSION &&
+                 header->file_size == map_size &&
+                 header->source_size == (u64)source_stat.st_size &&
+                 header->index_count % 3 == 0 &&
+                 meshcache_array_fits(header->positions_offset, vertex_floats * sizeof(float), map_size) &&
+                 meshcache_array_fits(header->normals_offset,
+                                      (header->flags & MESHCACHE_HAS_NORMALS) ? vertex_floats * sizeof(float) : 0,
+                                      map_size) &&
+                 meshcache_array_fits(header->uvs_offset,
+                                      (header->flags & MESHCACHE_HAS_UVS) ? header->vertex_count * 2 * sizeof(float) : 0,
+                                      map_size) &&
+                 meshcache_array_fits(header->indices_offset, (u64)header->index_count * sizeof(u32), map_size);
+
+    // NOTE(kk): A checkout or copy touches the mtime without changing the
+    // content, fall back to the hash before throwing the cache away
+    if (valid && header->source_mtime_ns != meshcache_mtime_ns(source_stat))
+    {
+        u64 source_hash;
+        valid = meshcache_hash_file(source_path, source_hash) && source_hash == header->source_hash;
+        if (valid)
+        {
+            // Record the new mtime so later loads skip the hash
+            i64 source_mtime_ns = meshcache_mtime_ns(source_stat);
+            int write_fd = open(cache_path, O_WRONLY);
+            if (write_fd >= 0)
+            {
+                pwrite(write_fd, &source_mtime_ns, sizeof(source_mtime_ns),
+                       offsetof(MeshCacheHeader, source_mtime_ns));
+                close(write_fd);
+            }
+        }
+    }
+
+    // A cache cut short or overwritten can still carry a valid header and
+    // hash, its indices go straight to the BVH build and the GL upload
+    if (valid && header->indices_offset)
+    {
+        u32* indices = (u32*)((byte*)map + header->indices_offset);
+        for (u32 i=0; i < header->index_count && valid; ++i)
+        {
+            valid = indices[i] < header->vertex_count;
+        }
+        if (!valid)
+            print("Ignoring %s, an index is out of range", cache_path);
+    }
+
+    if (!valid)
+    {
+        munmap(map, map_size);
+        return false;
+    }
+
+    byte* base = (byte*)map;
+    out_cache.map = map;
+    out_cache.map_size = map_size;
+    out_cache.header = header;
+    out_cache.positions = header->positions_offset ? (float*)(base + header->positions_offset) : NULL;
+    out_cache.normals = header->normals_offset ? (float*)(base + header->normals_offset) : NULL;
+    out_cache.uvs = header->uvs_offset ? (float*)(base + header->uvs_offset) : NULL;
+    out_cache.indices = header->indices_offset ? (u32*)(base + header->indices_offset) : NULL;
+    return true;
+}
+
+
+inline u64 meshcache_align(u64 offset)
+{
+    return (offset + MESHCACHE_ALIGNMENT - 1) & ~(u64)(MESHCACHE_ALIGNMENT - 1);
+}
+
+
+inline bool meshcache_write_array(FILE* fp, u64 offset, const void* data, u64 size)
+{
+    if (!data || size == 0)
+        return true;
+    return fseek(fp, (long)offset, SEEK_SET) == 0 && fwrite(data, 1, size, fp) == size;
+}
+
+
+// Writes the cache for source_path. normals and uvs may be NULL. The file
+// is written under a temporary name and renamed so readers never see a
+// partial cache.
+bool meshcache_write(const char* source_path, float* positions, float* normals, float* uvs,
+                     u32 vertex_count, u32* indices, u32 index_count, float* bbox)
+{
+    char cache_path[PATH_MAX];
+    char temp_path[PATH_MAX + 16];
+    if (!meshcache_path(source_path, cache_path, sizeof(cache_path)))
+        return false;
+    snprintf(temp_path, sizeof(temp_path), "%s.%d", cache_path, (int)getpid());
+
+    struct stat source_stat;
+    MeshCacheHeader header = {};
+    if (stat(source_path, &source_stat) != 0 || !meshcache_hash_file(source_path, header.source_hash))
+        return false;
+
+    header.magic = MESHCACHE_MAGIC;
+    header.version = MESHCACHE_VERSION;
+    header.source_size = source_stat.st_size;
+    header.source_mtime_ns = meshcache_mtime_ns(source_stat);
+    header.vertex_count = vertex_count;
+    header.index_count = index_count;
+    header.flags = (normals ? MESHCACHE_HAS_NORMALS : 0) | (uvs ? MESHCACHE_HAS_UVS : 0);
+    memcpy(header.bbox, bbox, sizeof(header.bbox));
+
+    u64 positions_size = (u64)vertex_count * 3 * sizeof(float);
+    u64 normals_size = normals ? positions_size : 0;
+    u64 uvs_size = uvs ? (u64)vertex_count * 2 * sizeof(float) : 0;
+    u64 indices_size = (u64)index_count * sizeof(u32);
+
+    u64 offset = sizeof(MeshCacheHeader);
+    if (positions_size)
+    {
+        header.positions_offset = offset;
+        offset = meshcache_align(offset + positions_size);
+    }
+    if (normals_size)
+    {
+        header.normals_offset = offset;
+        offset = meshcache_align(offset + normals_size);
+    }
+    if (uvs_size)
+    {
+        header.uvs_offset = offset;
+        offset = meshcache_align(offset + uvs_size);
+    }
+    if (indices_size)
+    {
+        header.indices_offset = offset;
+        offset = meshcache_align(offset + indices_size);
+    }
+    header.file_size = offset;
+
+    FILE* fp = fopen(temp_path, "wb");
+    if (!fp)
+        return false;
+
+    bool written = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+                   meshcache_write_array(fp, header.positions_offset, positions, positions_size) &&
+                   meshcache_write_array(fp, header.normals_offset, normals, normals_size) &&
+                   meshcache_write_array(fp, header.uvs_offset, uvs, uvs_size) &&
+                   meshcache_write_array(fp, header.indices_offset, indices, indices_size);
+
+    // Pad the last array so the file ends on the recorded size
+    if (written && offset > (u64)ftell(fp))
+    {
+        byte zero = 0;
+        written = fseek(fp, (long)offset - 1, SEEK_SET) == 0 && fwrite(&zero, 1, 1, fp) == 1;
+    }
+    written &= fclose(fp) == 0;
+
+    if (!written || rename(temp_path, cache_path) != 0)
+    {
+        remove(temp_path);
+        print("Could not write mesh cache %s", cache_path);
+        return false;
+    }
+    return true;
+}
+
+#endif //MESHCACHEH
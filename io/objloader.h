@@ -1,147 +1,810 @@
 #ifndef OBJLOADERH
 #define OBJLOADERH
 
-u32 objloader_load(const char* file_path,
-                   Array &out_vertex_array,
-                   Array &out_uv_array,
-                   Array &out_normal_array)
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../types.h"
+#include "../array.h"
+#include "../arena.h"
+#include "../job_pool.h"
+#include "meshcache.h"
+
+// Wavefront OBJ loader. The file is memory mapped and cut into chunks on
+// line boundaries, the chunks are parsed in parallel on the job pool and
+// merged. Corners with the same position, uv and normal share a vertex,
+// triangles are three indices into the vertex arrays.
+// Supports v, vt, vn and f lines with v, v/vt, v//vn and v/vt/vn corners,
+// negative (relative) indices and polygons, which are triangulated as fans.
+// Faces that can't be read or point past the vertices are skipped and
+// logged, the rest of the file still loads.
+
+#define OBJ_CHUNK_SIZE (1024 * 1024)
+#define OBJ_INDEX_NONE INT_MIN
+#define OBJ_KEY_NONE 0xFFFFFFFFu
+
+#define OBJ_RELATIVE_POSITION 1
+#define OBJ_RELATIVE_UV 2
+#define OBJ_RELATIVE_NORMAL 4
+
+
+// Indices are zero based. Relative ones are counted from the start of the
+// chunk that holds the face, they can point into earlier chunks.
+typedef struct ObjCorner
 {
-    FILE *fp;
-    char line[256];
-    u32 totalRead = 0;
+    i32 position;
+    i32 uv;
+    i32 normal;
+    u32 relative;
+} ObjCorner;
 
-    /* opening file for reading */
-    fp = fopen(file_path, "r");
-    if(fp == NULL) {
-        perror("Error opening file");
-        return(-1);
+
+typedef struct ObjChunk
+{
+    const char* begin;
+    const char* end;
+
+    float* positions;
+    float* uvs;
+    float* normals;
+    ObjCorner* corners;
+    u32 position_count;
+    u32 uv_count;
+    u32 normal_count;
+    u32 corner_count;
+    u32 position_capacity;
+    u32 uv_capacity;
+    u32 normal_capacity;
+    u32 corner_capacity;
+    bool has_uvs;
+    bool has_normals;
+
+    // Faces that can't be read are skipped, first_malformed is the line of
+    // the first one
+    u32 malformed_count;
+    const char* first_malformed;
+    const char* first_malformed_end;
+
+    // Filled in by the merge for the second pass
+    u32 position_base;
+    u32 uv_base;
+    u32 normal_base;
+    u32 corner_base;
+    struct ObjMerge* merge;
+} ObjChunk;
+
+
+typedef struct ObjMerge
+{
+    float* positions;
+    float* uvs;
+    float* normals;
+    u32 position_count;
+    u32 uv_count;
+    u32 normal_count;
+    u32* keys;  // position, uv and normal index of every corner
+} ObjMerge;
+
+
+static const double objloader_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+inline bool objloader_is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+
+inline const char* objloader_skip_space(const char* p, const char* end)
+{
+    while (p < end && objloader_is_space(*p))
+        p++;
+    return p;
+}
+
+
+// Returns NULL when there is no number at p. Mantissas of up to 19 digits
+// are exact and exponents up to 22 take one correctly rounded multiply or
+// divide, everything else falls back to pow.
+const char* objloader_parse_float(const char* p, const char* end, float &out)
+{
+    p = objloader_skip_space(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        p++;
+    }
+
+    u64 mantissa = 0;
+    i32 exponent = 0;
+    u32 digit_count = 0;
+    u32 significant_count = 0;
+    while (p < end && (u32)(*p - '0') < 10)
+    {
+        if (significant_count < 19)
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa)
+                significant_count++;
+        }
+        else
+        {
+            exponent++;
+        }
+        digit_count++;
+        p++;
+    }
+    if (p < end && *p == '.')
+    {
+        p++;
+        while (p < end && (u32)(*p - '0') < 10)
+        {
+            if (significant_count < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa)
+                    significant_count++;
+                exponent--;
+            }
+            digit_count++;
+            p++;
+        }
+    }
+    if (digit_count == 0)
+        return NULL;
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char* exponent_start = p++;
+        bool negative_exponent = false;
+        if (p < end && (*p == '-' || *p == '+'))
+        {
+            negative_exponent = *p == '-';
+            p++;
+        }
+        if (p < end && (u32)(*p - '0') < 10)
+        {
+            i32 value = 0;
+            while (p < end && (u32)(*p - '0') < 10)
+            {
+                if (value < 10000)
+                    value = value * 10 + (*p - '0');
+                p++;
+            }
+            exponent += negative_exponent ? -value : value;
+        }
+        else
+        {
+            p = exponent_start;
+        }
+    }
+
+    double value = (double)mantissa;
+    if (mantissa == 0)
+        value = 0;
+    else if (exponent >= 0 && exponent <= 22)
+        value *= objloader_powers_of_ten[exponent];
+    else if (exponent < 0 && exponent >= -22)
+        value /= objloader_powers_of_ten[-exponent];
+    else
+        value *= pow(10.0, exponent);
+
+    out = (float)(negative ? -value : value);
+    return p;
+}
+
+
+const char* objloader_parse_int(const char* p, const char* end, i32 &out)
+{
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        p++;
+    }
+    if (p == end || (u32)(*p - '0') >= 10)
+        return NULL;
+
+    i64 value = 0;
+    while (p < end && (u32)(*p - '0') < 10)
+    {
+        if (value <= INT_MAX)
+            value = value * 10 + (*p - '0');
+        p++;
     }
+    if (value > INT_MAX)
+        return NULL;
+    out = (i32)(negative ? -value : value);
+    return p;
+}
+
+
+// Grows a chunk buffer to hold count elements
+void objloader_reserve(void** data, u32 &capacity, u32 count, size_t element_size)
+{
+    if (count <= capacity)
+        return;
+    capacity = capacity ? capacity * 2 : 1024;
+    if (capacity < count)
+        capacity = count;
+    *data = realloc(*data, capacity * element_size);
+}
 
-    Array temp_vertex_array;
-    array_init(temp_vertex_array, 3 * sizeof(float), 1024*1024);
 
-    Array temp_uv_array;
-    array_init(temp_uv_array, 2 * sizeof(float), 1024*1024);
+// Makes an OBJ index zero based, relative ones are resolved against the
+// chunk and flagged so the merge can add the chunk's base
+inline i32 objloader_local_index(i32 index, u32 local_count, u32 relative_flag, u32 &relative)
+{
+    if (index > 0)
+        return index - 1;
+    relative |= relative_flag;
+    return (i32)local_count + index;
+}
+
 
-    Array temp_normal_array;
-    array_init(temp_normal_array, 3 * sizeof(float), 1024*1024);
+// Parses one face corner, 0 means an absent index
+const char* objloader_parse_corner(const char* p, const char* end, ObjChunk &chunk, ObjCorner &corner)
+{
+    i32 position = 0;
+    i32 uv = 0;
+    i32 normal = 0;
+    p = objloader_parse_int(p, end, position);
+    if (p == NULL || position == 0)
+        return NULL;
 
-    while(fgets(line, 256, fp) != NULL) 
+    if (p < end && *p == '/')
     {
-        totalRead = strlen(line);
-        /*
-         * Trim new line character from last if exists.
-         */
-        line[totalRead - 1] = line[totalRead - 1] == '\n' ? '\0' : line[totalRead - 1];
+        p++;
+        if (p < end && *p != '/')
+        {
+            p = objloader_parse_int(p, end, uv);
+            if (p == NULL || uv == 0)
+                return NULL;
+        }
+        if (p < end && *p == '/')
+        {
+            p = objloader_parse_int(p + 1, end, normal);
+            if (p == NULL || normal == 0)
+                return NULL;
+        }
+    }
+    if (p < end && !objloader_is_space(*p))
+        return NULL;
 
-        char data_type = line[0];
-        char data_type_2 = line[1];
-        if (data_type == 'v' && data_type_2 == ' ')
+    corner.relative = 0;
+    corner.position = objloader_local_index(position, chunk.position_count, OBJ_RELATIVE_POSITION, corner.relative);
+    corner.uv = OBJ_INDEX_NONE;
+    corner.normal = OBJ_INDEX_NONE;
+    if (uv)
+    {
+        corner.uv = objloader_local_index(uv, chunk.uv_count, OBJ_RELATIVE_UV, corner.relative);
+        chunk.has_uvs = true;
+    }
+    if (normal)
+    {
+        corner.normal = objloader_local_index(normal, chunk.normal_count, OBJ_RELATIVE_NORMAL, corner.relative);
+        chunk.has_normals = true;
+    }
+    return p;
+}
+
+
+// Leaves the chunk as it was when the face can't be read
+bool objloader_parse_face(const char* p, const char* end, ObjChunk &chunk)
+{
+    u32 first_corner = chunk.corner_count;
+    ObjCorner first;
+    ObjCorner previous;
+    u32 corner_count = 0;
+    while (true)
+    {
+        p = objloader_skip_space(p, end);
+        if (p == end)
+            break;
+
+        ObjCorner corner;
+        p = objloader_parse_corner(p, end, chunk, corner);
+        if (p == NULL)
         {
-            float vert[3] = {0};
-            int matches = sscanf(line, "v %f %f %f\n", &vert[0], &vert[1], &vert[2]);
-            if (matches == 3)
-                array_append(temp_vertex_array, &vert);
+            chunk.corner_count = first_corner;
+            return false;
         }
-        else if (data_type == 'v' && data_type_2 == 't')
+
+        if (corner_count == 0)
         {
-            float uv[2] = {0};
-            int matches = sscanf(line, "vt %f %f\n", &uv[0], &uv[1]);
-            // TODO account for 3 floats in data?
-            if(matches == 2)
-                array_append(temp_uv_array, &uv);
+            first = corner;
         }
-        else if (data_type == 'v' && data_type_2 == 'n')
+        else if (corner_count >= 2)
         {
-            float normal[3] = {0};
-            int matches = sscanf(line, "vn %f %f %f\n", &normal[0], &normal[1], &normal[2]);
-            if (matches == 3)
-                array_append(temp_normal_array, &normal);
+            objloader_reserve((void**)&chunk.corners, chunk.corner_capacity,
+                              chunk.corner_count + 3, sizeof(ObjCorner));
+            chunk.corners[chunk.corner_count++] = first;
+            chunk.corners[chunk.corner_count++] = previous;
+            chunk.corners[chunk.corner_count++] = corner;
         }
-        else if (data_type == 'f')
+        previous = corner;
+        corner_count++;
+    }
+    if (corner_count < 3)
+    {
+        chunk.corner_count = first_corner;
+        return false;
+    }
+    return true;
+}
+
+
+// Reads up to count floats, returns how many were found
+u32 objloader_parse_floats(const char* p, const char* end, float* out, u32 count)
+{
+    for (u32 i=0; i < count; ++i)
+    {
+        p = objloader_parse_float(p, end, out[i]);
+        if (p == NULL)
+            return i;
+    }
+    return count;
+}
+
+
+// Job pool entry point, first pass over one chunk
+void objloader_parse_chunk(void* args)
+{
+    ObjChunk &chunk = *(ObjChunk*)args;
+    const char* p = chunk.begin;
+    while (p < chunk.end)
+    {
+        const char* line_end = (const char*)memchr(p, '\n', chunk.end - p);
+        if (line_end == NULL)
+            line_end = chunk.end;
+
+        p = objloader_skip_space(p, line_end);
+        if (line_end - p >= 2 && p[0] == 'v' && objloader_is_space(p[1]))
         {
-            u32 vert_idx[3] = {0};
-            u32 uv_idx[3] = {0};
-            u32 normal_idx[3] = {0};
-            int matches = sscanf(line, "f %d %d %d\n", &vert_idx[0], &vert_idx[1], &vert_idx[2]);
-            if(matches == 3)
+            // NOTE(kk): Lines with too few numbers are skipped like before
+            float position[3];
+            if (objloader_parse_floats(p + 2, line_end, position, 3) == 3)
             {
-                float* vert1 = (float*)array_get_index(temp_vertex_array, vert_idx[0] - 1);
-                float* vert2 = (float*)array_get_index(temp_vertex_array, vert_idx[1] - 1);
-                float* vert3 = (float*)array_get_index(temp_vertex_array, vert_idx[2] - 1);
-                array_extend(out_vertex_array, vert1, 3);
-                array_extend(out_vertex_array, vert2, 3);
-                array_extend(out_vertex_array, vert3, 3);
+                objloader_reserve((void**)&chunk.positions, chunk.position_capacity,
+                                  chunk.position_count + 1, 3 * sizeof(float));
+                memcpy(chunk.positions + chunk.position_count++ * 3, position, sizeof(position));
             }
-            else
+        }
+        else if (line_end - p >= 3 && p[0] == 'v' && p[1] == 't' && objloader_is_space(p[2]))
+        {
+            // A third w component is ignored
+            float uv[2];
+            if (objloader_parse_floats(p + 3, line_end, uv, 2) == 2)
             {
-                u32 matches = sscanf(line, "f %d/%d/%d %d/%d/%d %d/%d/%d\n",
-                    &vert_idx[0], &uv_idx[0], &normal_idx[0],
-                    &vert_idx[1], &uv_idx[1], &normal_idx[1],
-                    &vert_idx[2], &uv_idx[2], &normal_idx[2]);
-                if(matches == 9)
-                {
-                    float* vert1 = (float*)array_get_index(temp_vertex_array, vert_idx[0] - 1);
-                    float* vert2 = (float*)array_get_index(temp_vertex_array, vert_idx[1] - 1);
-                    float* vert3 = (float*)array_get_index(temp_vertex_array, vert_idx[2] - 1);
-                    array_extend(out_vertex_array, vert1, 3);
-                    array_extend(out_vertex_array, vert2, 3);
-                    array_extend(out_vertex_array, vert3, 3);
-
-                    float* uv1 = (float*)array_get_index(temp_uv_array, uv_idx[0] - 1);
-                    float* uv2 = (float*)array_get_index(temp_uv_array, uv_idx[1] - 1);
-                    float* uv3 = (float*)array_get_index(temp_uv_array, uv_idx[2] - 1);
-                    array_extend(out_uv_array, uv1, 3);
-                    array_extend(out_uv_array, uv2, 3);
-                    array_extend(out_uv_array, uv3, 3);
-
-                    float* normal1 = (float*)array_get_index(temp_normal_array, normal_idx[0] - 1);
-                    float* normal2 = (float*)array_get_index(temp_normal_array, normal_idx[1] - 1);
-                    float* normal3 = (float*)array_get_index(temp_normal_array, normal_idx[2] - 1);
-                    array_extend(out_normal_array, normal1, 3);
-                    array_extend(out_normal_array, normal2, 3);
-                    array_extend(out_normal_array, normal3, 3);
-
-                    //print("normal1 %f %f %f", normal1[0], normal1[1], normal1[2]);
-                    //print("normal2 %f %f %f", normal2[0], normal2[1], normal2[2]);
-                    //print("normal3 %f %f %f", normal3[0], normal3[1], normal3[2]);
-                }
-                else
+                objloader_reserve((void**)&chunk.uvs, chunk.uv_capacity,
+                                  chunk.uv_count + 1, 2 * sizeof(float));
+                memcpy(chunk.uvs + chunk.uv_count++ * 2, uv, sizeof(uv));
+            }
+        }
+        else if (line_end - p >= 3 && p[0] == 'v' && p[1] == 'n' && objloader_is_space(p[2]))
+        {
+            float normal[3];
+            if (objloader_parse_floats(p + 3, line_end, normal, 3) == 3)
+            {
+                objloader_reserve((void**)&chunk.normals, chunk.normal_capacity,
+                                  chunk.normal_count + 1, 3 * sizeof(float));
+                memcpy(chunk.normals + chunk.normal_count++ * 3, normal, sizeof(normal));
+            }
+        }
+        else if (line_end - p >= 2 && p[0] == 'f' && objloader_is_space(p[1]))
+        {
+            if (!objloader_parse_face(p + 2, line_end, chunk))
+            {
+                if (chunk.malformed_count++ == 0)
                 {
-                     return -1;
+                    chunk.first_malformed = p;
+                    chunk.first_malformed_end = line_end;
                 }
+            }
+        }
+        p = line_end + 1;
+    }
+}
+
+
+inline bool objloader_resolve_index(i32 index, u32 relative, u32 base, u32 count, u32 &out)
+{
+    i64 resolved = relative ? (i64)base + index : index;
+    if (resolved < 0 || resolved >= count)
+        return false;
+    out = (u32)resolved;
+    return true;
+}
+
+
+// Job pool entry point, second pass resolving the chunk's corners to
+// global (position, uv, normal) keys. Corners with an index out of range
+// get OBJ_KEY_NONE as position, objloader_drop_invalid removes their
+// triangles.
+void objloader_resolve_chunk(void* args)
+{
+    ObjChunk &chunk = *(ObjChunk*)args;
+    ObjMerge &merge = *chunk.merge;
+    for (u32 i=0; i < chunk.corner_count; ++i)
+    {
+        ObjCorner &corner = chunk.corners[i];
+        u32* key = merge.keys + (size_t)(chunk.corner_base + i) * 3;
+        key[1] = OBJ_KEY_NONE;
+        key[2] = OBJ_KEY_NONE;
+
+        bool valid = objloader_resolve_index(corner.position, corner.relative & OBJ_RELATIVE_POSITION,
+                                             chunk.position_base, merge.position_count, key[0]);
+        if (valid && corner.uv != OBJ_INDEX_NONE)
+            valid = objloader_resolve_index(corner.uv, corner.relative & OBJ_RELATIVE_UV,
+                                            chunk.uv_base, merge.uv_count, key[1]);
+        if (valid && corner.normal != OBJ_INDEX_NONE)
+            valid = objloader_resolve_index(corner.normal, corner.relative & OBJ_RELATIVE_NORMAL,
+                                            chunk.normal_base, merge.normal_count, key[2]);
+        if (!valid)
+            key[0] = OBJ_KEY_NONE;
+    }
+}
 
+
+// Removes the triangles with an unresolved corner from merge.keys, returns
+// the corner count left
+u32 objloader_drop_invalid(ObjMerge &merge, u32 corner_count)
+{
+    u32 kept_count = 0;
+    for (u32 i=0; i < corner_count; i += 3)
+    {
+        u32* key = merge.keys + (size_t)i * 3;
+        if (key[0] == OBJ_KEY_NONE || key[3] == OBJ_KEY_NONE || key[6] == OBJ_KEY_NONE)
+            continue;
+        if (kept_count != i)
+            memmove(merge.keys + (size_t)kept_count * 3, key, 9 * sizeof(u32));
+        kept_count += 3;
+    }
+    return kept_count;
+}
+
+
+inline u32 objloader_hash_key(const u32* key)
+{
+    u32 hash = key[0] * 0x9E3779B1u;
+    hash ^= (key[1] + 0x7F4A7C15u) * 0x85EBCA77u;
+    hash ^= (key[2] + 0x165667B1u) * 0xC2B2AE3Du;
+    return hash ^ (hash >> 15);
+}
+
+
+// Gives every distinct key a vertex, numbered in order of first use so
+// neighbouring triangles share nearby vertices. Writes one index per corner
+// and the key of every vertex to unique_keys, returns the vertex count.
+u32 objloader_deduplicate(ObjMerge &merge, u32 corner_count, u32* indices, u32* unique_keys,
+                          Arena &scratch)
+{
+    u32 vertex_count = 0;
+
+    // Without uvs and normals a vertex is just its position
+    if (merge.uv_count == 0 && merge.normal_count == 0)
+    {
+        u32* remap = (u32*)arena_alloc(scratch, ((size_t)merge.position_count + 1) * sizeof(u32));
+        memset(remap, 0xFF, ((size_t)merge.position_count + 1) * sizeof(u32));
+        for (u32 i=0; i < corner_count; ++i)
+        {
+            u32 position = merge.keys[(size_t)i * 3];
+            if (remap[position] == OBJ_KEY_NONE)
+            {
+                remap[position] = vertex_count;
+                memcpy(unique_keys + (size_t)vertex_count * 3, merge.keys + (size_t)i * 3, 3 * sizeof(u32));
+                vertex_count++;
             }
+            indices[i] = remap[position];
         }
+        return vertex_count;
     }
-    array_free(temp_vertex_array);
-    array_free(temp_uv_array);
-    array_free(temp_normal_array);
-    fclose(fp);
 
-    return 0;
+    u32 capacity = 16;
+    while (capacity < corner_count * 2)
+        capacity *= 2;
+    u32* slots = (u32*)arena_alloc(scratch, (size_t)capacity * sizeof(u32));
+    memset(slots, 0xFF, (size_t)capacity * sizeof(u32));
+
+    for (u32 i=0; i < corner_count; ++i)
+    {
+        const u32* key = merge.keys + (size_t)i * 3;
+        u32 slot = objloader_hash_key(key) & (capacity - 1);
+        while (true)
+        {
+            u32 vertex = slots[slot];
+            if (vertex == OBJ_KEY_NONE)
+            {
+                slots[slot] = vertex_count;
+                memcpy(unique_keys + (size_t)vertex_count * 3, key, 3 * sizeof(u32));
+                indices[i] = vertex_count++;
+                break;
+            }
+            if (memcmp(unique_keys + (size_t)vertex * 3, key, 3 * sizeof(u32)) == 0)
+            {
+                indices[i] = vertex;
+                break;
+            }
+            slot = (slot + 1) & (capacity - 1);
+        }
+    }
+    return vertex_count;
+}
+
+
+// Copies the attributes of every vertex, missing uvs and normals are zero
+void objloader_emit_vertices(ObjMerge &merge, u32* unique_keys, u32 vertex_count,
+                             float* out_positions, float* out_uvs, float* out_normals)
+{
+    for (u32 i=0; i < vertex_count; ++i)
+    {
+        const u32* key = unique_keys + (size_t)i * 3;
+        memcpy(out_positions + (size_t)i * 3, merge.positions + (size_t)key[0] * 3, 3 * sizeof(float));
+
+        if (out_uvs)
+        {
+            float* uv = out_uvs + (size_t)i * 2;
+            if (key[1] != OBJ_KEY_NONE)
+                memcpy(uv, merge.uvs + (size_t)key[1] * 2, 2 * sizeof(float));
+            else
+                uv[0] = uv[1] = 0;
+        }
+
+        if (out_normals)
+        {
+            float* normal = out_normals + (size_t)i * 3;
+            if (key[2] != OBJ_KEY_NONE)
+                memcpy(normal, merge.normals + (size_t)key[2] * 3, 3 * sizeof(float));
+            else
+                normal[0] = normal[1] = normal[2] = 0;
+        }
+    }
 }
 
-Mesh objloader_create_mesh(const char* file_path)
+
+// Runs the jobs on the pool, or right here when it has not been started
+void objloader_run_chunks(JobFunction function, ObjChunk* chunks, u32 chunk_count)
+{
+    if (job_pool.worker_count == 0)
+    {
+        for (u32 i=0; i < chunk_count; ++i)
+        {
+            function(&chunks[i]);
+        }
+        return;
+    }
+
+    JobCounter counter = {};
+    job_pool_submit(job_pool, function, chunks, sizeof(ObjChunk), chunk_count, counter);
+    job_pool_wait(job_pool, counter);
+}
+
+
+// Concatenates the vertex data of all chunks and gives every chunk the
+// offset of its data in the result
+void objloader_merge_vertex_data(ObjChunk* chunks, u32 chunk_count, ObjMerge &merge, Arena &scratch)
 {
+    for (u32 i=0; i < chunk_count; ++i)
+    {
+        ObjChunk &chunk = chunks[i];
+        chunk.position_base = merge.position_count;
+        chunk.uv_base = merge.uv_count;
+        chunk.normal_base = merge.normal_count;
+        merge.position_count += chunk.position_count;
+        merge.uv_count += chunk.uv_count;
+        merge.normal_count += chunk.normal_count;
+    }
+
+    merge.positions = (float*)arena_alloc(scratch, ((size_t)merge.position_count * 3 + 1) * sizeof(float));
+    merge.uvs = (float*)arena_alloc(scratch, ((size_t)merge.uv_count * 2 + 1) * sizeof(float));
+    merge.normals = (float*)arena_alloc(scratch, ((size_t)merge.normal_count * 3 + 1) * sizeof(float));
+    for (u32 i=0; i < chunk_count; ++i)
+    {
+        ObjChunk &chunk = chunks[i];
+        memcpy(merge.positions + (size_t)chunk.position_base * 3, chunk.positions,
+               (size_t)chunk.position_count * 3 * sizeof(float));
+        memcpy(merge.uvs + (size_t)chunk.uv_base * 2, chunk.uvs,
+               (size_t)chunk.uv_count * 2 * sizeof(float));
+        memcpy(merge.normals + (size_t)chunk.normal_base * 3, chunk.normals,
+               (size_t)chunk.normal_count * 3 * sizeof(float));
+    }
+}
+
+
+// Fills the arrays with indexed triangles, false when the file can't be
+// read. Faces that can't be parsed or point at missing vertices are
+// skipped and logged.
+bool objloader_load(const char* file_path,
+                   Array &out_vertex_array,
+                   Array &out_uv_array,
+                   Array &out_normal_array,
+                   Array &out_index_array)
+{
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("Error opening file");
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0)
+    {
+        close(fd);
+        return true;
+    }
+
+    size_t file_size = file_stat.st_size;
+    const char* data = (const char*)mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        perror("Error mapping file");
+        return false;
+    }
+
+    // Everything but the chunk buffers, which grow on the workers, is
+    // scratch memory given back when the load is done
+    Arena &scratch = arena_thread_scratch();
+    ArenaMark scratch_mark = arena_mark(scratch);
+
+    // Chunks start right after a newline so no line is ever split
+    u32 chunk_count = (u32)(file_size / OBJ_CHUNK_SIZE) + 1;
+    ObjChunk* chunks = (ObjChunk*)arena_alloc_zero(scratch, chunk_count * sizeof(ObjChunk));
+    const char* file_end = data + file_size;
+    const char* chunk_begin = data;
+    u32 used_chunk_count = 0;
+    for (u32 i=0; i < chunk_count && chunk_begin < file_end; ++i)
+    {
+        const char* chunk_end = file_end;
+        if (i + 1 < chunk_count)
+        {
+            const char* split = data + (size_t)(i + 1) * OBJ_CHUNK_SIZE;
+            if (split < chunk_begin)
+                split = chunk_begin;
+            const char* newline = (const char*)memchr(split, '\n', file_end - split);
+            chunk_end = newline ? newline + 1 : file_end;
+        }
+        chunks[used_chunk_count].begin = chunk_begin;
+        chunks[used_chunk_count].end = chunk_end;
+        used_chunk_count++;
+        chunk_begin = chunk_end;
+    }
+    chunk_count = used_chunk_count;
+
+    objloader_run_chunks(objloader_parse_chunk, chunks, chunk_count);
+
+    bool has_uvs = false;
+    bool has_normals = false;
+    u32 corner_count = 0;
+    u32 malformed_count = 0;
+    for (u32 i=0; i < chunk_count; ++i)
+    {
+        has_uvs |= chunks[i].has_uvs;
+        has_normals |= chunks[i].has_normals;
+        chunks[i].corner_base = corner_count;
+        corner_count += chunks[i].corner_count;
+
+        if (chunks[i].malformed_count > 0 && malformed_count == 0)
+        {
+            print("Skipped malformed face in %s: %.*s", file_path,
+                  (int)(chunks[i].first_malformed_end - chunks[i].first_malformed), chunks[i].first_malformed);
+        }
+        malformed_count += chunks[i].malformed_count;
+    }
+    if (malformed_count > 1)
+        print("Skipped %u malformed faces in %s", malformed_count, file_path);
+
+    ObjMerge merge = {};
+    objloader_merge_vertex_data(chunks, chunk_count, merge, scratch);
+
+    merge.keys = (u32*)arena_alloc(scratch, ((size_t)corner_count * 3 + 1) * sizeof(u32));
+    for (u32 i=0; i < chunk_count; ++i)
+    {
+        chunks[i].merge = &merge;
+    }
+    objloader_run_chunks(objloader_resolve_chunk, chunks, chunk_count);
+
+    u32 resolved_count = objloader_drop_invalid(merge, corner_count);
+    if (resolved_count < corner_count)
+    {
+        print("Skipped %u triangles with indices out of range in %s",
+              (corner_count - resolved_count) / 3, file_path);
+        corner_count = resolved_count;
+    }
+
+    u32* unique_keys = (u32*)arena_alloc(scratch, ((size_t)corner_count * 3 + 1) * sizeof(u32));
+    array_resize(out_index_array, corner_count);
+    u32 vertex_count = objloader_deduplicate(merge, corner_count, (u32*)out_index_array.base_ptr,
+                                              unique_keys, scratch);
+
+    array_resize(out_vertex_array, vertex_count * 3);
+    float* out_uvs = NULL;
+    float* out_normals = NULL;
+    if (has_uvs)
+    {
+        array_resize(out_uv_array, vertex_count * 2);
+        out_uvs = (float*)out_uv_array.base_ptr;
+    }
+    if (has_normals)
+    {
+        array_resize(out_normal_array, vertex_count * 3);
+        out_normals = (float*)out_normal_array.base_ptr;
+    }
+    objloader_emit_vertices(merge, unique_keys, vertex_count,
+                            (float*)out_vertex_array.base_ptr, out_uvs, out_normals);
+
+    for (u32 i=0; i < chunk_count; ++i)
+    {
+        free(chunks[i].positions);
+        free(chunks[i].uvs);
+        free(chunks[i].normals);
+        free(chunks[i].corners);
+    }
+    arena_pop_to(scratch, scratch_mark);
+    munmap((void*)data, file_size);
+
+    return true;
+}
+
+// Loads the geometry from its binary cache when that is still valid, the
+// arrays then point into the cache mapping. Otherwise the OBJ is parsed
+// and the cache written for the next run. Returns geometry without
+// vertices when the file can't be loaded.
+MeshGeometry* objloader_create_geometry(const char* file_path)
+{
+    // NOTE(kk): Geometry lives until exit, so the mapping is never closed
+    MeshCache cache;
+    if (meshcache_open(file_path, cache))
+    {
+        return mesh_geometry_create(cache.positions, NULL, cache.normals,
+                                    cache.header->vertex_count * 3,
+                                    cache.indices, cache.header->index_count, 3);
+    }
+
+    // objloader_load sizes the arrays exactly, don't reserve up front
     Array vertex_array;
-    array_init(vertex_array, sizeof(float), 1024*1024);
+    array_init(vertex_array, sizeof(float), 16);
     Array uv_array;
-    array_init(uv_array, sizeof(float), 1024*1024);
+    array_init(uv_array, sizeof(float), 16);
     Array normals_array;
-    array_init(normals_array, sizeof(float), 1024*1024);
+    array_init(normals_array, sizeof(float), 16);
+    Array index_array;
+    array_init(index_array, sizeof(u32), 16);
+
+    bool loaded = objloader_load(file_path, vertex_array, uv_array, normals_array, index_array);
 
-    objloader_load(file_path, vertex_array, uv_array, normals_array);
+    float* normals = NULL;
+    if (normals_array.element_count > 0)
+        normals = (float*)normals_array.base_ptr;
+    else
+        array_free(normals_array);
 
-    Mesh mesh;
-    mesh.vertex_array_length = vertex_array.element_count;
-    mesh.vertex_positions = (float*)vertex_array.base_ptr;
-    mesh.vertex_normals = (float*)normals_array.base_ptr;
-    mesh.vertex_colors = NULL;
-    mesh.model_matrix  = glm::mat4(1.0);
+    MeshGeometry* geometry = mesh_geometry_create((float*)vertex_array.base_ptr, NULL, normals,
+                                                  vertex_array.element_count,
+                                                  (u32*)index_array.base_ptr, index_array.element_count, 3);
+
+    if (loaded && geometry->index_count > 0)
+    {
+        float* uvs = uv_array.element_count > 0 ? (float*)uv_array.base_ptr : NULL;
+        meshcache_write(file_path, geometry->vertex_positions, geometry->vertex_normals, uvs,
+                        geometry->vertex_array_length / 3, geometry->indices, geometry->index_count,
+                        geometry->bbox);
+    }
+    array_free(uv_array);
 
-    mesh_init(mesh, 3);
-    return mesh;
+    return geometry;
 }
 
 #endif //OBJLOADERH
@@ -0,0 +1,328 @@
+#ifndef JOBPOOLH
+#define JOBPOOLH
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/thread_policy.h>
+#endif
+
+#include "types.h"
+#include "arena.h"
+
+// Persistent worker threads shared by everything that wants to run work in
+// parallel. Each worker owns a deque, it takes its own jobs newest first and
+// steals the oldest jobs of the others when it runs dry. The thread calling
+// job_pool_wait is worker 0 and helps with the work instead of blocking.
+
+#define JOB_DEQUE_INITIAL_CAPACITY 256
+
+
+typedef void (*JobFunction)(void* data);
+
+
+// Number of jobs of a batch still to finish, job_pool_wait spins on it
+typedef struct JobCounter
+{
+    volatile u32 remaining;
+} JobCounter;
+
+
+typedef struct Job
+{
+    JobFunction function;
+    void* data;
+    JobCounter* counter;
+} Job;
+
+
+// Ring buffer, the owner pushes and pops at the tail, thieves take the head
+typedef struct JobDeque
+{
+    pthread_mutex_t mutex;
+    Job* jobs;
+    u32 capacity;
+    u32 head;
+    u32 count;
+} JobDeque;
+
+
+typedef struct JobPool
+{
+    JobDeque* deques;
+    pthread_t* threads;
+    u32 worker_count;  // including the waiting thread
+    volatile u32 next_deque;
+    volatile u32 queued_count;
+    volatile bool running;
+    pthread_mutex_t sleep_mutex;
+    pthread_cond_t wake_condition;
+} JobPool;
+
+
+typedef struct JobWorkerArgs
+{
+    JobPool* pool;
+    u32 index;
+} JobWorkerArgs;
+
+
+static thread_local u32 job_worker_index = 0;
+
+// Shared by every subsystem, the entry point starts and stops it
+static JobPool job_pool;
+
+
+void job_deque_push(JobDeque &deque, Job &job)
+{
+    pthread_mutex_lock(&deque.mutex);
+    if (deque.count == deque.capacity)
+    {
+        // Unwrap into a buffer twice the size
+        u32 new_capacity = deque.capacity * 2;
+        Job* jobs = (Job*)malloc(sizeof(Job) * new_capacity);
+        for (u32 i=0; i < deque.count; ++i)
+        {
+            jobs[i] = deque.jobs[(deque.head + i) % deque.capacity];
+        }
+        free(deque.jobs);
+        deque.jobs = jobs;
+        deque.capacity = new_capacity;
+        deque.head = 0;
+    }
+    deque.jobs[(deque.head + deque.count) % deque.capacity] = job;
+    deque.count++;
+    pthread_mutex_unlock(&deque.mutex);
+}
+
+
+bool job_deque_pop(JobDeque &deque, Job &job)
+{
+    pthread_mutex_lock(&deque.mutex);
+    bool found = deque.count > 0;
+    if (found)
+    {
+        deque.count--;
+        job = deque.jobs[(deque.head + deque.count) % deque.capacity];
+    }
+    pthread_mutex_unlock(&deque.mutex);
+    return found;
+}
+
+
+bool job_deque_steal(JobDeque &deque, Job &job)
+{
+    pthread_mutex_lock(&deque.mutex);
+    bool found = deque.count > 0;
+    if (found)
+    {
+        job = deque.jobs[deque.head];
+        deque.head = (deque.head + 1) % deque.capacity;
+        deque.count--;
+    }
+    pthread_mutex_unlock(&deque.mutex);
+    return found;
+}
+
+
+bool job_pool_take(JobPool &pool, u32 worker_index, Job &job)
+{
+    if (job_deque_pop(pool.deques[worker_index], job))
+    {
+        __sync_fetch_and_sub(&pool.queued_count, 1);
+        return true;
+    }
+
+    for (u32 i=1; i < pool.worker_count; ++i)
+    {
+        u32 victim = (worker_index + i) % pool.worker_count;
+        if (job_deque_steal(pool.deques[victim], job))
+        {
+            __sync_fetch_and_sub(&pool.queued_count, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void job_run(Job &job)
+{
+    job.function(job.data);
+    if (job.counter)
+        __sync_fetch_and_sub(&job.counter->remaining, 1);
+}
+
+
+// Pinning is only a hint on macOS, the kernel groups threads with the same
+// affinity tag but does not bind them to a core
+void job_pin_thread(pthread_t thread, u32 core)
+{
+#if defined(__linux__)
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(core, &cpu_set);
+    pthread_setaffinity_np(thread, sizeof(cpu_set), &cpu_set);
+#elif defined(__APPLE__)
+    thread_affinity_policy_data_t policy = { (integer_t)(core + 1) };
+    thread_policy_set(pthread_mach_thread_np(thread), THREAD_AFFINITY_POLICY,
+                      (thread_policy_t)&policy, THREAD_AFFINITY_POLICY_COUNT);
+#endif
+}
+
+
+void* job_worker_thread(void* args)
+{
+    JobWorkerArgs* worker_args = (JobWorkerArgs*)args;
+    JobPool &pool = *worker_args->pool;
+    job_worker_index = worker_args->index;
+    free(worker_args);
+
+    while (__atomic_load_n(&pool.running, __ATOMIC_ACQUIRE))
+    {
+        Job job;
+        if (job_pool_take(pool, job_worker_index, job))
+        {
+            job_run(job);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool.sleep_mutex);
+        while (pool.running && __atomic_load_n(&pool.queued_count, __ATOMIC_ACQUIRE) == 0)
+        {
+            pthread_cond_wait(&pool.wake_condition, &pool.sleep_mutex);
+        }
+        pthread_mutex_unlock(&pool.sleep_mutex);
+    }
+
+    if (thread_scratch_arena.block)
+        arena_free(thread_scratch_arena);
+    return NULL;
+}
+
+
+// thread_count includes the calling thread, 0 uses one thread per core but
+// at least one worker besides the calling thread. With thread_count 1 jobs
+// only run inside job_pool_wait, callers that submit and go on need 2.
+void job_pool_init(JobPool &pool, u32 thread_count, bool pin_threads)
+{
+    u32 core_count = std::thread::hardware_concurrency();
+    if (core_count == 0)
+        core_count = 1;
+    if (thread_count == 0)
+        thread_count = core_count > 1 ? core_count : 2;
+
+    pool.worker_count = thread_count;
+    pool.next_deque = 0;
+    pool.queued_count = 0;
+    pool.running = true;
+    pthread_mutex_init(&pool.sleep_mutex, NULL);
+    pthread_cond_init(&pool.wake_condition, NULL);
+
+    pool.deques = (JobDeque*)calloc(thread_count, sizeof(JobDeque));
+    for (u32 i=0; i < thread_count; ++i)
+    {
+        JobDeque &deque = pool.deques[i];
+        pthread_mutex_init(&deque.mutex, NULL);
+        deque.capacity = JOB_DEQUE_INITIAL_CAPACITY;
+        deque.jobs = (Job*)malloc(sizeof(Job) * deque.capacity);
+    }
+
+    job_worker_index = 0;
+    if (pin_threads)
+        job_pin_thread(pthread_self(), 0);
+
+    pool.threads = (pthread_t*)calloc(thread_count, sizeof(pthread_t));
+    for (u32 i=1; i < thread_count; ++i)
+    {
+        JobWorkerArgs* args = (JobWorkerArgs*)malloc(sizeof(JobWorkerArgs));
+        args->pool = &pool;
+        args->index = i;
+        pthread_create(&pool.threads[i], NULL, job_worker_thread, (void*)args);
+        if (pin_threads)
+            job_pin_thread(pool.threads[i], i % core_count);
+    }
+    print("Job pool started with %u threads", thread_count);
+}
+
+
+void job_pool_shutdown(JobPool &pool)
+{
+    pthread_mutex_lock(&pool.sleep_mutex);
+    __atomic_store_n(&pool.running, false, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&pool.wake_condition);
+    pthread_mutex_unlock(&pool.sleep_mutex);
+
+    for (u32 i=1; i < pool.worker_count; ++i)
+    {
+        pthread_join(pool.threads[i], NULL);
+    }
+    for (u32 i=0; i < pool.worker_count; ++i)
+    {
+        pthread_mutex_destroy(&pool.deques[i].mutex);
+        free(pool.deques[i].jobs);
+    }
+    free(pool.deques);
+    free(pool.threads);
+    pthread_mutex_destroy(&pool.sleep_mutex);
+    pthread_cond_destroy(&pool.wake_condition);
+    memset(&pool, 0, sizeof(pool));
+}
+
+
+// Queues job_count jobs calling function with data + i * data_stride.
+// Jobs are dealt round robin over the deques of the other workers, the
+// submitting thread may not get to run its own deque before they are done
+// and only steals while it waits. Every worker runs its share newest first,
+// so a batch meant to run in priority order is submitted lowest first.
+// counter must outlive the batch.
+void job_pool_submit(JobPool &pool, JobFunction function, void* data, size_t data_stride,
+                     u32 job_count, JobCounter &counter)
+{
+    // Counted before the jobs become visible so a worker taking one can
+    // never drive the counts below zero
+    __sync_fetch_and_add(&counter.remaining, job_count);
+    __sync_fetch_and_add(&pool.queued_count, job_count);
+    for (u32 i=0; i < job_count; ++i)
+    {
+        Job job;
+        job.function = function;
+        job.data = (byte*)data + i * data_stride;
+        job.counter = &counter;
+
+        u32 deque_index = 0;
+        if (pool.worker_count > 1)
+        {
+            deque_index = __sync_fetch_and_add(&pool.next_deque, 1) % (pool.worker_count - 1);
+            if (deque_index >= job_worker_index)
+                deque_index++;
+        }
+        job_deque_push(pool.deques[deque_index], job);
+    }
+
+    pthread_mutex_lock(&pool.sleep_mutex);
+    pthread_cond_broadcast(&pool.wake_condition);
+    pthread_mutex_unlock(&pool.sleep_mutex);
+}
+
+
+// Runs queued jobs on the calling thread until the batch is done
+void job_pool_wait(JobPool &pool, JobCounter &counter)
+{
+    // The acquire load also makes the results of the other workers visible
+    while (__atomic_load_n(&counter.remaining, __ATOMIC_ACQUIRE) > 0)
+    {
+        Job job;
+        if (job_pool_take(pool, job_worker_index, job))
+            job_run(job);
+        else
+            sched_yield();
+    }
+}
+
+#endif // JOBPOOLH
@@ -3,7 +3,6 @@
 // - cleanup text rendering
 // - Indexed draws
 // - picker shader fixes
-// - dict struct
 // - lights
 // - transform stack?
 // - bboxes
@@ -16,7 +15,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <limits.h>
+#include <time.h>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -32,14 +33,26 @@
 #include "types.h"
 #include "debug.h"
 #include "ray.c"
+#include "bvh.h"
 #include "camera.h"
 #include "array.h"
-#include "dict.h"
+#include "arena.h"
 #include "mesh.c"
+#include "shader.h"
+#include "render_queue.h"
+#include "picker.h"
+#include "tlas.h"
+#include "selection.h"
+#include "selection_set.h"
+#include "culling.h"
+#include "ray_packet.c"
+#include "job_pool.h"
+#include "render.c"
 #include "text.h"
 #include "background.c"
 
 #include "io/objloader.h"
+#include "asset_registry.h"
 
 #include "assets/grid.h"
 #include "assets/cube.h"
@@ -68,19 +81,43 @@ static glm::vec3 pan_vector_y;
 static Array mesh_data_array;
 static xorshift32_state xor_state;
 
-static float RAY_MAX_DISTANCE = 999999999.0f;
-
 static bool render_selction_buffer = false;
+// ID buffer for hover and selection, bump scene_version when meshes are
+// added, removed or moved so the picker renders the ID pass again
+static Picker picker;
+static u32 scene_version = 0;
+
+// Click and marquee selection on the CPU, against the view of the last frame
+static Selector selector;
+static glm::mat4 frame_vp;
+// SELECTION_TRIANGLES or SELECTION_BOUNDS, T switches
+static u32 marquee_mode = SELECTION_TRIANGLES;
+
+// World space boxes of the meshes and which of them the view sees this frame,
+// every raster pass draws only those
+static Culler culler;
 static bool draw_viewport_marquee = false;
 
-static Array selected_mesh_indices;
+static SelectionSet selected_meshes;
 static Mesh* mouse_over_mesh = NULL;
 
 static Array rays;
 
+// Temporaries of the frame and of the callbacks run in it, reset at the end
+// of every frame
+static Arena frame_arena;
+
 static bool is_running = true;
 static bool render_view = false;
 
+// Seconds since start, sampled once per frame for the time uniform
+static float frame_time = 0;
+static RenderQueue render_queue;
+
+// Render workers, set with -t and --pin. 0 threads means one per core.
+static u32 job_thread_count = 0;
+static bool job_pin_threads = false;
+
 const float TWO_M_PI = M_PI*2.0f;
 const float M_PI_OVER_TWO = M_PI/2.0f;
 
@@ -94,8 +131,14 @@ const char* ToolNames[] = {"NONE", "TRANSLATE"};
 static tool current_tool = NONE;
 
 enum selection_mode {OBJECT, FACE, VERTEX};
+const char* SelectionModeNames[] = {"OBJECT", "FACE", "VERTEX"};
 static selection_mode current_selection_mode = OBJECT;
 
+// Triangle or vertex of picked_mesh picked in FACE and VERTEX mode,
+// UINT_MAX when none
+static u32 picked_mesh = UINT_MAX;
+static u32 picked_element = UINT_MAX;
+
 
 typedef struct v2i
 {
@@ -120,74 +163,17 @@ typedef struct Marquee
 Marquee marquee;
 
 
-void loadFileContents(const char* file_path, char* buffer)
-{
-    FILE* fh;
-    fh = fopen(file_path, "r");
-    fread(buffer, 1000, 1, fh);  // FIXME
-    fclose(fh);
-}
-
-
-u8 compile_shader(GLuint shader_id, const char* shader_path)
-{
-    print("Compiling shader %s", shader_path);
-    u32 buffer_size = 1000;
-    char* shader_buffer = (char*)calloc(1, sizeof(char) * buffer_size);
-
-    loadFileContents(shader_path, shader_buffer);
-
-    glShaderSource(shader_id, 1, &shader_buffer, NULL);
-    glCompileShader(shader_id);
-    free(shader_buffer);
-
-    GLint is_compiled = 0;
-    glGetShaderiv(shader_id, GL_COMPILE_STATUS, &is_compiled);
-    if(is_compiled == GL_FALSE)
-    {
-        GLint max_length = 0;
-        glGetShaderiv(shader_id, GL_INFO_LOG_LENGTH, &max_length);
-        char errorLog[max_length];
-        glGetShaderInfoLog(shader_id, max_length, &max_length, &errorLog[0]);
-        glDeleteShader(shader_id);
-        print("%s", errorLog);
-        return 0;
-    }
-    return 1;
-}
-
-/*typedef struct BVH*/
-/*{*/
-     
-/*};*/
-
-
-GLuint create_shader(const char* vertex_shader, const char* fragment_shader)
+// The ID pass writes mesh index + 1, 0 is the background
+inline u32 picker_id_from_mesh_index(u32 mesh_index)
 {
-    GLuint shader_program_id = glCreateProgram();
-    GLuint vert_id = glCreateShader(GL_VERTEX_SHADER);
-    u8 rv = compile_shader(vert_id, vertex_shader);
-    assert(rv);
-
-    glAttachShader(shader_program_id, vert_id);
-    GLuint frag_id = glCreateShader(GL_FRAGMENT_SHADER);
-    rv = compile_shader(frag_id, fragment_shader);
-    assert(rv);
-
-    glAttachShader(shader_program_id, frag_id);
-    glLinkProgram(shader_program_id);
-    return shader_program_id;
+    return mesh_index + 1;
 }
 
 
-u32 get_selected_mesh_index(byte* color)
+// Mesh index of a picker id, UINT_MAX for the background
+inline u32 get_selected_mesh_index(u32 picker_id)
 {
-    u32 mesh_id = 0;
-    mesh_id += (255-color[0]) << 0;
-    mesh_id += (255-color[1]) << 8;
-    mesh_id += (255-color[2]) << 16;
-    mesh_id += (255-color[3]) << 24;
-    return mesh_id;
+    return picker_id - 1;
 }
 
 
@@ -350,82 +336,59 @@ glm::mat4 get_view_matrix()
 }
 
 
+// Single draw outside of a queue, for the grid and the manipulator
 void drawMesh(Mesh &mesh, GLenum mode, GLuint shader_program_id, glm::mat4 vp)
 {
-    glUseProgram(shader_program_id);
-
-    glm::mat4 mvp = vp * mesh.model_matrix;
-
-    GLuint matrix_id = glGetUniformLocation(shader_program_id, "MVP");
-    glUniformMatrix4fv(matrix_id, 1, GL_FALSE, &mvp[0][0]);
-
-    GLuint uniform_camera_pos = glGetUniformLocation(shader_program_id, "camera_position");
-    if(uniform_camera_pos)
-        glUniform3fv(uniform_camera_pos, 1, &global_cam.position[0]);
-
-    GLfloat time = glfwGetTime();
-    GLuint time_id = glGetUniformLocation(shader_program_id, "time");
-    glUniform1f(time_id, time);
-
-    glBindVertexArray(mesh.vao);
-    glDrawArrays(mode, 0, mesh.vertex_array_length / 3.0f);
-    glBindVertexArray(0);
-    glUseProgram(0);
+    render_queue_push(render_queue, shader_program_id, mesh, mode);
+    render_queue_flush(render_queue, vp, global_cam.position, frame_time);
 };
 
 
-void decompose_u32(u32 number, byte* array)
+// Corner of the triangle closest to the cursor on screen, x and y in
+// framebuffer pixels
+u32 pick_triangle_vertex(Mesh &mesh, u32 triangle, glm::mat4 vp, float x, float y, int width, int height)
 {
-    array[0] = number & 0xFF; 
-    array[1] = (number >> 8) & 0xFF;
-    array[2] = (number >> 16) & 0xFF;
-    array[3] = (number >> 24) & 0xFF;
+    MeshGeometry &geometry = *mesh.geometry;
+    glm::mat4 mvp = vp * mesh.model_matrix;
+    u32 closest_vertex = UINT_MAX;
+    float closest_distance = FLT_MAX;
+    for (u32 corner=0; corner < 3; ++corner)
+    {
+        u32 index = triangle * 3 + corner;
+        u32 vertex = geometry.indices ? geometry.indices[index] : index;
+        float* position = geometry.vertex_positions + vertex * geometry.vector_dimensions;
+        glm::vec4 clip = mvp * glm::vec4(position[0], position[1], position[2], 1.0f);
+        if (clip.w <= 0.0f)
+            continue;
+
+        float dx = (clip.x / clip.w * 0.5f + 0.5f) * width - x;
+        float dy = (clip.y / clip.w * 0.5f + 0.5f) * height - y;
+        float distance = dx * dx + dy * dy;
+        if (distance < closest_distance)
+        {
+            closest_distance = distance;
+            closest_vertex = vertex;
+        }
+    }
+    return closest_vertex;
 }
 
 
-void render_selection_buffer(GLFWwindow* window, glm::mat4 vp)
+// program writes the picker ids, picker_shader_program_id for the ID pass
+void render_selection_buffer(GLFWwindow* window, glm::mat4 vp, GLuint program)
 {
-    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
     if(current_tool == NONE)
     {
-        if(current_selection_mode == OBJECT)
+        // NOTE(kk): Every selection mode picks from the same pass, FACE and
+        // VERTEX use the primitive id attachment on top of the mesh id
+        u32* visible = (u32*)culler.visible.base_ptr;
+        for (u32 i=0; i < culler.visible.element_count; ++i)
         {
-            u32 element_count = mesh_data_array.element_count;
-            for (u32 i=0; i < element_count; ++i)
-            {
-                Mesh* mesh = (Mesh*)array_get_index(mesh_data_array, i);
-
-                byte bytes[4];
-                decompose_u32(i, bytes);
-                // Create an ID from mesh index
-                glm::vec4 picker_color = glm::vec4(
-                    255 - bytes[0], 255 - bytes[1], 255 - bytes[2], 255 - bytes[3]);
-
-                // Draw
-                glUseProgram(picker_shader_program_id);
-                glm::mat4 mvp = vp * mesh->model_matrix;
-                GLuint matrix_id = glGetUniformLocation(
-                    picker_shader_program_id, "MVP");
-
-                glUniformMatrix4fv(matrix_id, 1, GL_FALSE, &mvp[0][0]);
-
-                GLuint picker_id = glGetUniformLocation(
-                    picker_shader_program_id, "picker_id");
-
-                GLfloat uniform[4] = {
-                    (GLfloat)picker_color[0] / 255.0f,
-                    (GLfloat)picker_color[1] / 255.0f,
-                    (GLfloat)picker_color[2] / 255.0f,
-                    (GLfloat)picker_color[3] / 255.0f,
-                };
-                glUniform4fv(picker_id, 1, &uniform[0]);
-                glBindVertexArray(mesh->vao);
-                glDrawArrays(GL_TRIANGLES, 0, mesh->vertex_array_length / 3.0f);
-                glBindVertexArray(0);
-            }
+            Mesh* mesh = (Mesh*)array_get_index(mesh_data_array, visible[i]);
+            DrawItem &item = render_queue_push(render_queue, program, *mesh, GL_TRIANGLES);
+            item.instance.picker_id = picker_id_from_mesh_index(visible[i]);
         }
+        render_queue_flush(render_queue, vp, global_cam.position, frame_time);
     }
     else if(current_tool == TRANSLATE)
     {
@@ -440,31 +403,10 @@ static void cursorPositionCallback(GLFWwindow* window, double xpos, double ypos)
     last_press_x = xpos;
     last_press_y = ypos;
 
-    v2i px_coords = get_mouse_pixel_coords(window);
-
-    glReadBuffer(GL_BACK);
-    byte pixel_color[4];
-    glReadPixels(px_coords.x, px_coords.y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, &pixel_color);
-    u32 mesh_id = get_selected_mesh_index(pixel_color);
-
-    if(mesh_id != UINT_MAX)
-    {
-        mouse_over_mesh = (Mesh*)array_get_index(mesh_data_array, mesh_id);
-        /*print("over %i: %p", mesh_idx, mouse_over_mesh);*/
-    }
-    else
-    {
-        mouse_over_mesh = NULL;
-    }
-
-    /*print("Press %f, %f", xpos, ypos);*/
+    // NOTE(kk): Only remembers where to look, the main loop reads the ID
+    // buffer asynchronously and sets mouse_over_mesh a frame or two later
     v2i pixel_coords = get_mouse_pixel_coords(window);
-
-    int buffer_width, buffer_height;
-    glfwGetFramebufferSize(window, &buffer_width, &buffer_height);
-    float u, v;
-    u = pixel_coords.x / (float)buffer_width;
-    v = pixel_coords.y / (float)buffer_height;
+    picker_set_cursor(picker, (int)pixel_coords.x, (int)pixel_coords.y);
 }
 
 
@@ -484,7 +426,6 @@ void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
         if (!mods || mods & GLFW_MOD_SHIFT)
         {
             camera_update(global_cam);
-            print("Press %f, %f", xpos, ypos);
             v2i pixel_coords = get_mouse_pixel_coords(window);
 
             int buffer_width, buffer_height;
@@ -496,39 +437,55 @@ void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
             Ray r = camera_shoot_ray(global_cam, u, v);
             /*array_append(rays, &r);*/
 
-            glReadBuffer(GL_BACK);
-            byte pixel_color[4];
-            glReadPixels(pixel_coords.x, pixel_coords.y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, &pixel_color);
-
-            u32 mesh_id = get_selected_mesh_index(pixel_color);
-            print("Pixel color %hhu %hhu %hhu %hhu, mesh id %u", pixel_color[0], pixel_color[1], pixel_color[2], pixel_color[3], mesh_id);
+            // NOTE(kk): Synced every frame, this only catches meshes events
+            // earlier in the same poll changed
+            selection_update(selector, mesh_data_array, scene_version);
+            u32 mesh_id = selection_pick(selector, r);
 
-            if(mesh_id != UINT_MAX)
+            if(current_selection_mode != OBJECT)
             {
-                print("Selected %i", mesh_id);
-                bool already_selected = false;
-                for (int i=0; i < selected_mesh_indices.element_count; ++i)
-                {
-                    u32* present_idx = (u32*)array_get_index(selected_mesh_indices, i);
-                    if(*present_idx == mesh_id)
-                        already_selected = true;
-                }
-                if (!already_selected)
+                // NOTE(kk): Triangles come from the ID buffer, the ray pick
+                // doesn't report them
+                PickResult pick = picker_pick(picker, pixel_coords.x, pixel_coords.y);
+                mesh_id = get_selected_mesh_index(pick.id);
+                picked_mesh = UINT_MAX;
+                picked_element = UINT_MAX;
+                if(mesh_id < mesh_data_array.element_count)
                 {
-                    if(mods & GLFW_MOD_SHIFT)
+                    Mesh* mesh = (Mesh*)array_get_index(mesh_data_array, mesh_id);
+                    picked_mesh = mesh_id;
+                    if(current_selection_mode == FACE)
                     {
-                        array_append(selected_mesh_indices, &mesh_id);
+                        picked_element = pick.primitive;
                     }
                     else
                     {
-                        array_clear(selected_mesh_indices);
-                        array_append(selected_mesh_indices, &mesh_id);
+                        picked_element = pick_triangle_vertex(*mesh, pick.primitive, frame_vp, pixel_coords.x + 0.5f,
+                                                              pixel_coords.y + 0.5f, buffer_width, buffer_height);
                     }
+#ifdef DEBUG
+                    print("Picked %s %u of mesh %u", SelectionModeNames[current_selection_mode],
+                          picked_element, picked_mesh);
+#endif
                 }
             }
-            else
+            else if(mesh_id < mesh_data_array.element_count)
             {
-                array_clear(selected_mesh_indices);
+                // Shift toggles, a plain click on a selected mesh keeps the
+                // selection so it can be moved together
+                if(mods & GLFW_MOD_SHIFT)
+                {
+                    selection_set_toggle(selected_meshes, mesh_id);
+                }
+                else if (!selection_set_contains(selected_meshes, mesh_id))
+                {
+                    selection_set_clear(selected_meshes);
+                    selection_set_add(selected_meshes, mesh_id);
+                }
+            }
+            else if (!(mods & GLFW_MOD_SHIFT))
+            {
+                selection_set_clear(selected_meshes);
             }
             draw_viewport_marquee = true;
         }
@@ -551,77 +508,42 @@ void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
     {
         rotate_mode = false;
         pan_mode = false;
-        print("Release");
         draw_viewport_marquee = false;
 
-        byte pixel_color[4];
-
         v2i top_hdpi = hdpi_pixel_convert(window, marquee.top.x, marquee.top.y);
         v2i bottom_hdpi = hdpi_pixel_convert(window, marquee.bottom.x, marquee.bottom.y);
 
         int width = top_hdpi.x - bottom_hdpi.x;
         int height = bottom_hdpi.y - top_hdpi.y;
 
-        print("points %u/%u", bottom_hdpi.x, bottom_hdpi.y);
-        print("width/height %i/%i", width, height);
-        u32 pixel_count = width * height;
-        u32 buffer_size = pixel_count * sizeof(u32);
-        u32* buffer = (u32*)malloc(buffer_size);
+        if(width <= 0 || height <= 0)
+            return;
 
-        int window_width, window_height;
-        glfwGetFramebufferSize(window, &window_width, &window_height);
+        int buffer_width, buffer_height;
+        glfwGetFramebufferSize(window, &buffer_width, &buffer_height);
 
-        glReadBuffer(GL_BACK);
         // NOTE(kk): Need to flip bottom because the values are already stored "correctly"
-        glReadPixels(bottom_hdpi.x, window_height - bottom_hdpi.y, width, height,
-                     GL_RGBA, GL_UNSIGNED_BYTE, (void*)buffer);
-
-
-        Array mesh_indices;
-        array_init(mesh_indices, sizeof(u32), 128);
-
-        for(u32* ptr = buffer; ptr < buffer + pixel_count; ++ptr) 
-        {
-            u32 boit = *ptr;
-            byte bytes[4];
-            decompose_u32((u32)*ptr, bytes);
-            u8 r = bytes[0];
-            u8 g = bytes[1];
-            u8 b = bytes[2];
-            u8 a = bytes[3];
-            if(r*b*g*a != 0)
-            {
-                u32 mesh_id = get_selected_mesh_index(bytes);
-                // TODO(kk): It should be really a hashmap or a set
-                bool found = false;
-                for (int i=0; i < mesh_indices.element_count; ++i)
-                {
-                    u32* mesh_index = (u32*)array_get_index(mesh_indices, i);
-                    if(*mesh_index == mesh_id)
-                    {
-                        found = true;
-                        break;
-                    }
-                }
-                if(!found)
-                {
-                    array_append(mesh_indices, &mesh_id);
-                }
-            }
-        }
-        if(mesh_indices.element_count > 0)
+        float x0 = 2.0f * bottom_hdpi.x / buffer_width - 1.0f;
+        float x1 = 2.0f * top_hdpi.x / buffer_width - 1.0f;
+        float y0 = 2.0f * (buffer_height - (int)bottom_hdpi.y) / buffer_height - 1.0f;
+        float y1 = 2.0f * (buffer_height - (int)top_hdpi.y) / buffer_height - 1.0f;
+        Frustum frustum = frustum_from_rect(frame_vp, x0, y0, x1, y1);
+
+        // Everything in the frustum, hidden meshes too. Synced every frame,
+        // this only catches meshes added since, the bitset below must fit.
+        selection_update(selector, mesh_data_array, scene_version);
+        // NOTE(kk): Lives in frame_arena, gone at the end of the frame
+        u32 mesh_count = mesh_data_array.element_count;
+        u64* words = (u64*)arena_alloc_zero(frame_arena, bitset_word_count(mesh_count) * sizeof(u64));
+        Bitset marquee_selection = bitset_from_words(words, mesh_count);
+        u32 mesh_id_count = selection_marquee(selector, frustum, marquee_mode, marquee_selection);
+        if(mesh_id_count > 0)
         {
-            array_clear(selected_mesh_indices);
-            for (int i=0; i < mesh_indices.element_count; ++i)
-            {
-                u32* mesh_index = (u32*)array_get_index(mesh_indices, i);
-                array_append(selected_mesh_indices, mesh_index);
-            }
+            // Shift adds to the selection
+            if (!(mods & GLFW_MOD_SHIFT))
+                selection_set_clear(selected_meshes);
+            selection_set_add_bits(selected_meshes, marquee_selection);
         }
-
-        array_free(mesh_indices);
-
-        free(buffer);
     }
 
 }
@@ -647,43 +569,106 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
     else if (key == GLFW_KEY_Q)
     {
         current_tool = NONE;
+        scene_version++;
     }
     else if (key == GLFW_KEY_W)
     {
         current_tool = TRANSLATE;
+        scene_version++;
     }
     else if (key == GLFW_KEY_UP)
     {
-        /*Mesh cube_mesh = cube_create_random_on_sphere(xor_state);*/
-        Mesh cube_mesh = cube_create_random_on_plane(xor_state);
-        mesh_init(cube_mesh, 3);
-        cube_mesh.shader_id = default_shader_program_id;
-        array_append(mesh_data_array, &cube_mesh);
+        // Shift spawns a thousand at once, the cubes share one geometry
+        // and draw instanced
+        u32 spawn_count = (mods & GLFW_MOD_SHIFT) ? 1000 : 1;
+        array_grow(mesh_data_array, spawn_count);
+        for (u32 i=0; i < spawn_count; ++i)
+        {
+            /*Mesh cube_mesh = cube_create_random_on_sphere(xor_state);*/
+            Mesh cube_mesh = cube_create_random_on_plane(xor_state);
+            cube_mesh.shader_id = default_shader_program_id;
+            array_append(mesh_data_array, &cube_mesh);
+        }
+        // Growing may have moved the meshes
+        mouse_over_mesh = NULL;
+        scene_version++;
     }
     else if (key == GLFW_KEY_DOWN)
     {
-        for (int i=1; i < 10; ++i)
+        for (int i=1; i < 10 && mesh_data_array.element_count > 0; ++i)
         {
+            Mesh* mesh = (Mesh*)array_get_index(mesh_data_array, mesh_data_array.element_count - 1);
+            mesh_release(*mesh);
             array_pop(mesh_data_array);
         }
+
+        // Forget the popped meshes
+        mouse_over_mesh = NULL;
+        scene_version++;
+        selection_set_remove_range(selected_meshes, mesh_data_array.element_count, selected_meshes.capacity);
     }
 
     if(action == GLFW_PRESS)
     {
-        if (key == GLFW_KEY_A)
+        if (key == GLFW_KEY_A && mods & GLFW_MOD_CONTROL)
+        {
+            selection_set_add_range(selected_meshes, 0, mesh_data_array.element_count);
+        }
+        else if (key == GLFW_KEY_I && mods & GLFW_MOD_CONTROL)
+        {
+            // Invert the selection
+            for (u32 i=0; i < mesh_data_array.element_count; ++i)
+            {
+                selection_set_toggle(selected_meshes, i);
+            }
+        }
+        else if (key == GLFW_KEY_A)
         {
             render_selction_buffer = true;
         }
+        else if (key >= GLFW_KEY_1 && key <= GLFW_KEY_3)
+        {
+            current_selection_mode = (selection_mode)(key - GLFW_KEY_1);
+            picked_mesh = UINT_MAX;
+            picked_element = UINT_MAX;
+        }
         else if (key == GLFW_KEY_SPACE)
         {
             render_view = !render_view;
         }
+        else if (key == GLFW_KEY_P)
+        {
+            // Cycle through the supported packet widths down to scalar
+            ray_packet_width = ray_packet_width > 1 ? ray_packet_width / 2 : ray_packet_max_width;
+            if (ray_packet_width == 2)
+                ray_packet_width = 1;
+            print("Ray packet width %u", ray_packet_width);
+        }
+        else if (key == GLFW_KEY_B)
+        {
+            render_bucket_order = render_bucket_order == BUCKET_ORDER_COST ? BUCKET_ORDER_SPIRAL : BUCKET_ORDER_COST;
+            print("Bucket order %s", BucketOrderNames[render_bucket_order]);
+        }
+        else if (key == GLFW_KEY_H)
+        {
+            render_heatmap = !render_heatmap;
+        }
+        else if (key == GLFW_KEY_T)
+        {
+            marquee_mode = marquee_mode == SELECTION_TRIANGLES ? SELECTION_BOUNDS : SELECTION_TRIANGLES;
+            print("Marquee selects by %s", SelectionMarqueeModeNames[marquee_mode]);
+        }
+#ifdef DEBUG
+        else if (key == GLFW_KEY_M)
+        {
+            debug_alloc_report();
+        }
+#endif
         else if (key == GLFW_KEY_F)
         {
-            if (selected_mesh_indices.element_count > 0)
+            if (selected_meshes.count > 0)
             {
-                u32* mesh_idx = (u32*)array_get_index(selected_mesh_indices, 0);
-                Mesh* mesh = (Mesh*)array_get_index(mesh_data_array, *mesh_idx);
+                Mesh* mesh = (Mesh*)array_get_index(mesh_data_array, selected_meshes.dense[0]);
                 focus_on_mesh(mesh);
             }
             else
@@ -721,191 +706,81 @@ size_t array_defaul_resizer(void* array_pointer)
     print("element size, %i", arr->element_size);
     print("max element count, %i", arr->max_element_count);
     print("element count, %i", arr->element_count);
-    print("need twice as much, %i", arr->_block_size * 2);
+    print("need twice as much, %zu", arr->_block_size * 2);
     return arr->_block_size * 2;
 }
 
 
-void prepare_meshes_for_render()
+// Copies the buckets finished since the last frame into the bound texture
+void render_pass_upload(RenderPass &pass, ImageBuffer image)
 {
-    for (int i=0; i < mesh_data_array.element_count; ++i)
-    {
-        Mesh* mesh = (Mesh*)array_get_index(mesh_data_array, i);
-        glm::mat4 inverse_model_matrix = glm::inverse(mesh->model_matrix);
-        glm::mat4 inverse_transpose_model_matrix = glm::inverseTranspose(mesh->model_matrix);
-        mesh->inverse_model_matrix = inverse_model_matrix;
-        mesh->inverse_transpose_model_matrix = inverse_transpose_model_matrix;
-    }
-}
+    if (pass.cancelled || pass.uploaded_count == pass.request_count)
+        return;
 
-// TODO multithread buckets
-void trace_ray(float u, float v, HitRecord &closest_hit)
-{
-    Ray r = camera_shoot_ray(global_cam, u, v);
-    for (int i=0; i < mesh_data_array.element_count; ++i)
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, image.width);
+    for (u32 i=0; i < pass.request_count; ++i)
     {
-        Mesh* mesh = (Mesh*)array_get_index(mesh_data_array, i);
-        glm::mat4 inverse_model_matrix = mesh->inverse_model_matrix;
-        glm::vec3 vmin = glm::vec3(mesh->bbox[0], mesh->bbox[1], mesh->bbox[2]);
-        glm::vec3 vmax = glm::vec3(mesh->bbox[3], mesh->bbox[4], mesh->bbox[5]);
-
-        // Modify the ray to intersect transformed mesh data
-        Ray changed_ray;
-        changed_ray.origin = glm::vec3(inverse_model_matrix * glm::vec4(r.origin, 1));
-
-        // Homogenous coordinate must be set to 0 for vectors
-        /*https://online.ucsd.edu/courses/course-v1:CSE+168X+2020-SP/courseware/Unit_3/L10/1?activate_block_id=block-v1%3ACSE%2B168X%2B2020-SP%2Btype%40html%2Bblock%40video_l10v1*/
-        changed_ray.direction = glm::vec3(inverse_model_matrix * glm::vec4(r.direction, 0));
-
-        bool box_hit = ray_intersect_box(changed_ray, vmin, vmax);
-        if(!box_hit)
+        RenderRequest &rr = pass.requests[i];
+        if (__atomic_load_n(&rr.state, __ATOMIC_ACQUIRE) != BUCKET_RENDERED)
             continue;
 
-        for (u32 c=0; c<mesh->vertex_array_length; c += 9)
+        Bucket &b = rr.bucket;
+        u32 width = b.xmax - b.xmin;
+        u32 height = b.ymax - b.ymin;
+        if (pass.heatmap)
         {
-            // Move to prepare mesh and construct render data triangles
-            Triangle tri;
-            tri.A = glm::vec3(mesh->vertex_positions[c], mesh->vertex_positions[c+1], mesh->vertex_positions[c+2]);
-            tri.B = glm::vec3(mesh->vertex_positions[c+3], mesh->vertex_positions[c+4], mesh->vertex_positions[c+5]);
-            tri.C = glm::vec3(mesh->vertex_positions[c+6], mesh->vertex_positions[c+7], mesh->vertex_positions[c+8]);
-
-            HitRecord this_hit_record;
-            this_hit_record.t = RAY_MAX_DISTANCE;
-            this_hit_record.p = glm::vec3(0);
-            this_hit_record.normal= glm::vec3(0);
-            bool intersect = ray_intersect_triangle(changed_ray, tri, 0.001f, 10000.0f, this_hit_record);
-
-            if (intersect && this_hit_record.t < closest_hit.t)
+            // Scaled by the slowest pixels of the last finished pass
+            static u32 heatmap_pixels[RENDER_BUCKET_SIZE * RENDER_BUCKET_SIZE];
+            float pixel_cost = rr.seconds / (width * height);
+            float max_pixel_cost = pass.max_pixel_cost > 0 ? pass.max_pixel_cost : pixel_cost;
+            u32 color = render_heatmap_color(pixel_cost / max_pixel_cost);
+            for (u32 i=0; i < width * height; ++i)
             {
-                closest_hit.t = this_hit_record.t;
-                closest_hit.p = glm::vec3(mesh->model_matrix * glm::vec4(this_hit_record.p, 1));
-                closest_hit.normal = glm::normalize(glm::vec3(mesh->inverse_transpose_model_matrix * glm::vec4(this_hit_record.normal, 1)));
+                heatmap_pixels[i] = color;
             }
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, b.xmin, b.ymin, width, height,
+                            GL_RGBA, GL_UNSIGNED_BYTE, heatmap_pixels);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, image.width);
         }
+        else
+        {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, b.xmin, b.ymin, width, height,
+                            GL_RGBA, GL_UNSIGNED_BYTE, get_image_pixel(image, b.xmin, b.ymin));
+        }
+        rr.state = BUCKET_UPLOADED;
+        pass.uploaded_count++;
     }
-}
-
-typedef struct RenderThreadArgs
-{
-    float  u;
-    float  v;
-    HitRecord hit_record;
-} RenderThreadArgs;
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 
-
-
-typedef struct ImageBuffer
-{
-     u32* buffer;
-     u32 width;
-     u32 height;
-} ImageBuffer;
-
-
-typedef struct Bucket
-{
-     u32 xmin;
-     u32 ymin;
-     u32 xmax;
-     u32 ymax;
-} Bucket;
-
-
-typedef struct RenderRequest
-{
-    ImageBuffer image_buffer;
-    Bucket bucket;
-} RenderRequest;
-
-
-typedef struct RenderQueue
-{
-    u32 request_count;
-    RenderRequest *requests;
-    volatile u32 requests_rendered;
-    volatile u32 next_request_index;
-} RenderQueue;
-
-
-u32* get_image_pixel(ImageBuffer image, u32 x, u32 y)
-{
-     return image.buffer + y * image.width + x;
-}
-
-u32 lock_add(volatile u32 *a, u32 b)
-{
-    pthread_t tid = pthread_self();
-    // print("From the function, the thread id %d", tid);
-    return __sync_fetch_and_add(a, b);
+    if (pass.uploaded_count == pass.request_count)
+        render_pass_finish(pass, image);
 }
 
 
-bool raycast(RenderQueue *queue)
+int main(int argc, char** argv)
 {
-    u32 request_index = lock_add(&queue->next_request_index, 1);
-    // print("Index %i", request_index);
-    // print("queue %i", queue->request_count);
-    if(request_index > queue->request_count)
-    {
-        // print("thread done");
-        return false;
-    }
-    RenderRequest rr = queue->requests[request_index];
-
-    ImageBuffer image = rr.image_buffer;
-    Bucket bucket = rr.bucket;
-    float u, v;
-    // print("Rendering %ux%u", image.width, image.height);
-    for(int j=bucket.ymin; j < bucket.ymax; ++j)
+    for (int i=1; i < argc; ++i)
     {
-        for(int i=bucket.xmin; i < bucket.xmax; ++i)
+        if ((strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--threads") == 0) && i + 1 < argc)
         {
-            u = i / (float)image.width;
-            v = j / (float)image.height;
-
-            HitRecord hit_result;
-            hit_result.t = RAY_MAX_DISTANCE;
-            hit_result.p = glm::vec3(0);
-            hit_result.normal= glm::vec3(0);
-
-            trace_ray(u, v, hit_result);
-
-            if(hit_result.t != RAY_MAX_DISTANCE)
-            {
-
-                glm::vec3 normal = hit_result.normal;
-                u8 colorR = (u8)((normal.x + 1) / 2 * 255.0f);
-                u8 colorG = (u8)((normal.y + 1) / 2 * 255.0f);
-                u8 colorB = (u8)((normal.z + 1) / 2 * 255.0f);
-                u8 alpha = 255;
-
-                u32 final = colorR | (colorG << 8) | (colorB << 16) | (alpha << 24);
-
-                /*print("normal %f %f %f", normal.x, normal.y, normal.z);*/
-                /*print("normal rescaled %f %f %f", (normal.x + 1) / 2, (normal.y + 1) / 2, (normal.z + 1) / 2);*/
-                /*print("%u %u %u - %04X", colorR, colorG, colorB, final);*/
-                image.buffer[j * image.width + i] = final;
-            }
-            else
-            {
-                image.buffer[j * image.width + i] = 0x0;
-            }
+            job_thread_count = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--pin") == 0)
+        {
+            job_pin_threads = true;
+        }
+        else
+        {
+            printf("Usage: %s [-t threads] [--pin]\n", argv[0]);
+            return 1;
         }
     }
-    lock_add(&queue->requests_rendered, 1);
-    return true;
-}
-
-
-void* raycast_thread(void* args)
-{
-     RenderQueue *queue = (RenderQueue*)args;
-     while(raycast(queue)) {};
-}
+    // NOTE(kk): The render view never waits on its pass, a single thread
+    // would only run the buckets at shutdown
+    if (job_thread_count == 1)
+        job_thread_count = 2;
 
-
-int main()
-{
     GLFWwindow* window;
 
     // GL INIT
@@ -946,22 +821,25 @@ int main()
     text_initialize_font("/System/Library/Fonts/Helvetica.ttc", helvetica_characters);
 
     default_shader_program_id = create_shader(
-        "shaders/default.vert", "shaders/default.frag");
+        "shaders/default_instanced.vert", "shaders/default.frag");
 
     GLuint outline_shader_program_id = create_shader(
-        "shaders/outline.vert", "shaders/outline.frag");
+        "shaders/outline_instanced.vert", "shaders/outline.frag");
 
     hover_shader_program_id = create_shader(
-        "shaders/outline.vert", "shaders/hover.frag");
+        "shaders/outline_instanced.vert", "shaders/hover.frag");
 
     GLuint noop_shader_program_id = create_shader(
         "shaders/noop.vert", "shaders/outline.frag");
 
     picker_shader_program_id = create_shader(
-        "shaders/default.vert", "shaders/picker.frag");
+        "shaders/default_instanced.vert", "shaders/picker_instanced.frag");
+
+    GLuint picker_debug_shader_program_id = create_shader(
+        "shaders/default_instanced.vert", "shaders/picker_debug.frag");
 
     selection_shader_program_id = create_shader(
-        "shaders/default.vert", "shaders/selection.frag");
+        "shaders/default_instanced.vert", "shaders/selection.frag");
 
     GLuint font_shader_program_id = create_shader(
         "shaders/font.vert", "shaders/font.frag");
@@ -973,7 +851,7 @@ int main()
         "shaders/marquee.vert", "shaders/marquee_inside.frag");
 
     GLuint lambert_shader_program_id = create_shader(
-        "shaders/default.vert", "shaders/lambert.frag");
+        "shaders/default_instanced.vert", "shaders/lambert.frag");
 
     GLuint background_shader_program_id = create_shader(
         "shaders/background.vert", "shaders/background.frag");
@@ -981,50 +859,19 @@ int main()
     GLuint render_shader_program_id = create_shader(
         "shaders/render.vert", "shaders/render.frag");
 
-    Array keys;
-    array_init(keys, sizeof(char*) * 64, 128);
-
-    const char* key2 = "what";
-    const char* key3 = "noidea";
-    const char* key1 = "something";
-    const char* key4 = "meshy";
-
-    array_append(keys, &key1);
-    array_append(keys, &key2);
-    array_append(keys, &key3);
-    array_append(keys, &key4);
-
-    Array values;
-    array_init(values, sizeof(float) * 64, 128);
-
-    float val1 = 10;
-    float val2 = 11;
-    float val3 = 12;
-    float val4 = 13;
+    GLuint bbox_shader_program_id = create_shader(
+        "shaders/bbox.vert", "shaders/default.frag");
 
-    array_append(values, &val1);
-    array_append(values, &val2);
-    array_append(values, &val3);
-    array_append(values, &val4);
+    BBoxBatch bbox_batch;
+    bbox_batch_init(bbox_batch);
 
-    Dict test_dict;
-    dict_init(test_dict, keys, values);
-    float result;
-    u32 index;
-
-
-    /*const char* test_123 = "what";*/
-    /*float newval = 666;*/
-    /*dict_map(test_dict, test_123, &newval);*/
-
-    /*resulty = dict_get(test_dict, "what", index);*/
-    /*if(resulty != NULL)*/
-    /*{*/
-        /*result = *(float*)resulty;*/
-        /*print("%f", result);*/
-        /*print("%i", index);*/
-    /*}*/
+    render_queue_init(render_queue);
 
+    int picker_width, picker_height;
+    glfwGetFramebufferSize(window, &picker_width, &picker_height);
+    picker_init(picker, picker_width, picker_height, PICKER_PRIMITIVE_IDS | PICKER_DEPTH);
+    selection_init(selector);
+    culler_init(culler);
 
     // WORLD
     glm::vec3 cam_start_pos = glm::vec3(10, 8, 10);
@@ -1041,17 +888,24 @@ int main()
     mesh_data_array.resize_func = array_defaul_resizer;
 
     u32 max_init_selection= 100;
-    array_init(selected_mesh_indices, sizeof(u32), max_init_selection);
+    selection_set_init(selected_meshes, max_init_selection);
 
     u32 max_rays= 100;
     array_init(rays, sizeof(Ray), max_rays);
 
+    arena_init(frame_arena, "frame", 4 * 1024 * 1024);
+
     xor_state.a = 10;
 
+    render_init_packet_width(0);
+    print("Ray packet width %u", ray_packet_width);
+
+    job_pool_init(job_pool, job_thread_count, job_pin_threads);
+
     double current_frame = glfwGetTime();
     double last_frame= current_frame;
 
-    Mesh suzanne_mesh = objloader_create_mesh("assets/suzanne.obj");
+    Mesh suzanne_mesh = asset_registry_create_mesh("assets/suzanne.obj");
     suzanne_mesh.model_matrix = glm::translate(suzanne_mesh.model_matrix,
                                                glm::vec3(0,5,0));
     /*suzanne_mesh.model_matrix = glm::scale(suzanne_mesh.model_matrix,*/
@@ -1059,7 +913,7 @@ int main()
     suzanne_mesh.shader_id = lambert_shader_program_id;
     array_append(mesh_data_array, &suzanne_mesh);
 
-    Mesh suzanne_mesh2 = objloader_create_mesh("assets/suzanne.obj");
+    Mesh suzanne_mesh2 = asset_registry_create_mesh("assets/suzanne.obj");
     suzanne_mesh2.model_matrix = glm::translate(suzanne_mesh2.model_matrix,
                                                glm::vec3(5,5,0));
     /*suzanne_mesh2.model_matrix = glm::scale(suzanne_mesh2.model_matrix,*/
@@ -1068,7 +922,7 @@ int main()
     array_append(mesh_data_array, &suzanne_mesh2);
 
     // Crash with 3rd
-    Mesh suzanne_mesh3 = objloader_create_mesh("assets/suzanne.obj");
+    Mesh suzanne_mesh3 = asset_registry_create_mesh("assets/suzanne.obj");
     suzanne_mesh3.model_matrix = glm::translate(suzanne_mesh3.model_matrix,
                                                glm::vec3(-5,5,0));
     /*suzanne_mesh3.model_matrix = glm::scale(suzanne_mesh3.model_matrix,*/
@@ -1076,7 +930,7 @@ int main()
     suzanne_mesh3.shader_id = lambert_shader_program_id;
     array_append(mesh_data_array, &suzanne_mesh3);
 
-    Mesh teapot_mesh = objloader_create_mesh("assets/teapot2.obj");
+    Mesh teapot_mesh = asset_registry_create_mesh("assets/teapot2.obj");
     /*teapot_mesh.model_matrix = glm::scale(teapot_mesh.model_matrix,*/
                                           /*glm::vec3(0.5,0.5,0.5));*/
     teapot_mesh.model_matrix = glm::translate(teapot_mesh.model_matrix,
@@ -1087,11 +941,9 @@ int main()
 
     // World grid
     Mesh grid_mesh = grid_create_mesh();
-    mesh_init(grid_mesh, 3);
 
     Mesh manip_mesh = manipulator_create_mesh();
     manip_mesh.shader_id = lambert_shader_program_id;
-    mesh_init(manip_mesh, 3);
 
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_CULL_FACE);
@@ -1131,6 +983,9 @@ int main()
     render_image.buffer = (u32*)malloc(buffer_width * buffer_height * sizeof(u32));
     render_image.width = buffer_width;
     render_image.height = buffer_height;
+    memset(render_image.buffer, 0, buffer_width * buffer_height * sizeof(u32));
+
+    RenderPass render_pass = {};
 
     unsigned int render_texture;
     glGenTextures(1, &render_texture);
@@ -1173,7 +1028,7 @@ int main()
 
     glBindTexture(GL_TEXTURE_2D, render_texture);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, render_image.width, render_image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, render_image.width, render_image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, render_image.buffer);
     glBindTexture(GL_TEXTURE_2D, 0);
 
     // position attribute
@@ -1212,6 +1067,7 @@ int main()
                 time_in_ms = delta_time * 1000.0f;
             }
         }
+        frame_time = current_frame;
 
         // background
         glUseProgram(background_shader_program_id);
@@ -1235,13 +1091,21 @@ int main()
 
         glm::mat4 view_matrix = get_view_matrix();
         glm::mat4 vp = Projection * view_matrix;
+        frame_vp = vp;
 
-
-        u32 element_count = mesh_data_array.element_count;
+        culler_update(culler, mesh_data_array, scene_version);
+        // Moving meshes refits the selector's TLAS here, not in the click
+        selection_update(selector, mesh_data_array, scene_version);
+        Frustum view_frustum = frustum_from_rect(vp, -1.0f, -1.0f, 1.0f, 1.0f);
+        culler_cull(culler, view_frustum);
+        u32* visible = (u32*)culler.visible.base_ptr;
 
         if (render_selction_buffer)
         {
-            render_selection_buffer(window, vp);
+            // The ids as colors, the integer ID buffer can't go on screen
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            render_selection_buffer(window, vp, picker_debug_shader_program_id);
         }
         else
         {
@@ -1249,9 +1113,9 @@ int main()
             glStencilFunc(GL_ALWAYS, 1, 0xFF);
             glStencilMask(0xFF);
 
-            for (int i=0; i < element_count; ++i)
+            for (u32 i=0; i < culler.visible.element_count; ++i)
             {
-                Mesh* mesh = (Mesh*)array_get_index(mesh_data_array, i);
+                Mesh* mesh = (Mesh*)array_get_index(mesh_data_array, visible[i]);
                 /* legacy anim test
                 u32 offset = 0;
                 float ratioX = offset / float(UINT_MAX);
@@ -1266,70 +1130,20 @@ int main()
                 mesh->model_matrix = glm::translate(mesh->model_matrix, diff);
                 */
 
-                GLuint object_shader = mesh->shader_id;
-                drawMesh(*mesh, GL_TRIANGLES, object_shader, vp);
+                render_queue_push(render_queue, mesh->shader_id, *mesh, GL_TRIANGLES);
             }
+            render_queue_flush(render_queue, vp, global_cam.position, frame_time);
 
             if(render_view)
             {
                 camera_update(global_cam);
-                int core_count = std::thread::hardware_concurrency();
-                //print("CPU count %i", core_count);
-                //print("Preparing meshes...");
-                prepare_meshes_for_render();
-
-                u32 bucket_size = 32;
-                u32 buckets_x = ceil((render_image.width) / (float)bucket_size);
-                u32 buckets_y = ceil((render_image.height) / (float)bucket_size);
-
-                u32 bucket_count = buckets_x * buckets_y;
-
-                RenderRequest requests[bucket_count];
-
-                u32 idx = 0;
-                for (u32 i=0; i < buckets_x; ++i)
-                {
-                    for (u32 j=0; j < buckets_y; ++j)
-                    {
-                        u32 xmin = i*bucket_size;
-                        u32 ymin = j*bucket_size;
-                        u32 xmax = fmin((i+1)*bucket_size, render_image.width);
-                        u32 ymax = fmin((j+1)*bucket_size, render_image.height);
-                        Bucket buc = {xmin, ymin, xmax, ymax};
-                        RenderRequest rr;
-                        rr.image_buffer= render_image;
-                        rr.bucket = buc;
-                        requests[idx] = rr;
-                        idx++;
-                    }
-                }
-
-                RenderQueue queue;
-                queue.request_count = bucket_count;
-                queue.requests = requests;
-                queue.requests_rendered = 0;
-                queue.next_request_index = 0;
-
-                u32 thread_count = core_count - 1;
-                pthread_t threads[thread_count];
-
-                for(u32 core_id = 1; core_id < core_count; ++core_id)
-                {
-                     pthread_t thread_id;
-                     // print("creating thread");
-                     pthread_create(&thread_id, NULL, raycast_thread, (void*)&queue);
-                     threads[core_id - 1] = thread_id;
-                }
 
-                while(raycast(&queue)) {};
-
-                for(u32 i = 0; i < thread_count; ++i)
-                {
-                    pthread_join(threads[i], NULL);
-                }
-
-                last_frame = current_frame;
-                // print("Render done in %f ms", time_in_ms);
+                // Never wait for the workers here, an outdated pass is
+                // cancelled and the next one starts once they have drained
+                if(!render_pass.started || render_pass_is_outdated(render_pass, global_cam, mesh_data_array))
+                    render_pass_cancel(render_pass);
+                if(render_pass.cancelled && render_pass_is_idle(render_pass))
+                    render_pass_start(render_pass, render_image, global_cam, mesh_data_array);
 
                 //glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
                 glDisable(GL_DEPTH_TEST);
@@ -1340,8 +1154,7 @@ int main()
                 glActiveTexture(GL_TEXTURE0);
                 glBindTexture(GL_TEXTURE_2D, render_texture);
 
-                // NOTE(kk): Change this per bucket?
-                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, render_image.width, render_image.height, GL_RGBA, GL_UNSIGNED_BYTE, render_image.buffer);
+                render_pass_upload(render_pass, render_image);
 
                 // render container
                 glUseProgram(render_shader_program_id);
@@ -1352,88 +1165,63 @@ int main()
                 glDisable(GL_BLEND);
                 glEnable(GL_DEPTH_TEST);
             }
+            else if(render_pass.started)
+            {
+                render_pass_cancel(render_pass);
+            }
 
             bool active_selection = 0;
             // STENCIL
-            for (int i=0; i < element_count; ++i)
+            glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
+            glStencilMask(0x00);
+            glDisable(GL_DEPTH_TEST);
+            // Only the selected meshes and the hovered one get outlines, so
+            // this costs nothing for the meshes that aren't
+            for (u32 i=0; i < selected_meshes.count; ++i)
             {
-                Mesh* mesh = (Mesh*)array_get_index(mesh_data_array, i);
-
-                glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
-                glStencilMask(0x00);
-                glDisable(GL_DEPTH_TEST);
-
-                bool is_selected = false;
-
-                for (int j=0; j < selected_mesh_indices.element_count; ++j)
-                {
-                    u32* selected_idx = (u32*)array_get_index(selected_mesh_indices, j);
-                    if(*selected_idx == i)
-                        is_selected = true;
-                }
-
-                if (is_selected || mesh == mouse_over_mesh)
-                {
-                    GLuint shader_id = 0;
-                    if (is_selected)
-                    {
-                        shader_id = outline_shader_program_id;
-                        glm::vec3 scale;
-                        glm::quat rotation;
-                        glm::vec3 translation;
-                        glm::vec3 skew;
-                        glm::vec4 perspective;
-                        glm::decompose(mesh->model_matrix, scale, rotation, translation, skew, perspective);
-                        glm::mat4 rotation_matrix = glm::mat4_cast(rotation);
-                        glm::vec3 offset_x = translation;
-                        /*glm::mat4 rotation_with_pivot = glm::translate(glm::mat4(1), offset_x) * rotation_matrix * glm::translate(glm::mat4(1), -offset_x);*/
-                        manip_mesh.model_matrix = glm::translate(glm::mat4(1), offset_x);
-                        manip_mesh.model_matrix = manip_mesh.model_matrix * rotation_matrix;
-                        active_selection = 1;
-                    }
-                    if (mesh == mouse_over_mesh)
-                    {
-                        shader_id = hover_shader_program_id;
-                    }
+                if (!bitset_test(culler.visible_bits, selected_meshes.dense[i]))
+                    continue;
+                Mesh* mesh = (Mesh*)array_get_index(mesh_data_array, selected_meshes.dense[i]);
+                GLuint shader_id = mesh == mouse_over_mesh ? hover_shader_program_id : outline_shader_program_id;
+                render_queue_push(render_queue, shader_id, *mesh, GL_TRIANGLES);
+            }
+            if (mouse_over_mesh && !selection_set_contains(selected_meshes, (u32)(mouse_over_mesh - (Mesh*)mesh_data_array.base_ptr)))
+            {
+                render_queue_push(render_queue, hover_shader_program_id, *mouse_over_mesh, GL_TRIANGLES);
+            }
 
-                    glUseProgram(shader_id);
-
-                    glm::mat4 mvp = vp * mesh->model_matrix;
-                    GLuint matrix_id = glGetUniformLocation(shader_id, "MVP");
-                    glUniformMatrix4fv(matrix_id, 1, GL_FALSE, &mvp[0][0]);
-
-                    GLuint uniform_camera_pos = glGetUniformLocation(shader_id, "camera_position");
-                    if(uniform_camera_pos)
-                        glUniform3fv(uniform_camera_pos, 1, &global_cam.position[0]);
-
-                    /*GLuint uniform_volume = glGetUniformLocation(shader_id, "volume");*/
-                    /*if(uniform_volume)*/
-                    /*{*/
-                        /*float width = mesh->bbox[3] - mesh->bbox[0];*/
-                        /*float height = mesh->bbox[4] - mesh->bbox[1];*/
-                        /*float depth = mesh->bbox[5] - mesh->bbox[2];*/
-                        /*glUniform1f(uniform_volume, width * height * depth);*/
-                    /*}*/
-
-                    glBindVertexArray(mesh->vao);
-                    glDrawArrays(GL_TRIANGLES, 0, mesh->vertex_array_length / 3.0f);
-                    glBindVertexArray(0);
-                    glUseProgram(0);
-                }
-                glBindVertexArray(0);
-                glStencilMask(0xFF);
-                glStencilFunc(GL_ALWAYS, 0, 0xFF);
-                glEnable(GL_DEPTH_TEST);
+            // The manipulator sits on the last selected mesh
+            if (selected_meshes.count > 0)
+            {
+                Mesh* mesh = (Mesh*)array_get_index(mesh_data_array, selected_meshes.dense[selected_meshes.count - 1]);
+                glm::vec3 scale;
+                glm::quat rotation;
+                glm::vec3 translation;
+                glm::vec3 skew;
+                glm::vec4 perspective;
+                glm::decompose(mesh->model_matrix, scale, rotation, translation, skew, perspective);
+                glm::mat4 rotation_matrix = glm::mat4_cast(rotation);
+                glm::vec3 offset_x = translation;
+                /*glm::mat4 rotation_with_pivot = glm::translate(glm::mat4(1), offset_x) * rotation_matrix * glm::translate(glm::mat4(1), -offset_x);*/
+                manip_mesh.model_matrix = glm::translate(glm::mat4(1), offset_x);
+                manip_mesh.model_matrix = manip_mesh.model_matrix * rotation_matrix;
+                active_selection = 1;
             }
+            render_queue_flush(render_queue, vp, global_cam.position, frame_time);
+            glStencilMask(0xFF);
+            glStencilFunc(GL_ALWAYS, 0, 0xFF);
+            glEnable(GL_DEPTH_TEST);
 
             if(active_selection)
             {
-                for (int i=0; i < selected_mesh_indices.element_count; ++i)
+                for (u32 i=0; i < selected_meshes.count; ++i)
                 {
-                    u32* selected_idx = (u32*)array_get_index(selected_mesh_indices, i);
-                    Mesh* mesh = (Mesh*)array_get_index(mesh_data_array, *selected_idx);
-                    mesh_draw_bbox(*mesh, default_shader_program_id, vp);
+                    if (!bitset_test(culler.visible_bits, selected_meshes.dense[i]))
+                        continue;
+                    Mesh* mesh = (Mesh*)array_get_index(mesh_data_array, selected_meshes.dense[i]);
+                    bbox_batch_add(bbox_batch, *mesh);
                 }
+                bbox_batch_draw(bbox_batch, bbox_shader_program_id, vp);
 
                 // Manipulator
                 if(current_tool == TRANSLATE)
@@ -1458,8 +1246,8 @@ int main()
         // Text
         glm::mat4 ortho_projection = glm::ortho(0.0f, (float)window_width, 0.0f, (float)window_height);
 
-        char text[8];
-        sprintf(text, "%.2fms", time_in_ms);
+        char text[16];
+        snprintf(text, sizeof(text), "%.2fms", time_in_ms);
         float redx = fmax(0, time_in_ms - 16.666f);
 
         glm::vec3 color = glm::vec3(0.3f + redx/10.f, 0.8f, 0.4f);
@@ -1469,11 +1257,52 @@ int main()
         text_draw(text, color, pos, scale, helvetica_characters, ortho_projection, font_shader_program_id);
 
         scale = 0.3f;
-        char text_tool[32];
+        char text_tool[128];
         pos = glm::vec2(10, window_height - 15);
-        sprintf(text_tool, "Tool: %s", ToolNames[current_tool]);
+        snprintf(text_tool, sizeof(text_tool), "Tool: %s, select: %s, marquee: %s, meshes: %u drawn, %u culled", ToolNames[current_tool],
+                SelectionModeNames[current_selection_mode], SelectionMarqueeModeNames[marquee_mode],
+                culler.visible.element_count, culler.culled_count);
         text_draw(text_tool, color, pos, scale, helvetica_characters, ortho_projection, font_shader_program_id);
 
+        if(render_view)
+        {
+            char text_render[64];
+            pos = glm::vec2(10, window_height - 30);
+            u32 progress = render_pass.request_count ? render_pass.uploaded_count * 100 / render_pass.request_count : 0;
+            snprintf(text_render, sizeof(text_render), "Render: %u%%, %.2f Mrays/s, %u wide", progress, render_mrays_per_second, ray_packet_width);
+            text_draw(text_render, color, pos, scale, helvetica_characters, ortho_projection, font_shader_program_id);
+
+            pos = glm::vec2(10, window_height - 45);
+            snprintf(text_render, sizeof(text_render), "Buckets: %s, %u%s", BucketOrderNames[render_bucket_order],
+                    render_pass.request_count, render_heatmap ? ", heatmap" : "");
+            text_draw(text_render, color, pos, scale, helvetica_characters, ortho_projection, font_shader_program_id);
+        }
+
+#ifdef DEBUG
+        // Live allocations and the GL callsite holding the most objects
+        {
+            DebugAllocTotals totals = debug_alloc_totals();
+            char text_alloc[128];
+            pos = glm::vec2(10, 30);
+            snprintf(text_alloc, sizeof(text_alloc), "Heap: %.2f MB live in %llu allocs, peak %.2f MB, GL: %llu buffers, %llu vaos",
+                    totals.live_bytes / (1024.0 * 1024.0),
+                    (unsigned long long)totals.live_count[DEBUG_ALLOC_HEAP],
+                    totals.peak_bytes / (1024.0 * 1024.0),
+                    (unsigned long long)totals.live_count[DEBUG_ALLOC_GL_BUFFER],
+                    (unsigned long long)totals.live_count[DEBUG_ALLOC_GL_VERTEX_ARRAY]);
+            text_draw(text_alloc, color, pos, scale, helvetica_characters, ortho_projection, font_shader_program_id);
+
+            DebugAllocSite top_site;
+            if (debug_alloc_top_sites(DEBUG_ALLOC_GL_BUFFER, &top_site, 1))
+            {
+                pos = glm::vec2(10, 45);
+                snprintf(text_alloc, sizeof(text_alloc), "Most GL buffers: %llu at %s:%u",
+                        (unsigned long long)top_site.live_count, top_site.file, top_site.line);
+                text_draw(text_alloc, color, pos, scale, helvetica_characters, ortho_projection, font_shader_program_id);
+            }
+        }
+#endif
+
         if(draw_viewport_marquee)
         {
             v2f p1;
@@ -1497,20 +1326,52 @@ int main()
 
         glfwSwapBuffers(window);
 
-        render_selection_buffer(window, vp);
-        /*// NOTE(kk): render selection back render_buffer before polling events*/
+        // NOTE(kk): The ID pass only renders when the view or the scene
+        // changed, hovering a still scene reads nothing back either
+        int frame_width, frame_height;
+        glfwGetFramebufferSize(window, &frame_width, &frame_height);
+        if (picker_begin_pass(picker, vp, scene_version, frame_width, frame_height))
+        {
+            render_selection_buffer(window, vp, picker_shader_program_id);
+            picker_end_pass();
+        }
         glfwPollEvents();
+
+        picker_request(picker);
+        if (picker_poll(picker))
+        {
+            u32 mesh_id = get_selected_mesh_index(picker.result.id);
+            if (mesh_id < mesh_data_array.element_count)
+                mouse_over_mesh = (Mesh*)array_get_index(mesh_data_array, mesh_id);
+            else
+                mouse_over_mesh = NULL;
+        }
+
+        arena_reset(frame_arena);
     }
 
     glDeleteVertexArrays(1, &render_VAO);
     glDeleteBuffers(1, &render_VBO);
     glDeleteBuffers(1, &render_EBO);
+    bbox_batch_free(bbox_batch);
+    render_queue_free(render_queue);
+    picker_free(picker);
+    selection_free(selector);
+    culler_free(culler);
+
 
+    render_pass_cancel(render_pass);
+    job_pool_wait(job_pool, render_pass.counter);
+    free(render_pass.requests);
+    free(render_pass.tile_costs);
 
     array_free(mesh_data_array);
-    array_free(selected_mesh_indices);
+    selection_set_free(selected_meshes);
     free(render_image.buffer);
 
+    job_pool_shutdown(job_pool);
+    debug_print_arena_stats();
+    arena_free(frame_arena);
     glfwTerminate();
     return 0;
 }
@@ -1,18 +1,43 @@
 #ifndef MESHH
 #define MESHH
 
-typedef struct Mesh
+// NOTE(kk): HEADLESS builds have no GL, meshes only carry the CPU side data
+#ifdef HEADLESS
+typedef unsigned int GLuint;
+typedef unsigned int GLenum;
+typedef float GLfloat;
+#endif
+
+// Vertex data and GPU buffers, shared by every mesh that draws it. Only the
+// asset registry creates these for loaded files.
+typedef struct MeshGeometry
 {
     GLuint vao;
-    GLuint shader_id;
+    GLuint buffers[4];  // positions, indices, colors, normals
     u32 vertex_array_length;
-    glm::mat4 model_matrix;
-    glm::mat4 inverse_model_matrix;
-    glm::mat4 inverse_transpose_model_matrix;
     float bbox[6];
     float* vertex_positions;
     float* vertex_colors;
     float* vertex_normals;
+    // Three per triangle, NULL when every three vertices are a triangle
+    u32* indices;
+    u32 index_count;
+    GLenum index_type;
+    u32 vector_dimensions;
+    BVH* bvh;
+    // Meshes using the geometry, the GPU buffers are freed when it drops to 0
+    u32 ref_count;
+} MeshGeometry;
+
+
+// One placed copy of a geometry
+typedef struct Mesh
+{
+    MeshGeometry* geometry;
+    GLuint shader_id;
+    glm::mat4 model_matrix;
+    glm::mat4 inverse_model_matrix;
+    glm::mat4 inverse_transpose_model_matrix;
     const char* mesh_name;
 } Mesh;
 
@@ -72,39 +97,66 @@ void mesh_get_bbox(float* vertex_buffer, u32 length, float* bbox)
 }
 
 
-void mesh_init(Mesh &mesh, u32 vector_dimensions)
+// Uploads the vertex data to the GPU, a no-op when it is already there
+void mesh_geometry_upload(MeshGeometry &geometry)
 {
-    mesh.model_matrix = glm::mat4(1);
-    mesh.mesh_name = "mesh";
-    mesh_get_bbox(mesh.vertex_positions, mesh.vertex_array_length, mesh.bbox);
-
-    print("%f %f %f - %f %f %f", mesh.bbox[0], mesh.bbox[1], mesh.bbox[2], mesh.bbox[3], mesh.bbox[4], mesh.bbox[5]);
+#ifdef HEADLESS
+    geometry.vao = 0;
+#else
+    if(geometry.vao)
+        return;
 
+    u32 vector_dimensions = geometry.vector_dimensions;
     GLuint vao;
     glGenVertexArrays(1, &vao);
+    debug_gl_created(DEBUG_ALLOC_GL_VERTEX_ARRAY, 1, &vao);
     glBindVertexArray(vao);
 
-    GLuint vbo;
-    glGenBuffers(1, &vbo);
+    glGenBuffers(4, geometry.buffers);
+    debug_gl_created(DEBUG_ALLOC_GL_BUFFER, 4, geometry.buffers);
 
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, geometry.buffers[0]);
     glBufferData(GL_ARRAY_BUFFER,
-                 mesh.vertex_array_length * sizeof(float),
-                 mesh.vertex_positions,
+                 geometry.vertex_array_length * sizeof(float),
+                 geometry.vertex_positions,
                  GL_STATIC_DRAW);
 
     // shader layout 0
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, vector_dimensions, GL_FLOAT, GL_FALSE, 0, NULL);
 
-    if(mesh.vertex_colors)
+    // NOTE(kk): Vertex counts up to 64k draw with 16 bit indices
+    geometry.index_type = 0;
+    if(geometry.indices)
+    {
+        u32 vertex_count = geometry.vertex_array_length / vector_dimensions;
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, geometry.buffers[1]);
+        if(vertex_count <= 0x10000)
+        {
+            u16* short_indices = (u16*)malloc(geometry.index_count * sizeof(u16));
+            for(u32 i=0; i < geometry.index_count; ++i)
+            {
+                short_indices[i] = (u16)geometry.indices[i];
+            }
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, geometry.index_count * sizeof(u16),
+                         short_indices, GL_STATIC_DRAW);
+            free(short_indices);
+            geometry.index_type = GL_UNSIGNED_SHORT;
+        }
+        else
+        {
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, geometry.index_count * sizeof(u32),
+                         geometry.indices, GL_STATIC_DRAW);
+            geometry.index_type = GL_UNSIGNED_INT;
+        }
+    }
+
+    if(geometry.vertex_colors)
     {
-        GLuint colorbuffer;
-        glGenBuffers(1, &colorbuffer);
-        glBindBuffer(GL_ARRAY_BUFFER, colorbuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, geometry.buffers[2]);
         glBufferData(GL_ARRAY_BUFFER,
-                     mesh.vertex_array_length * sizeof(float),
-                     mesh.vertex_colors,
+                     geometry.vertex_array_length * sizeof(float),
+                     geometry.vertex_colors,
                      GL_STATIC_DRAW);
 
         // shader layout 1
@@ -112,14 +164,12 @@ void mesh_init(Mesh &mesh, u32 vector_dimensions)
         glVertexAttribPointer(1, vector_dimensions, GL_FLOAT, GL_FALSE, 0, NULL);
     }
 
-    if(mesh.vertex_normals)
+    if(geometry.vertex_normals)
     {
-        GLuint normal_buffer;
-        glGenBuffers(1, &normal_buffer);
-        glBindBuffer(GL_ARRAY_BUFFER, normal_buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, geometry.buffers[3]);
         glBufferData(GL_ARRAY_BUFFER,
-                     mesh.vertex_array_length * sizeof(float),
-                     mesh.vertex_normals,
+                     geometry.vertex_array_length * sizeof(float),
+                     geometry.vertex_normals,
                      GL_STATIC_DRAW);
 
         // shader layout 2
@@ -129,108 +179,217 @@ void mesh_init(Mesh &mesh, u32 vector_dimensions)
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
 
-    mesh.vao = vao;
+    geometry.vao = vao;
+#endif
 }
 
 
-void mesh_draw_bbox(Mesh& mesh, u32 shader_id, glm::mat4 vp) {
+// Frees the GPU buffers, the CPU arrays stay since the BLAS cache can
+// still point into them
+void mesh_geometry_unload(MeshGeometry &geometry)
+{
+#ifndef HEADLESS
+    if(!geometry.vao)
+        return;
+    debug_gl_deleted(DEBUG_ALLOC_GL_BUFFER, 4, geometry.buffers);
+    debug_gl_deleted(DEBUG_ALLOC_GL_VERTEX_ARRAY, 1, &geometry.vao);
+    glDeleteBuffers(4, geometry.buffers);
+    glDeleteVertexArrays(1, &geometry.vao);
+#endif
+    geometry.vao = 0;
+    memset(geometry.buffers, 0, sizeof(geometry.buffers));
+}
+
+
+// The arrays are not copied, they have to outlive the geometry
+MeshGeometry* mesh_geometry_create(float* vertex_positions, float* vertex_colors, float* vertex_normals,
+                                   u32 vertex_array_length, u32* indices, u32 index_count,
+                                   u32 vector_dimensions)
+{
+    MeshGeometry* geometry = (MeshGeometry*)calloc(1, sizeof(MeshGeometry));
+    geometry->vertex_positions = vertex_positions;
+    geometry->vertex_colors = vertex_colors;
+    geometry->vertex_normals = vertex_normals;
+    geometry->vertex_array_length = vertex_array_length;
+    geometry->indices = indices;
+    geometry->index_count = index_count;
+    geometry->vector_dimensions = vector_dimensions;
+    geometry->bvh = NULL;
+    mesh_get_bbox(vertex_positions, vertex_array_length, geometry->bbox);
+
+    print("%f %f %f - %f %f %f", geometry->bbox[0], geometry->bbox[1], geometry->bbox[2],
+          geometry->bbox[3], geometry->bbox[4], geometry->bbox[5]);
+    return geometry;
+}
+
+
+// New mesh drawing the geometry at the origin, uploads the geometry when
+// it isn't on the GPU yet
+Mesh mesh_create(MeshGeometry* geometry)
+{
+    if(geometry->ref_count++ == 0)
+        mesh_geometry_upload(*geometry);
+
+    Mesh mesh;
+    mesh.geometry = geometry;
+    mesh.shader_id = 0;
+    mesh.model_matrix = glm::mat4(1);
+    mesh.inverse_model_matrix = glm::mat4(1);
+    mesh.inverse_transpose_model_matrix = glm::mat4(1);
+    mesh.mesh_name = "mesh";
+    return mesh;
+}
+
+
+// Drops the mesh's reference, the last one frees the GPU buffers
+void mesh_release(Mesh &mesh)
+{
+    MeshGeometry* geometry = mesh.geometry;
+    if(geometry && geometry->ref_count > 0 && --geometry->ref_count == 0)
+        mesh_geometry_unload(*geometry);
+    mesh.geometry = NULL;
+}
+
+
+#ifndef HEADLESS
+// Draws the bound vao, through the element buffer for indexed meshes
+void mesh_draw_elements(MeshGeometry &geometry, GLenum mode)
+{
+    if(geometry.indices)
+        glDrawElements(mode, geometry.index_count, geometry.index_type, 0);
+    else
+        glDrawArrays(mode, 0, geometry.vertex_array_length / geometry.vector_dimensions);
+}
+
+
+void mesh_draw_elements_instanced(MeshGeometry &geometry, GLenum mode, u32 instance_count)
+{
+    if(geometry.indices)
+        glDrawElementsInstanced(mode, geometry.index_count, geometry.index_type, 0, instance_count);
+    else
+        glDrawArraysInstanced(mode, 0, geometry.vertex_array_length / geometry.vector_dimensions, instance_count);
+}
+
+
+// Bounding boxes drawn as one instanced call. The unit cube is uploaded
+// once, every box is a transform in the instance buffer, which only grows.
+typedef struct BBoxBatch
+{
+    GLuint vao;
+    GLuint buffers[3];  // cube corners, edge indices, instance transforms
+    u32 instance_capacity;
+    Array transforms;   // glm::mat4 per box, emptied by bbox_batch_draw
+} BBoxBatch;
+
+
+void bbox_batch_init(BBoxBatch &batch)
+{
     // Cube 1x1x1, centered on origin
     GLfloat vertices[] = {
-        -0.5, -0.5, -0.5, 1.0,
-        0.5, -0.5, -0.5, 1.0,
-        0.5,  0.5, -0.5, 1.0,
-        -0.5,  0.5, -0.5, 1.0,
-        -0.5, -0.5,  0.5, 1.0,
-        0.5, -0.5,  0.5, 1.0,
-        0.5,  0.5,  0.5, 1.0,
-        -0.5,  0.5,  0.5, 1.0,
+        -0.5, -0.5, -0.5,
+        0.5, -0.5, -0.5,
+        0.5,  0.5, -0.5,
+        -0.5,  0.5, -0.5,
+        -0.5, -0.5,  0.5,
+        0.5, -0.5,  0.5,
+        0.5,  0.5,  0.5,
+        -0.5,  0.5,  0.5,
     };
 
-    GLfloat colors[] = {
-        1.0, 0.0, 0.0, 1.0,
-        1.0, 0.0, 0.0, 1.0,
-        1.0, 0.0, 0.0, 1.0,
-        1.0, 0.0, 0.0, 1.0,
-        1.0, 0.0, 0.0, 1.0,
-        1.0, 0.0, 0.0, 1.0,
-        1.0, 0.0, 0.0, 1.0,
-        1.0, 0.0, 0.0, 1.0,
+    // The 12 edges as lines
+    GLushort elements[] = {
+        0, 1, 1, 2, 2, 3, 3, 0,
+        4, 5, 5, 6, 6, 7, 7, 4,
+        0, 4, 1, 5, 2, 6, 3, 7
     };
-    GLuint vao;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
 
-    GLuint vbo_vertices;
-    glGenBuffers(1, &vbo_vertices);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo_vertices);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glGenVertexArrays(1, &batch.vao);
+    debug_gl_created(DEBUG_ALLOC_GL_VERTEX_ARRAY, 1, &batch.vao);
+    glBindVertexArray(batch.vao);
 
-    GLushort elements[] = {
-        0, 1, 2, 3,
-        4, 5, 6, 7,
-        0, 4, 1, 5,
-        2, 6, 3, 7
-    };
+    glGenBuffers(3, batch.buffers);
+    debug_gl_created(DEBUG_ALLOC_GL_BUFFER, 3, batch.buffers);
+
+    glBindBuffer(GL_ARRAY_BUFFER, batch.buffers[0]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    // shader layout 0
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
 
-    GLuint ibo_elements;
-    glGenBuffers(1, &ibo_elements);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_elements);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch.buffers[1]);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(elements), elements, GL_STATIC_DRAW);
+
+    // shader layout 1-4, a mat4 per instance, one column per location
+    glBindBuffer(GL_ARRAY_BUFFER, batch.buffers[2]);
+    for(u32 i=0; i < 4; ++i)
+    {
+        glEnableVertexAttribArray(1 + i);
+        glVertexAttribPointer(1 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                              (GLvoid*)(i * sizeof(glm::vec4)));
+        glVertexAttribDivisor(1 + i, 1);
+    }
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-    float minx = mesh.bbox[0];
-    float miny = mesh.bbox[1];
-    float minz = mesh.bbox[2];
-    float maxx = mesh.bbox[3];
-    float maxy = mesh.bbox[4];
-    float maxz = mesh.bbox[5];
+    batch.instance_capacity = 0;
+    array_init(batch.transforms, sizeof(glm::mat4), 16);
+}
 
-    glm::vec3 size = glm::vec3(maxx-minx, maxy-miny, maxz-minz);
-    glm::mat4 transform = vp * glm::scale(mesh.model_matrix, size);
 
-    /* Apply object's transformation matrix */
-    glUseProgram(shader_id);
-    GLuint matrix_id = glGetUniformLocation(shader_id, "MVP");
-    glUniformMatrix4fv(matrix_id, 1, GL_FALSE, &transform[0][0]);
-
-    glBindBuffer(GL_ARRAY_BUFFER, vbo_vertices);
-    u32 attribute_v_coord = 0;
-    glEnableVertexAttribArray(attribute_v_coord);
-    glVertexAttribPointer(
-        attribute_v_coord,  // attribute
-        4,                  // number of elements per vertex, here (x,y,z,w)
-        GL_FLOAT,           // the type of each element
-        GL_FALSE,           // take our values as-is
-        0,                  // no extra data between each position
-        0                   // offset of first element
-    );
-
-    GLuint colorbuffer;
-    glGenBuffers(1, &colorbuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, colorbuffer);
-    glBufferData(GL_ARRAY_BUFFER,
-                 32 * sizeof(float),
-                 colors,
-                 GL_STATIC_DRAW);
+// Queues the bbox of mesh for the next bbox_batch_draw
+void bbox_batch_add(BBoxBatch &batch, Mesh &mesh)
+{
+    float* bbox = mesh.geometry->bbox;
+    glm::vec3 min = glm::vec3(bbox[0], bbox[1], bbox[2]);
+    glm::vec3 max = glm::vec3(bbox[3], bbox[4], bbox[5]);
 
-    // shader layout 1
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, NULL);
+    glm::mat4 transform = glm::translate(mesh.model_matrix, (min + max) * 0.5f);
+    transform = glm::scale(transform, max - min);
+    array_append(batch.transforms, &transform);
+}
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_elements);
-    glDrawElements(GL_LINE_LOOP, 4, GL_UNSIGNED_SHORT, 0);
-    glDrawElements(GL_LINE_LOOP, 4, GL_UNSIGNED_SHORT, (GLvoid*)(4*sizeof(GLushort)));
-    glDrawElements(GL_LINES, 8, GL_UNSIGNED_SHORT, (GLvoid*)(8*sizeof(GLushort)));
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-    glDisableVertexAttribArray(attribute_v_coord);
+// Draws every queued bbox and empties the queue
+void bbox_batch_draw(BBoxBatch &batch, u32 shader_id, glm::mat4 vp)
+{
+    u32 instance_count = batch.transforms.element_count;
+    if(instance_count == 0)
+        return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, batch.buffers[2]);
+    if(instance_count > batch.instance_capacity)
+    {
+        batch.instance_capacity = batch.transforms.max_element_count;
+        glBufferData(GL_ARRAY_BUFFER, batch.instance_capacity * sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+    }
+    glBufferSubData(GL_ARRAY_BUFFER, 0, instance_count * sizeof(glm::mat4), batch.transforms.base_ptr);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-    glDeleteBuffers(1, &vbo_vertices);
-    glDeleteBuffers(1, &ibo_elements);
+    glUseProgram(shader_id);
+    GLuint matrix_id = glGetUniformLocation(shader_id, "VP");
+    glUniformMatrix4fv(matrix_id, 1, GL_FALSE, &vp[0][0]);
+
+    glBindVertexArray(batch.vao);
+    glDrawElementsInstanced(GL_LINES, 24, GL_UNSIGNED_SHORT, 0, instance_count);
     glBindVertexArray(0);
     glUseProgram(0);
+
+    array_clear(batch.transforms);
+}
+
+
+void bbox_batch_free(BBoxBatch &batch)
+{
+    debug_gl_deleted(DEBUG_ALLOC_GL_BUFFER, 3, batch.buffers);
+    debug_gl_deleted(DEBUG_ALLOC_GL_VERTEX_ARRAY, 1, &batch.vao);
+    glDeleteBuffers(3, batch.buffers);
+    glDeleteVertexArrays(1, &batch.vao);
+    array_free(batch.transforms);
+    batch.vao = 0;
+    batch.instance_capacity = 0;
 }
+#endif // HEADLESS
 
 #endif // MESHH
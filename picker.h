@@ -0,0 +1,337 @@
+#ifndef PICKERH
+#define PICKERH
+
+#include <stddef.h>
+#include <string.h>
+
+#include "types.h"
+#include "debug.h"
+
+// Picking from an offscreen ID buffer without stalling on the GPU.
+// The ID pass writes unsigned integers into the picker's framebuffer: the
+// id of the object in a GL_R32UI attachment, 0 where there is nothing, and
+// optionally gl_PrimitiveID of the triangle in a second one, for face and
+// vertex picking. Depth can be read back with the pick as well.
+// The ID pass only renders when the view, the scene or the size changed
+// since the last one. Reading the
+// pixel under the cursor goes into one of a few pixel buffer objects with
+// a fence behind it; picker_poll picks the result up a frame or two later,
+// once the fence has passed, and never waits for it. When nothing moves
+// there is no ID pass and no readback at all.
+// Face and vertex clicks want the current pixels and read the framebuffer
+// directly with picker_pick, which waits.
+
+// Readbacks in flight, a third one covers a frame of driver latency
+#define PICKER_READBACK_COUNT 3
+
+// Flags of picker_init
+#define PICKER_PRIMITIVE_IDS (1 << 0)
+#define PICKER_DEPTH (1 << 1)
+
+#define PICKER_ATTACHMENT_IDS 0
+#define PICKER_ATTACHMENT_PRIMITIVES 1
+#define PICKER_ATTACHMENT_DEPTH 2
+
+
+// What is under a pixel. primitive and depth are 0 unless the picker was
+// made with PICKER_PRIMITIVE_IDS and PICKER_DEPTH.
+typedef struct PickResult
+{
+    u32 id;
+    u32 primitive;
+    float depth;  // window space, 1 is the far plane
+    int x;
+    int y;
+} PickResult;
+
+
+typedef struct PickerReadback
+{
+    GLuint buffer;  // one PickResult
+    GLsync fence;   // NULL while the slot is free
+    int x;
+    int y;
+} PickerReadback;
+
+
+typedef struct Picker
+{
+    u32 flags;
+    GLuint framebuffer;
+    GLuint renderbuffers[3];  // ids, primitives, depth
+    int width;
+    int height;
+
+    PickerReadback readbacks[PICKER_READBACK_COUNT];
+    u32 next_readback;    // slot the next request goes to
+    u32 oldest_readback;  // slot picker_poll checks
+    u32 pending_count;
+
+    // What the ID buffer holds
+    glm::mat4 vp;
+    u32 scene_version;
+    bool valid;
+
+    // Cursor the next readback is for, dirty when it or the ID buffer
+    // changed since the last request
+    int cursor_x;
+    int cursor_y;
+    bool dirty;
+
+    // Latest readback
+    PickResult result;
+} Picker;
+
+
+void picker_create_framebuffer(Picker &picker, int width, int height)
+{
+    picker.width = width;
+    picker.height = height;
+
+    glGenFramebuffers(1, &picker.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, picker.framebuffer);
+    glGenRenderbuffers(3, picker.renderbuffers);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, picker.renderbuffers[PICKER_ATTACHMENT_IDS]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_R32UI, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER,
+                              picker.renderbuffers[PICKER_ATTACHMENT_IDS]);
+
+    GLenum draw_buffers[2] = {GL_COLOR_ATTACHMENT0, GL_NONE};
+    if (picker.flags & PICKER_PRIMITIVE_IDS)
+    {
+        glBindRenderbuffer(GL_RENDERBUFFER, picker.renderbuffers[PICKER_ATTACHMENT_PRIMITIVES]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_R32UI, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_RENDERBUFFER,
+                                  picker.renderbuffers[PICKER_ATTACHMENT_PRIMITIVES]);
+        draw_buffers[1] = GL_COLOR_ATTACHMENT1;
+    }
+    glDrawBuffers(2, draw_buffers);
+
+    // NOTE(kk): The ID pass depth tests either way, PICKER_DEPTH only makes
+    // the values exact enough to unproject
+    glBindRenderbuffer(GL_RENDERBUFFER, picker.renderbuffers[PICKER_ATTACHMENT_DEPTH]);
+    glRenderbufferStorage(GL_RENDERBUFFER, picker.flags & PICKER_DEPTH ? GL_DEPTH_COMPONENT32F : GL_DEPTH_COMPONENT24,
+                          width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER,
+                              picker.renderbuffers[PICKER_ATTACHMENT_DEPTH]);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        print("Picker framebuffer %ix%i incomplete", width, height);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+
+void picker_delete_framebuffer(Picker &picker)
+{
+    glDeleteRenderbuffers(3, picker.renderbuffers);
+    glDeleteFramebuffers(1, &picker.framebuffer);
+}
+
+
+// width and height of the window's framebuffer, flags PICKER_PRIMITIVE_IDS
+// and PICKER_DEPTH add those to every pick
+void picker_init(Picker &picker, int width, int height, u32 flags)
+{
+    picker = {};
+    picker.flags = flags;
+    picker_create_framebuffer(picker, width, height);
+
+    for (u32 i=0; i < PICKER_READBACK_COUNT; ++i)
+    {
+        PickerReadback &readback = picker.readbacks[i];
+        glGenBuffers(1, &readback.buffer);
+        debug_gl_created(DEBUG_ALLOC_GL_BUFFER, 1, &readback.buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(PickResult), NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+
+void picker_free(Picker &picker)
+{
+    for (u32 i=0; i < PICKER_READBACK_COUNT; ++i)
+    {
+        PickerReadback &readback = picker.readbacks[i];
+        if (readback.fence)
+            glDeleteSync(readback.fence);
+        debug_gl_deleted(DEBUG_ALLOC_GL_BUFFER, 1, &readback.buffer);
+        glDeleteBuffers(1, &readback.buffer);
+    }
+    picker_delete_framebuffer(picker);
+}
+
+
+// Binds and clears the ID framebuffer and returns true when the ID pass has
+// to be rendered, false when the buffer still shows this view and scene.
+// Call picker_end_pass after rendering.
+bool picker_begin_pass(Picker &picker, glm::mat4 vp, u32 scene_version, int width, int height)
+{
+    if (width != picker.width || height != picker.height)
+    {
+        picker_delete_framebuffer(picker);
+        picker_create_framebuffer(picker, width, height);
+        picker.valid = false;
+    }
+
+    if (picker.valid && picker.scene_version == scene_version &&
+        memcmp(&picker.vp, &vp, sizeof(glm::mat4)) == 0)
+        return false;
+
+    picker.vp = vp;
+    picker.scene_version = scene_version;
+    picker.valid = true;
+    // The pixel under the cursor may have changed with the buffer
+    picker.dirty = true;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, picker.framebuffer);
+    glViewport(0, 0, width, height);
+    // NOTE(kk): glClear with the float clear color is undefined for integer
+    // attachments
+    GLuint no_id[4] = {0, 0, 0, 0};
+    GLfloat far_depth = 1.0f;
+    glClearBufferuiv(GL_COLOR, 0, no_id);
+    if (picker.flags & PICKER_PRIMITIVE_IDS)
+        glClearBufferuiv(GL_COLOR, 1, no_id);
+    glClearBufferfv(GL_DEPTH, 0, &far_depth);
+    return true;
+}
+
+
+void picker_end_pass()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+
+// Cursor in framebuffer pixels, bottom left origin
+void picker_set_cursor(Picker &picker, int x, int y)
+{
+    if (x == picker.cursor_x && y == picker.cursor_y)
+        return;
+    picker.cursor_x = x;
+    picker.cursor_y = y;
+    picker.dirty = true;
+}
+
+
+// Reads one pixel of every attachment into result, or into the bound pixel
+// pack buffer when result is the offset there
+void picker_read(Picker &picker, int x, int y, PickResult* result)
+{
+    byte* base = (byte*)result;
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, picker.framebuffer);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(x, y, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, base + offsetof(PickResult, id));
+    if (picker.flags & PICKER_PRIMITIVE_IDS)
+    {
+        glReadBuffer(GL_COLOR_ATTACHMENT1);
+        glReadPixels(x, y, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, base + offsetof(PickResult, primitive));
+    }
+    if (picker.flags & PICKER_DEPTH)
+        glReadPixels(x, y, 1, 1, GL_DEPTH_COMPONENT, GL_FLOAT, base + offsetof(PickResult, depth));
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+
+// Attachments the picker doesn't have read as 0
+void picker_clear_missing(Picker &picker, PickResult &result)
+{
+    if (!(picker.flags & PICKER_PRIMITIVE_IDS))
+        result.primitive = 0;
+    if (!(picker.flags & PICKER_DEPTH))
+        result.depth = 0.0f;
+}
+
+
+// Starts reading the pixel under the cursor when the cursor or the ID
+// buffer changed. Returns without waiting; when all readbacks are in
+// flight the request stays dirty for the next frame.
+void picker_request(Picker &picker)
+{
+    if (!picker.dirty || !picker.valid || picker.pending_count == PICKER_READBACK_COUNT)
+        return;
+
+    picker.dirty = false;
+    int x = picker.cursor_x;
+    int y = picker.cursor_y;
+    if (x < 0 || y < 0 || x >= picker.width || y >= picker.height)
+    {
+        // Outside of the window is over nothing
+        memset(&picker.result, 0, sizeof(PickResult));
+        picker.result.x = x;
+        picker.result.y = y;
+        return;
+    }
+
+    PickerReadback &readback = picker.readbacks[picker.next_readback];
+    readback.x = x;
+    readback.y = y;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    // NOTE(kk): With a pack buffer bound the pointer is an offset into it
+    // and the calls return without waiting for the ID pass to finish
+    picker_read(picker, x, y, (PickResult*)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    picker.next_readback = (picker.next_readback + 1) % PICKER_READBACK_COUNT;
+    picker.pending_count++;
+}
+
+
+// Collects the readbacks that finished, never waits. Returns true when
+// picker.result was updated.
+bool picker_poll(Picker &picker)
+{
+    bool updated = false;
+    while (picker.pending_count > 0)
+    {
+        PickerReadback &readback = picker.readbacks[picker.oldest_readback];
+        GLenum status = glClientWaitSync(readback.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+
+        glDeleteSync(readback.fence);
+        readback.fence = NULL;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        PickResult* result = (PickResult*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sizeof(PickResult),
+                                                           GL_MAP_READ_BIT);
+        if (result)
+        {
+            picker.result = *result;
+            picker.result.x = readback.x;
+            picker.result.y = readback.y;
+            picker_clear_missing(picker, picker.result);
+            updated = true;
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        picker.oldest_readback = (picker.oldest_readback + 1) % PICKER_READBACK_COUNT;
+        picker.pending_count--;
+    }
+    return updated;
+}
+
+
+// What is under the pixel now, waits for the GPU. For clicks, where the
+// result is needed right away.
+PickResult picker_pick(Picker &picker, int x, int y)
+{
+    PickResult result = {};
+    result.x = x;
+    result.y = y;
+    if (x < 0 || y < 0 || x >= picker.width || y >= picker.height)
+        return result;
+
+    picker_read(picker, x, y, &result);
+    picker_clear_missing(picker, result);
+    return result;
+}
+
+#endif // PICKERH
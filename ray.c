@@ -1,6 +1,8 @@
 #ifndef RAYH
 #define RAYH
 
+#include <float.h>
+
 float EPSILON = 0.0000001f;
 
 struct Material
@@ -23,6 +25,22 @@ struct HitRecord
     /*Material *matrial;*/
 };
 
+// Traversal counters for benchmarks, every thread counts its own rays.
+// Compiled out unless RAY_STATS is defined, the increments sit in the
+// innermost loops of the intersectors.
+typedef struct RayStats
+{
+    u64 nodes_visited;
+    u64 triangle_tests;
+} RayStats;
+
+#ifdef RAY_STATS
+static thread_local RayStats ray_stats;
+#define RAY_STATS_ADD(counter, n) (ray_stats.counter += (n))
+#else
+#define RAY_STATS_ADD(counter, n)
+#endif
+
 struct Triangle
 {
     glm::vec3 A;
@@ -122,6 +140,30 @@ bool ray_intersect_box(const Ray &r, glm::vec3 vmin, glm::vec3 vmax)
 }
 
 
+// Slab test against a min/max float[6] box, returns the entry distance or
+// FLT_MAX when the box is missed or further away than t_max
+float ray_intersect_box_distance(const Ray &r, glm::vec3 inverse_direction, const float* bbox, float t_max)
+{
+    float tx1 = (bbox[0] - r.origin.x) * inverse_direction.x;
+    float tx2 = (bbox[3] - r.origin.x) * inverse_direction.x;
+    float tmin = fmin(tx1, tx2);
+    float tmax = fmax(tx1, tx2);
+
+    float ty1 = (bbox[1] - r.origin.y) * inverse_direction.y;
+    float ty2 = (bbox[4] - r.origin.y) * inverse_direction.y;
+    tmin = fmax(tmin, fmin(ty1, ty2));
+    tmax = fmin(tmax, fmax(ty1, ty2));
+
+    float tz1 = (bbox[2] - r.origin.z) * inverse_direction.z;
+    float tz2 = (bbox[5] - r.origin.z) * inverse_direction.z;
+    tmin = fmax(tmin, fmin(tz1, tz2));
+    tmax = fmin(tmax, fmax(tz1, tz2));
+
+    if (tmax >= tmin && tmin < t_max && tmax > 0)
+        return tmin;
+    return FLT_MAX;
+}
+
 glm::vec2 pixel_to_NDC(float x, float y, float window_width, float window_height)
 {
      float x_ndc = (x + 0.5) / window_width;
@@ -0,0 +1,233 @@
+#ifndef RAYPACKETH
+#define RAYPACKETH
+
+#include "types.h"
+#include "tlas.h"
+
+// Coherent primary rays traced together, 4 wide with SSE or 8 wide with
+// AVX2. The width is picked at runtime from the CPU features, everything
+// else (and non-x86 builds) falls back to tracing the lanes one by one.
+
+#define PACKET_MAX_WIDTH 8
+
+
+typedef struct RayPacket
+{
+    alignas(32) float origin_x[PACKET_MAX_WIDTH];
+    alignas(32) float origin_y[PACKET_MAX_WIDTH];
+    alignas(32) float origin_z[PACKET_MAX_WIDTH];
+    alignas(32) float direction_x[PACKET_MAX_WIDTH];
+    alignas(32) float direction_y[PACKET_MAX_WIDTH];
+    alignas(32) float direction_z[PACKET_MAX_WIDTH];
+    alignas(32) float t[PACKET_MAX_WIDTH];
+    alignas(32) float normal_x[PACKET_MAX_WIDTH];
+    alignas(32) float normal_y[PACKET_MAX_WIDTH];
+    alignas(32) float normal_z[PACKET_MAX_WIDTH];
+    u32 width;
+} RayPacket;
+
+
+void ray_packet_set(RayPacket &packet, u32 lane, Ray &ray, float t_max)
+{
+    packet.origin_x[lane] = ray.origin.x;
+    packet.origin_y[lane] = ray.origin.y;
+    packet.origin_z[lane] = ray.origin.z;
+    packet.direction_x[lane] = ray.direction.x;
+    packet.direction_y[lane] = ray.direction.y;
+    packet.direction_z[lane] = ray.direction.z;
+    packet.t[lane] = t_max;
+    packet.normal_x[lane] = 0.0f;
+    packet.normal_y[lane] = 0.0f;
+    packet.normal_z[lane] = 0.0f;
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RAY_PACKET_SIMD 1
+#include <immintrin.h>
+
+// SSE, 4 wide
+#define VF __m128
+#define VF_SET1(a) _mm_set1_ps(a)
+#define VF_LOAD(p) _mm_load_ps(p)
+#define VF_STORE(p, a) _mm_store_ps(p, a)
+#define VF_ADD(a, b) _mm_add_ps(a, b)
+#define VF_SUB(a, b) _mm_sub_ps(a, b)
+#define VF_MUL(a, b) _mm_mul_ps(a, b)
+#define VF_DIV(a, b) _mm_div_ps(a, b)
+#define VF_MIN(a, b) _mm_min_ps(a, b)
+#define VF_MAX(a, b) _mm_max_ps(a, b)
+#define VF_SQRT(a) _mm_sqrt_ps(a)
+#define VF_AND(a, b) _mm_and_ps(a, b)
+#define VF_OR(a, b) _mm_or_ps(a, b)
+#define VF_CMPEQ(a, b) _mm_cmpeq_ps(a, b)
+#define VF_CMPLT(a, b) _mm_cmplt_ps(a, b)
+#define VF_CMPLE(a, b) _mm_cmple_ps(a, b)
+#define VF_CMPGT(a, b) _mm_cmpgt_ps(a, b)
+#define VF_CMPGE(a, b) _mm_cmpge_ps(a, b)
+#define VF_MOVEMASK(a) _mm_movemask_ps(a)
+#define VF_BLEND(a, b, mask) _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a))
+
+static inline float vf_hmin_4(__m128 a)
+{
+    a = _mm_min_ps(a, _mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 0, 3, 2)));
+    a = _mm_min_ps(a, _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtss_f32(a);
+}
+#define VF_HMIN(a) vf_hmin_4(a)
+#define PACKET_WIDTH 4
+#define PACKET_FN(name) name##_4
+
+#include "ray_packet_kernel.h"
+
+#undef VF
+#undef VF_SET1
+#undef VF_LOAD
+#undef VF_STORE
+#undef VF_ADD
+#undef VF_SUB
+#undef VF_MUL
+#undef VF_DIV
+#undef VF_MIN
+#undef VF_MAX
+#undef VF_SQRT
+#undef VF_AND
+#undef VF_OR
+#undef VF_CMPEQ
+#undef VF_CMPLT
+#undef VF_CMPLE
+#undef VF_CMPGT
+#undef VF_CMPGE
+#undef VF_MOVEMASK
+#undef VF_BLEND
+#undef VF_HMIN
+#undef PACKET_WIDTH
+#undef PACKET_FN
+
+// AVX2, 8 wide. Only this block is compiled for AVX2 so the rest of the
+// binary still runs on CPUs without it. No FMA, fusing the multiplies and
+// adds would round the triangle test differently than the scalar path.
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2"))), apply_to=function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+#define VF __m256
+#define VF_SET1(a) _mm256_set1_ps(a)
+#define VF_LOAD(p) _mm256_load_ps(p)
+#define VF_STORE(p, a) _mm256_store_ps(p, a)
+#define VF_ADD(a, b) _mm256_add_ps(a, b)
+#define VF_SUB(a, b) _mm256_sub_ps(a, b)
+#define VF_MUL(a, b) _mm256_mul_ps(a, b)
+#define VF_DIV(a, b) _mm256_div_ps(a, b)
+#define VF_MIN(a, b) _mm256_min_ps(a, b)
+#define VF_MAX(a, b) _mm256_max_ps(a, b)
+#define VF_SQRT(a) _mm256_sqrt_ps(a)
+#define VF_AND(a, b) _mm256_and_ps(a, b)
+#define VF_OR(a, b) _mm256_or_ps(a, b)
+#define VF_CMPEQ(a, b) _mm256_cmp_ps(a, b, _CMP_EQ_OQ)
+#define VF_CMPLT(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define VF_CMPLE(a, b) _mm256_cmp_ps(a, b, _CMP_LE_OQ)
+#define VF_CMPGT(a, b) _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define VF_CMPGE(a, b) _mm256_cmp_ps(a, b, _CMP_GE_OQ)
+#define VF_MOVEMASK(a) _mm256_movemask_ps(a)
+#define VF_BLEND(a, b, mask) _mm256_blendv_ps(a, b, mask)
+
+static inline float vf_hmin_8(__m256 a)
+{
+    a = _mm256_min_ps(a, _mm256_permute2f128_ps(a, a, 1));
+    a = _mm256_min_ps(a, _mm256_shuffle_ps(a, a, _MM_SHUFFLE(1, 0, 3, 2)));
+    a = _mm256_min_ps(a, _mm256_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm256_cvtss_f32(a);
+}
+#define VF_HMIN(a) vf_hmin_8(a)
+#define PACKET_WIDTH 8
+#define PACKET_FN(name) name##_8
+
+#include "ray_packet_kernel.h"
+
+#undef VF
+#undef VF_SET1
+#undef VF_LOAD
+#undef VF_STORE
+#undef VF_ADD
+#undef VF_SUB
+#undef VF_MUL
+#undef VF_DIV
+#undef VF_MIN
+#undef VF_MAX
+#undef VF_SQRT
+#undef VF_AND
+#undef VF_OR
+#undef VF_CMPEQ
+#undef VF_CMPLT
+#undef VF_CMPLE
+#undef VF_CMPGT
+#undef VF_CMPGE
+#undef VF_MOVEMASK
+#undef VF_BLEND
+#undef VF_HMIN
+#undef PACKET_WIDTH
+#undef PACKET_FN
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#endif // x86
+
+
+// Widest packet the CPU supports, 1 means the scalar path
+u32 ray_packet_detect_width()
+{
+#if RAY_PACKET_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return 8;
+    return 4;
+#else
+    return 1;
+#endif
+}
+
+
+// Closest hit for every lane, lanes that miss keep their initial t
+void ray_packet_intersect(TLAS &tlas, RayPacket &packet, float t_min)
+{
+#if RAY_PACKET_SIMD
+    if (packet.width == 8)
+    {
+        packet_intersect_tlas_8(tlas, packet, t_min);
+        return;
+    }
+    if (packet.width == 4)
+    {
+        packet_intersect_tlas_4(tlas, packet, t_min);
+        return;
+    }
+#endif
+    for (u32 lane=0; lane < packet.width; ++lane)
+    {
+        Ray r;
+        r.origin = glm::vec3(packet.origin_x[lane], packet.origin_y[lane], packet.origin_z[lane]);
+        r.direction = glm::vec3(packet.direction_x[lane], packet.direction_y[lane], packet.direction_z[lane]);
+
+        HitRecord hit;
+        hit.t = packet.t[lane];
+        hit.p = glm::vec3(0);
+        hit.normal = glm::vec3(0);
+        if (tlas_intersect(tlas, r, t_min, hit))
+        {
+            packet.t[lane] = hit.t;
+            packet.normal_x[lane] = hit.normal.x;
+            packet.normal_y[lane] = hit.normal.y;
+            packet.normal_z[lane] = hit.normal.z;
+        }
+    }
+}
+
+#endif // RAYPACKETH
@@ -0,0 +1,264 @@
+// Packet traversal kernel, included once per SIMD width by ray_packet.c.
+// The includer defines VF and the VF_* operations, PACKET_WIDTH and
+// PACKET_FN(name), which suffixes every function with the width.
+//
+// Lanes are rays in SoA layout. Every function takes a lane mask of rays
+// that are still active and only ever writes results into those lanes.
+
+
+static inline VF PACKET_FN(packet_dot)(VF ax, VF ay, VF az, VF bx, VF by, VF bz)
+{
+    return VF_ADD(VF_ADD(VF_MUL(ax, bx), VF_MUL(ay, by)), VF_MUL(az, bz));
+}
+
+
+// Returns the mask of lanes entering the box before their current closest
+// hit, entry is set to the nearest entry distance over those lanes
+static inline VF PACKET_FN(packet_intersect_box)(const float* bbox, VF* origin, VF* inverse_direction,
+                                                 VF t_max, VF active, float &entry)
+{
+    VF t1 = VF_MUL(VF_SUB(VF_SET1(bbox[0]), origin[0]), inverse_direction[0]);
+    VF t2 = VF_MUL(VF_SUB(VF_SET1(bbox[3]), origin[0]), inverse_direction[0]);
+    VF tmin = VF_MIN(t1, t2);
+    VF tmax = VF_MAX(t1, t2);
+
+    t1 = VF_MUL(VF_SUB(VF_SET1(bbox[1]), origin[1]), inverse_direction[1]);
+    t2 = VF_MUL(VF_SUB(VF_SET1(bbox[4]), origin[1]), inverse_direction[1]);
+    tmin = VF_MAX(tmin, VF_MIN(t1, t2));
+    tmax = VF_MIN(tmax, VF_MAX(t1, t2));
+
+    t1 = VF_MUL(VF_SUB(VF_SET1(bbox[2]), origin[2]), inverse_direction[2]);
+    t2 = VF_MUL(VF_SUB(VF_SET1(bbox[5]), origin[2]), inverse_direction[2]);
+    tmin = VF_MAX(tmin, VF_MIN(t1, t2));
+    tmax = VF_MIN(tmax, VF_MAX(t1, t2));
+
+    VF hit = VF_AND(VF_CMPGE(tmax, tmin), VF_CMPLT(tmin, t_max));
+    hit = VF_AND(active, VF_AND(hit, VF_CMPGT(tmax, VF_SET1(0.0f))));
+    if (!VF_MOVEMASK(hit))
+        return hit;
+
+    entry = VF_HMIN(VF_BLEND(VF_SET1(FLT_MAX), tmin, hit));
+    return hit;
+}
+
+
+// Masked Moller-Trumbore against a stored triangle, same acceptance rules
+// as ray_intersect_triangle
+static inline void PACKET_FN(packet_intersect_triangle)(TriangleStore &store, u32 i, VF* origin, VF* direction,
+                                                       float t_min, VF &t, VF* normal, VF mask)
+{
+    VF ab[3] = {VF_SET1(store.e1x[i]), VF_SET1(store.e1y[i]), VF_SET1(store.e1z[i])};
+    VF ac[3] = {VF_SET1(store.e2x[i]), VF_SET1(store.e2y[i]), VF_SET1(store.e2z[i])};
+
+    VF px = VF_SUB(VF_MUL(direction[1], ac[2]), VF_MUL(direction[2], ac[1]));
+    VF py = VF_SUB(VF_MUL(direction[2], ac[0]), VF_MUL(direction[0], ac[2]));
+    VF pz = VF_SUB(VF_MUL(direction[0], ac[1]), VF_MUL(direction[1], ac[0]));
+
+    VF det = PACKET_FN(packet_dot)(ab[0], ab[1], ab[2], px, py, pz);
+    VF valid = VF_AND(mask, VF_OR(VF_CMPLE(det, VF_SET1(-EPSILON)), VF_CMPGE(det, VF_SET1(EPSILON))));
+    if (!VF_MOVEMASK(valid))
+        return;
+
+    VF inv_det = VF_DIV(VF_SET1(1.0f), det);
+
+    VF tx = VF_SUB(origin[0], VF_SET1(store.ax[i]));
+    VF ty = VF_SUB(origin[1], VF_SET1(store.ay[i]));
+    VF tz = VF_SUB(origin[2], VF_SET1(store.az[i]));
+
+    VF u = VF_MUL(PACKET_FN(packet_dot)(tx, ty, tz, px, py, pz), inv_det);
+    valid = VF_AND(valid, VF_AND(VF_CMPGE(u, VF_SET1(0.0f)), VF_CMPLE(u, VF_SET1(1.0f))));
+
+    VF qx = VF_SUB(VF_MUL(ty, ab[2]), VF_MUL(tz, ab[1]));
+    VF qy = VF_SUB(VF_MUL(tz, ab[0]), VF_MUL(tx, ab[2]));
+    VF qz = VF_SUB(VF_MUL(tx, ab[1]), VF_MUL(ty, ab[0]));
+
+    VF v = VF_MUL(PACKET_FN(packet_dot)(direction[0], direction[1], direction[2], qx, qy, qz), inv_det);
+    valid = VF_AND(valid, VF_AND(VF_CMPGE(v, VF_SET1(0.0f)), VF_CMPLE(VF_ADD(u, v), VF_SET1(1.0f))));
+
+    VF distance = VF_MUL(PACKET_FN(packet_dot)(ac[0], ac[1], ac[2], qx, qy, qz), inv_det);
+    valid = VF_AND(valid, VF_AND(VF_CMPGT(distance, VF_SET1(t_min)), VF_CMPLT(distance, t)));
+    if (!VF_MOVEMASK(valid))
+        return;
+
+    t = VF_BLEND(t, distance, valid);
+    normal[0] = VF_BLEND(normal[0], VF_SET1(store.nx[i]), valid);
+    normal[1] = VF_BLEND(normal[1], VF_SET1(store.ny[i]), valid);
+    normal[2] = VF_BLEND(normal[2], VF_SET1(store.nz[i]), valid);
+}
+
+
+// Moves to the nearer child hit by the packet and defers the other one,
+// pops the stack when neither child is hit. Returns false when done.
+static inline bool PACKET_FN(packet_next_node)(BVH &bvh, BVHNode* &node, VF &mask, VF* origin,
+                                               VF* inverse_direction, VF t, VF active,
+                                               u32* stack, u32 &stack_size)
+{
+    if (node->triangle_count == 0)
+    {
+        u32 near_index = node->left_first;
+        u32 far_index = node->left_first + 1;
+        float near_entry;
+        float far_entry;
+        VF near_mask = PACKET_FN(packet_intersect_box)(bvh.nodes[near_index].bbox, origin, inverse_direction, t, active, near_entry);
+        VF far_mask = PACKET_FN(packet_intersect_box)(bvh.nodes[far_index].bbox, origin, inverse_direction, t, active, far_entry);
+        bool near_hit = VF_MOVEMASK(near_mask) != 0;
+        bool far_hit = VF_MOVEMASK(far_mask) != 0;
+
+        if (near_hit && far_hit)
+        {
+            if (far_entry < near_entry)
+            {
+                u32 temp_index = near_index;
+                near_index = far_index;
+                far_index = temp_index;
+                near_mask = far_mask;
+            }
+            if (stack_size < BVH_STACK_SIZE)
+                stack[stack_size++] = far_index;
+            node = &bvh.nodes[near_index];
+            mask = near_mask;
+            return true;
+        }
+        if (near_hit || far_hit)
+        {
+            node = &bvh.nodes[near_hit ? near_index : far_index];
+            mask = near_hit ? near_mask : far_mask;
+            return true;
+        }
+    }
+
+    // Deferred nodes are tested again, the closest hits may have moved since
+    while (stack_size > 0)
+    {
+        float entry;
+        node = &bvh.nodes[stack[--stack_size]];
+        mask = PACKET_FN(packet_intersect_box)(node->bbox, origin, inverse_direction, t, active, entry);
+        if (VF_MOVEMASK(mask))
+            return true;
+    }
+    return false;
+}
+
+
+static void PACKET_FN(packet_intersect_blas)(BVH &bvh, VF* origin, VF* direction,
+                                             float t_min, VF &t, VF* normal, VF active)
+{
+    if (bvh.triangle_count == 0)
+        return;
+
+    VF one = VF_SET1(1.0f);
+    VF inverse_direction[3] = {VF_DIV(one, direction[0]), VF_DIV(one, direction[1]), VF_DIV(one, direction[2])};
+
+    u32 stack[BVH_STACK_SIZE];
+    u32 stack_size = 0;
+
+    float entry;
+    BVHNode* node = &bvh.nodes[0];
+    VF mask = PACKET_FN(packet_intersect_box)(node->bbox, origin, inverse_direction, t, active, entry);
+    if (!VF_MOVEMASK(mask))
+        return;
+
+    do
+    {
+        // Counted per active lane to compare with the one ray at a time path
+        RAY_STATS_ADD(nodes_visited, __builtin_popcount(VF_MOVEMASK(mask)));
+        if (node->triangle_count > 0)
+        {
+            RAY_STATS_ADD(triangle_tests, node->triangle_count * __builtin_popcount(VF_MOVEMASK(mask)));
+            u32 last = node->left_first + node->triangle_count;
+            for (u32 i=node->left_first; i < last; ++i)
+            {
+                PACKET_FN(packet_intersect_triangle)(bvh.triangles, i, origin, direction, t_min, t, normal, mask);
+            }
+        }
+    } while (PACKET_FN(packet_next_node)(bvh, node, mask, origin, inverse_direction, t, active, stack, stack_size));
+}
+
+
+static void PACKET_FN(packet_intersect_instance)(TLASInstance* instance, VF* origin, VF* direction,
+                                                 float t_min, VF &t, VF* normal, VF active)
+{
+    // Move the packet into object space, vectors ignore the translation column
+    glm::mat4 &m = instance->inverse_model_matrix;
+    VF object_origin[3];
+    VF object_direction[3];
+    for (u32 r=0; r < 3; ++r)
+    {
+        VF d = VF_ADD(VF_ADD(VF_MUL(VF_SET1(m[0][r]), direction[0]),
+                             VF_MUL(VF_SET1(m[1][r]), direction[1])),
+                      VF_MUL(VF_SET1(m[2][r]), direction[2]));
+        VF o = VF_ADD(VF_ADD(VF_MUL(VF_SET1(m[0][r]), origin[0]),
+                             VF_MUL(VF_SET1(m[1][r]), origin[1])),
+                      VF_ADD(VF_MUL(VF_SET1(m[2][r]), origin[2]), VF_SET1(m[3][r])));
+        object_direction[r] = d;
+        object_origin[r] = o;
+    }
+
+    VF t_before = t;
+    VF object_normal[3] = {VF_SET1(0.0f), VF_SET1(0.0f), VF_SET1(0.0f)};
+    PACKET_FN(packet_intersect_blas)(*instance->blas, object_origin, object_direction,
+                                     t_min, t, object_normal, active);
+
+    VF hit = VF_CMPLT(t, t_before);
+    if (!VF_MOVEMASK(hit))
+        return;
+
+    glm::mat4 &it = instance->inverse_transpose_model_matrix;
+    VF world_normal[3];
+    for (u32 r=0; r < 3; ++r)
+    {
+        world_normal[r] = VF_ADD(VF_ADD(VF_MUL(VF_SET1(it[0][r]), object_normal[0]),
+                                        VF_MUL(VF_SET1(it[1][r]), object_normal[1])),
+                                 VF_ADD(VF_MUL(VF_SET1(it[2][r]), object_normal[2]), VF_SET1(it[3][r])));
+    }
+    VF length = VF_SQRT(PACKET_FN(packet_dot)(world_normal[0], world_normal[1], world_normal[2],
+                                              world_normal[0], world_normal[1], world_normal[2]));
+    for (u32 r=0; r < 3; ++r)
+    {
+        normal[r] = VF_BLEND(normal[r], VF_DIV(world_normal[r], length), hit);
+    }
+}
+
+
+void PACKET_FN(packet_intersect_tlas)(TLAS &tlas, RayPacket &packet, float t_min)
+{
+    if (tlas.instance_count == 0)
+        return;
+
+    VF origin[3] = {VF_LOAD(packet.origin_x), VF_LOAD(packet.origin_y), VF_LOAD(packet.origin_z)};
+    VF direction[3] = {VF_LOAD(packet.direction_x), VF_LOAD(packet.direction_y), VF_LOAD(packet.direction_z)};
+    VF normal[3] = {VF_LOAD(packet.normal_x), VF_LOAD(packet.normal_y), VF_LOAD(packet.normal_z)};
+    VF t = VF_LOAD(packet.t);
+    VF active = VF_CMPEQ(t, t);
+
+    VF one = VF_SET1(1.0f);
+    VF inverse_direction[3] = {VF_DIV(one, direction[0]), VF_DIV(one, direction[1]), VF_DIV(one, direction[2])};
+
+    u32 stack[BVH_STACK_SIZE];
+    u32 stack_size = 0;
+
+    float entry;
+    BVHNode* node = &tlas.bvh.nodes[0];
+    VF mask = PACKET_FN(packet_intersect_box)(node->bbox, origin, inverse_direction, t, active, entry);
+    if (!VF_MOVEMASK(mask))
+        return;
+
+    do
+    {
+        RAY_STATS_ADD(nodes_visited, __builtin_popcount(VF_MOVEMASK(mask)));
+        if (node->triangle_count > 0)
+        {
+            for (u32 i=0; i < node->triangle_count; ++i)
+            {
+                u32 instance_index = tlas.bvh.triangle_indices[node->left_first + i];
+                PACKET_FN(packet_intersect_instance)(&tlas.instances[instance_index], origin, direction,
+                                                     t_min, t, normal, mask);
+            }
+        }
+    } while (PACKET_FN(packet_next_node)(tlas.bvh, node, mask, origin, inverse_direction, t, active, stack, stack_size));
+
+    VF_STORE(packet.t, t);
+    VF_STORE(packet.normal_x, normal[0]);
+    VF_STORE(packet.normal_y, normal[1]);
+    VF_STORE(packet.normal_z, normal[2]);
+}
@@ -0,0 +1,472 @@
+#ifndef RENDERC
+#define RENDERC
+
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "types.h"
+#include "array.h"
+#include "camera.h"
+#include "tlas.h"
+#include "ray_packet.c"
+#include "job_pool.h"
+
+// Bucket raytracer shared by the render view in main.c and the headless
+// render_cli.c. Nothing in here touches GL, uploading finished buckets is
+// left to the caller.
+
+static TLAS scene_tlas;
+
+static float RAY_MAX_DISTANCE = 999999999.0f;
+
+// 8 (AVX2) or 4 (SSE) wide packets for primary rays, 1 traces rays one by one
+static u32 ray_packet_width = 1;
+static u32 ray_packet_max_width = 1;
+static float render_mrays_per_second = 0;
+
+// Bucket scheduling. COST runs the buckets that were slowest in the last
+// finished pass first and falls back to SPIRAL, which runs them center-out,
+// until there are timings.
+enum bucket_order {BUCKET_ORDER_COST, BUCKET_ORDER_SPIRAL};
+const char* BucketOrderNames[] = {"COST", "SPIRAL"};
+static bucket_order render_bucket_order = BUCKET_ORDER_COST;
+static bool render_heatmap = false;
+
+
+void prepare_meshes_for_render(Array &meshes)
+{
+    for (u32 i=0; i < meshes.element_count; ++i)
+    {
+        Mesh* mesh = (Mesh*)array_get_index(meshes, i);
+        tlas_prepare_mesh(*mesh);
+    }
+    tlas_update(scene_tlas, meshes);
+}
+
+// Uses the widest packets the CPU supports, or packet_width when it is 1 or
+// 4 and the CPU supports it. 0 picks the widest.
+void render_init_packet_width(u32 packet_width)
+{
+    ray_packet_max_width = ray_packet_detect_width();
+    ray_packet_width = ray_packet_max_width;
+    if (packet_width == 1 || packet_width == 4)
+        ray_packet_width = packet_width < ray_packet_max_width ? packet_width : ray_packet_max_width;
+}
+
+void trace_ray(Camera &camera, float u, float v, HitRecord &closest_hit)
+{
+    Ray r = camera_shoot_ray(camera, u, v);
+    tlas_intersect(scene_tlas, r, 0.001f, closest_hit);
+}
+
+typedef struct RenderThreadArgs
+{
+    float  u;
+    float  v;
+    HitRecord hit_record;
+} RenderThreadArgs;
+
+
+
+typedef struct ImageBuffer
+{
+     u32* buffer;
+     u32 width;
+     u32 height;
+} ImageBuffer;
+
+
+typedef struct Bucket
+{
+     u32 xmin;
+     u32 ymin;
+     u32 xmax;
+     u32 ymax;
+} Bucket;
+
+
+enum bucket_state {BUCKET_PENDING, BUCKET_RENDERED, BUCKET_UPLOADED};
+
+#define RENDER_BUCKET_SIZE 32
+#define RENDER_BUCKET_MIN_SIZE 8
+// Buckets estimated to cost more than this many times the average bucket
+// are split in four, recursively down to RENDER_BUCKET_MIN_SIZE
+#define RENDER_BUCKET_SPLIT_FACTOR 4.0f
+
+
+struct RenderPass;
+
+typedef struct RenderRequest
+{
+    ImageBuffer image_buffer;
+    Bucket bucket;
+    RenderPass* pass;
+    volatile u32 state;
+    float priority;   // higher runs earlier
+    double seconds;   // time the worker spent tracing the bucket
+    RayStats stats;   // only counted in RAY_STATS builds
+} RenderRequest;
+
+
+// One progressive render of render_image. Workers trace the buckets in the
+// background while the main thread keeps drawing frames and uploads every
+// finished bucket. Everything the workers read is a snapshot taken when the
+// pass starts, the scene TLAS is only updated while no pass is in flight.
+typedef struct RenderPass
+{
+    RenderRequest* requests;
+    u32 request_count;
+    u32 request_capacity;
+    u32 uploaded_count;
+    JobCounter counter;
+    volatile bool cancelled;
+    bool started;
+    Camera camera;
+    u32 packet_width;
+    bool heatmap;
+    double start_time;
+
+    // Seconds spent on every RENDER_BUCKET_SIZE tile by the last finished
+    // pass, split buckets add up into the tile they came from
+    float* tile_costs;
+    u32 tiles_x;
+    u32 tiles_y;
+    bool has_tile_costs;
+    float max_pixel_cost;
+} RenderPass;
+
+
+double render_time_now()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1000000000.0;
+}
+
+
+u32* get_image_pixel(ImageBuffer image, u32 x, u32 y)
+{
+     return image.buffer + y * image.width + x;
+}
+
+u32 shade_normal(glm::vec3 normal)
+{
+    u8 colorR = (u8)((normal.x + 1) / 2 * 255.0f);
+    u8 colorG = (u8)((normal.y + 1) / 2 * 255.0f);
+    u8 colorB = (u8)((normal.z + 1) / 2 * 255.0f);
+    u8 alpha = 255;
+
+    /*print("normal %f %f %f", normal.x, normal.y, normal.z);*/
+    /*print("normal rescaled %f %f %f", (normal.x + 1) / 2, (normal.y + 1) / 2, (normal.z + 1) / 2);*/
+    return colorR | (colorG << 8) | (colorB << 16) | (alpha << 24);
+}
+
+
+// Traces the bucket in 4x2 (AVX2) or 2x2 (SSE) pixel tiles. Tiles hanging
+// over the bucket edge repeat the last pixel so every lane stays valid.
+void raycast_bucket_packets(RenderPass* pass, ImageBuffer image, Bucket bucket, u32 packet_width)
+{
+    u32 tile_width = packet_width == 8 ? 4 : 2;
+    u32 tile_height = 2;
+
+    RayPacket packet;
+    packet.width = packet_width;
+    for(u32 j=bucket.ymin; j < bucket.ymax; j += tile_height)
+    {
+        if(pass->cancelled)
+            return;
+
+        for(u32 i=bucket.xmin; i < bucket.xmax; i += tile_width)
+        {
+            for(u32 lane=0; lane < packet_width; ++lane)
+            {
+                u32 x = fmin(i + lane % tile_width, bucket.xmax - 1);
+                u32 y = fmin(j + lane / tile_width, bucket.ymax - 1);
+                float u = x / (float)image.width;
+                float v = y / (float)image.height;
+                Ray r = camera_shoot_ray(pass->camera, u, v);
+                ray_packet_set(packet, lane, r, RAY_MAX_DISTANCE);
+            }
+
+            ray_packet_intersect(scene_tlas, packet, 0.001f);
+
+            for(u32 lane=0; lane < packet_width; ++lane)
+            {
+                u32 x = i + lane % tile_width;
+                u32 y = j + lane / tile_width;
+                if(x >= bucket.xmax || y >= bucket.ymax)
+                    continue;
+
+                if(packet.t[lane] != RAY_MAX_DISTANCE)
+                {
+                    glm::vec3 normal = glm::vec3(packet.normal_x[lane], packet.normal_y[lane], packet.normal_z[lane]);
+                    image.buffer[y * image.width + x] = shade_normal(normal);
+                }
+                else
+                {
+                    image.buffer[y * image.width + x] = 0x0;
+                }
+            }
+        }
+    }
+}
+
+
+// Publishes a finished bucket to the main thread for upload
+void render_request_done(RenderRequest* rr, double start_time)
+{
+    if(!rr->pass->cancelled)
+    {
+        rr->seconds = render_time_now() - start_time;
+#ifdef RAY_STATS
+        rr->stats = ray_stats;
+#endif
+        __atomic_store_n(&rr->state, (u32)BUCKET_RENDERED, __ATOMIC_RELEASE);
+    }
+}
+
+
+// Job pool entry point, renders one RenderRequest
+void raycast(void* args)
+{
+    RenderRequest* rr = (RenderRequest*)args;
+    RenderPass* pass = rr->pass;
+    if(pass->cancelled)
+        return;
+
+    double start_time = render_time_now();
+#ifdef RAY_STATS
+    ray_stats = {};
+#endif
+    ImageBuffer image = rr->image_buffer;
+    Bucket bucket = rr->bucket;
+
+    if(pass->packet_width > 1)
+    {
+        raycast_bucket_packets(pass, image, bucket, pass->packet_width);
+        render_request_done(rr, start_time);
+        return;
+    }
+
+    float u, v;
+    // print("Rendering %ux%u", image.width, image.height);
+    for(u32 j=bucket.ymin; j < bucket.ymax; ++j)
+    {
+        if(pass->cancelled)
+            return;
+
+        for(u32 i=bucket.xmin; i < bucket.xmax; ++i)
+        {
+            u = i / (float)image.width;
+            v = j / (float)image.height;
+
+            HitRecord hit_result;
+            hit_result.t = RAY_MAX_DISTANCE;
+            hit_result.p = glm::vec3(0);
+            hit_result.normal= glm::vec3(0);
+
+            trace_ray(pass->camera, u, v, hit_result);
+
+            if(hit_result.t != RAY_MAX_DISTANCE)
+            {
+                image.buffer[j * image.width + i] = shade_normal(hit_result.normal);
+            }
+            else
+            {
+                image.buffer[j * image.width + i] = 0x0;
+            }
+        }
+    }
+    render_request_done(rr, start_time);
+}
+
+
+// Stops the workers at their next row, they drain the queued buckets
+// without tracing them
+void render_pass_cancel(RenderPass &pass)
+{
+    pass.cancelled = true;
+}
+
+
+bool render_pass_is_idle(RenderPass &pass)
+{
+    return __atomic_load_n(&pass.counter.remaining, __ATOMIC_ACQUIRE) == 0;
+}
+
+
+bool render_pass_is_outdated(RenderPass &pass, Camera &camera, Array &meshes)
+{
+    return pass.camera.position != camera.position ||
+           pass.camera.topLeftCorner != camera.topLeftCorner ||
+           pass.camera.horizontalVector != camera.horizontalVector ||
+           pass.camera.verticalVector != camera.verticalVector ||
+           pass.packet_width != ray_packet_width ||
+           pass.heatmap != render_heatmap ||
+           tlas_is_outdated(scene_tlas, meshes);
+}
+
+
+u32 render_pass_get_tile(RenderPass &pass, Bucket &bucket)
+{
+    return (bucket.ymin / RENDER_BUCKET_SIZE) * pass.tiles_x + bucket.xmin / RENDER_BUCKET_SIZE;
+}
+
+
+// Queues the bucket, or its quarters when its estimated cost is above
+// split_cost
+void render_pass_add_bucket(RenderPass &pass, ImageBuffer image, Bucket bucket, float cost, float split_cost)
+{
+    u32 width = bucket.xmax - bucket.xmin;
+    u32 height = bucket.ymax - bucket.ymin;
+    if (cost > split_cost && width > RENDER_BUCKET_MIN_SIZE && height > RENDER_BUCKET_MIN_SIZE)
+    {
+        u32 xmid = bucket.xmin + width / 2;
+        u32 ymid = bucket.ymin + height / 2;
+        Bucket quarters[4] = {
+            {bucket.xmin, bucket.ymin, xmid, ymid},
+            {xmid, bucket.ymin, bucket.xmax, ymid},
+            {bucket.xmin, ymid, xmid, bucket.ymax},
+            {xmid, ymid, bucket.xmax, bucket.ymax},
+        };
+        for (u32 i=0; i < 4; ++i)
+        {
+            render_pass_add_bucket(pass, image, quarters[i], cost / 4.0f, split_cost);
+        }
+        return;
+    }
+
+    if (pass.request_count == pass.request_capacity)
+    {
+        pass.request_capacity = pass.request_capacity ? pass.request_capacity * 2 : 256;
+        pass.requests = (RenderRequest*)realloc(pass.requests, sizeof(RenderRequest) * pass.request_capacity);
+    }
+
+    RenderRequest &rr = pass.requests[pass.request_count++];
+    rr.image_buffer = image;
+    rr.bucket = bucket;
+    rr.pass = &pass;
+    rr.state = BUCKET_PENDING;
+    rr.seconds = 0;
+    rr.stats = {};
+
+    if (render_bucket_order == BUCKET_ORDER_COST && pass.has_tile_costs)
+    {
+        rr.priority = cost;
+    }
+    else
+    {
+        float dx = (bucket.xmin + bucket.xmax) * 0.5f - image.width * 0.5f;
+        float dy = (bucket.ymin + bucket.ymax) * 0.5f - image.height * 0.5f;
+        rr.priority = -(dx * dx + dy * dy);
+    }
+}
+
+
+int render_request_compare_priority(const void* a, const void* b)
+{
+    float pa = ((RenderRequest*)a)->priority;
+    float pb = ((RenderRequest*)b)->priority;
+    return (pa > pb) - (pa < pb);
+}
+
+
+// Must only be called while the pass is idle
+void render_pass_start(RenderPass &pass, ImageBuffer image, Camera &camera, Array &meshes)
+{
+    prepare_meshes_for_render(meshes);
+
+    u32 tiles_x = ceil((image.width) / (float)RENDER_BUCKET_SIZE);
+    u32 tiles_y = ceil((image.height) / (float)RENDER_BUCKET_SIZE);
+    u32 tile_count = tiles_x * tiles_y;
+    if (pass.tiles_x != tiles_x || pass.tiles_y != tiles_y)
+    {
+        pass.tile_costs = (float*)realloc(pass.tile_costs, sizeof(float) * tile_count);
+        pass.tiles_x = tiles_x;
+        pass.tiles_y = tiles_y;
+        pass.has_tile_costs = false;
+    }
+
+    float split_cost = FLT_MAX;
+    if (pass.has_tile_costs)
+    {
+        float total_cost = 0;
+        for (u32 i=0; i < tile_count; ++i)
+        {
+            total_cost += pass.tile_costs[i];
+        }
+        split_cost = total_cost / tile_count * RENDER_BUCKET_SPLIT_FACTOR;
+    }
+
+    pass.request_count = 0;
+    for (u32 j=0; j < tiles_y; ++j)
+    {
+        for (u32 i=0; i < tiles_x; ++i)
+        {
+            u32 xmin = i*RENDER_BUCKET_SIZE;
+            u32 ymin = j*RENDER_BUCKET_SIZE;
+            u32 xmax = fmin((i+1)*RENDER_BUCKET_SIZE, image.width);
+            u32 ymax = fmin((j+1)*RENDER_BUCKET_SIZE, image.height);
+            Bucket buc = {xmin, ymin, xmax, ymax};
+            float cost = pass.has_tile_costs ? pass.tile_costs[j * tiles_x + i] : 0.0f;
+            render_pass_add_bucket(pass, image, buc, cost, split_cost);
+        }
+    }
+
+    // Workers run their share of a batch newest first, so the buckets are
+    // submitted from the lowest priority up
+    qsort(pass.requests, pass.request_count, sizeof(RenderRequest), render_request_compare_priority);
+
+    pass.camera = camera;
+    pass.packet_width = ray_packet_width;
+    pass.heatmap = render_heatmap;
+    pass.uploaded_count = 0;
+    pass.cancelled = false;
+    pass.started = true;
+    pass.start_time = render_time_now();
+
+    job_pool_submit(job_pool, raycast, pass.requests, sizeof(RenderRequest), pass.request_count, pass.counter);
+}
+
+
+// Blue for the cheapest pixels up to red for the most expensive ones
+u32 render_heatmap_color(float cost)
+{
+    float k = fmin(fmax(cost, 0.0f), 1.0f);
+    u8 colorR = (u8)(k * 255.0f);
+    u8 colorG = (u8)((1.0f - fabs(k * 2.0f - 1.0f)) * 160.0f);
+    u8 colorB = (u8)((1.0f - k) * 255.0f);
+    u8 alpha = 255;
+    return colorR | (colorG << 8) | (colorB << 16) | (alpha << 24);
+}
+
+
+// Keeps the bucket timings of a finished pass to schedule the next one
+void render_pass_store_costs(RenderPass &pass)
+{
+    u32 tile_count = pass.tiles_x * pass.tiles_y;
+    memset(pass.tile_costs, 0, sizeof(float) * tile_count);
+    pass.max_pixel_cost = 0;
+    for (u32 i=0; i < pass.request_count; ++i)
+    {
+        RenderRequest &rr = pass.requests[i];
+        pass.tile_costs[render_pass_get_tile(pass, rr.bucket)] += rr.seconds;
+
+        u32 pixel_count = (rr.bucket.xmax - rr.bucket.xmin) * (rr.bucket.ymax - rr.bucket.ymin);
+        pass.max_pixel_cost = fmax(pass.max_pixel_cost, rr.seconds / pixel_count);
+    }
+    pass.has_tile_costs = true;
+}
+
+
+// Called once every bucket of the pass has been rendered
+void render_pass_finish(RenderPass &pass, ImageBuffer image)
+{
+    double render_seconds = render_time_now() - pass.start_time;
+    u32 ray_count = image.width * image.height;
+    render_mrays_per_second = ray_count / (render_seconds * 1000000.0);
+    render_pass_store_costs(pass);
+}
+
+#endif // RENDERC
@@ -0,0 +1,207 @@
+// Offline renderer, traces OBJ files with the render view's bucket renderer
+// and writes the result to disk. Needs neither a window, GL nor FreeType.
+//
+// render_cli [options] scene.obj [--at x,y,z] [more.obj [--at x,y,z] ...]
+//   -o, --output path     .png, .ppm or .exr (default render.png)
+//   -w, --width n         image width (default 1280)
+//   -h, --height n        image height (default 720)
+//   -t, --threads n       render threads, 0 means one per core, at least 2 (default 0)
+//   --pin                 pin render threads to cores
+//   --camera x,y,z        camera position (default 10,8,10)
+//   --target x,y,z        camera target (default 0,0,0)
+//   --fov degrees         vertical field of view (default 45)
+//   --packet n            ray packet width 1, 4 or 8 (default widest supported)
+//   --at x,y,z            translates the OBJ given right before it
+
+#define HEADLESS
+
+#include <cmath>
+#include <pthread.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include "types.h"
+#include "debug.h"
+#include "ray.c"
+#include "bvh.h"
+#include "camera.h"
+#include "array.h"
+#include "mesh.c"
+#include "tlas.h"
+#include "ray_packet.c"
+#include "job_pool.h"
+#include "render.c"
+
+#include "io/objloader.h"
+#include "asset_registry.h"
+#include "io/image_writer.h"
+
+
+void print_usage()
+{
+    printf("Usage: render_cli [-o out.png|.ppm|.exr] [-w width] [-h height] [-t threads] [--pin]\n"
+           "                  [--camera x,y,z] [--target x,y,z] [--fov degrees] [--packet 1|4|8]\n"
+           "                  scene.obj [--at x,y,z] [more.obj [--at x,y,z] ...]\n");
+}
+
+
+bool parse_vec3(const char* text, glm::vec3 &out)
+{
+    return sscanf(text, "%f,%f,%f", &out.x, &out.y, &out.z) == 3;
+}
+
+
+int main(int argc, char** argv)
+{
+    double start_time = render_time_now();
+
+    const char* output_path = "render.png";
+    u32 width = 1280;
+    u32 height = 720;
+    u32 thread_count = 0;
+    bool pin_threads = false;
+    u32 packet_width = 0;
+
+    Camera camera;
+    camera.position = glm::vec3(10, 8, 10);
+    camera.target = glm::vec3(0, 0, 0);
+    camera.fov = 45.0f;
+
+    Array meshes;
+    array_init(meshes, sizeof(Mesh), argc);
+
+    for (int i=1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        bool has_value = true;
+
+        if ((strcmp(arg, "-o") == 0 || strcmp(arg, "--output") == 0) && value)
+        {
+            output_path = value;
+        }
+        else if ((strcmp(arg, "-w") == 0 || strcmp(arg, "--width") == 0) && value)
+        {
+            width = atoi(value);
+        }
+        else if ((strcmp(arg, "-h") == 0 || strcmp(arg, "--height") == 0) && value)
+        {
+            height = atoi(value);
+        }
+        else if ((strcmp(arg, "-t") == 0 || strcmp(arg, "--threads") == 0) && value)
+        {
+            thread_count = atoi(value);
+        }
+        else if (strcmp(arg, "--packet") == 0 && value)
+        {
+            packet_width = atoi(value);
+            if (packet_width != 1 && packet_width != 4 && packet_width != 8)
+            {
+                print_usage();
+                return 1;
+            }
+        }
+        else if (strcmp(arg, "--fov") == 0 && value)
+        {
+            camera.fov = atof(value);
+        }
+        else if (strcmp(arg, "--camera") == 0 && value && parse_vec3(value, camera.position)) {}
+        else if (strcmp(arg, "--target") == 0 && value && parse_vec3(value, camera.target)) {}
+        else if (strcmp(arg, "--at") == 0 && value && meshes.element_count > 0)
+        {
+            glm::vec3 offset;
+            if (!parse_vec3(value, offset))
+            {
+                print_usage();
+                return 1;
+            }
+            Mesh* mesh = (Mesh*)array_get_index(meshes, meshes.element_count - 1);
+            mesh->model_matrix = glm::translate(mesh->model_matrix, offset);
+        }
+        else
+        {
+            has_value = false;
+            if (strcmp(arg, "--pin") == 0)
+            {
+                pin_threads = true;
+            }
+            else if (arg[0] == '-')
+            {
+                print_usage();
+                return 1;
+            }
+            else
+            {
+                Mesh mesh = asset_registry_create_mesh(arg);
+                if (mesh.geometry->vertex_array_length == 0)
+                {
+                    printf("Failed to load %s\n", arg);
+                    return 1;
+                }
+                array_append(meshes, &mesh);
+            }
+        }
+
+        if (has_value)
+            i++;
+    }
+
+    if (meshes.element_count == 0 || width == 0 || height == 0)
+    {
+        print_usage();
+        return 1;
+    }
+
+    camera.aspect_ratio = (float)width / (float)height;
+    camera_update(camera);
+
+    render_init_packet_width(packet_width);
+
+    job_pool_init(job_pool, thread_count, pin_threads);
+
+    ImageBuffer image;
+    image.width = width;
+    image.height = height;
+    image.buffer = (u32*)calloc(width * height, sizeof(u32));
+
+    RenderPass pass = {};
+    render_pass_start(pass, image, camera, meshes);
+    job_pool_wait(job_pool, pass.counter);
+    render_pass_finish(pass, image);
+
+    // Rows are traced bottom up like the GL texture, image files go top down
+    for (u32 y=0; y < height / 2; ++y)
+    {
+        u32* top = get_image_pixel(image, 0, y);
+        u32* bottom = get_image_pixel(image, 0, height - 1 - y);
+        for (u32 x=0; x < width; ++x)
+        {
+            u32 temp = top[x];
+            top[x] = bottom[x];
+            bottom[x] = temp;
+        }
+    }
+
+    bool written = image_write(output_path, image.buffer, width, height);
+    double wall_seconds = render_time_now() - start_time;
+
+    u32 ray_count = width * height;
+    printf("%s: %ux%u, %u meshes, %u threads, %u wide packets\n",
+           written ? output_path : "not written", width, height, meshes.element_count,
+           job_pool.worker_count, ray_packet_width);
+    printf("Wall time %.3f s, %u rays, %.2f Mrays/s while tracing, %.2f Mrays/s over the wall time\n",
+           wall_seconds, ray_count, render_mrays_per_second, ray_count / (wall_seconds * 1000000.0));
+
+    job_pool_shutdown(job_pool);
+    free(pass.requests);
+    free(pass.tile_costs);
+    free(image.buffer);
+    array_free(meshes);
+    return written ? 0 : 1;
+}
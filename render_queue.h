@@ -0,0 +1,290 @@
+#ifndef RENDERQUEUEH
+#define RENDERQUEUEH
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "types.h"
+#include "array.h"
+#include "hashmap.h"
+#include "shader.h"
+
+// Draw calls collected over a pass and issued grouped by program, then by
+// vertex array, so every program and vertex array is bound once per flush.
+// Uniforms that are the same for the whole pass (VP, camera position, time)
+// are set once per program.
+// Programs with per instance attributes (see shader.h) draw a whole group
+// with one instanced call, the model matrices and picker ids of the group
+// sit next to each other in the queue's instance buffer. Other programs get
+// MVP and picker_id as uniforms and one draw per item.
+
+// Model matrix in locations 3 to 6, picker id in 7
+#define RENDER_QUEUE_INSTANCE_LOCATION 3
+
+
+typedef struct InstanceData
+{
+    glm::mat4 model_matrix;
+    u32 picker_id;  // see picker.h, 0 is nothing
+} InstanceData;
+
+
+typedef struct DrawItem
+{
+    GLuint program;
+    GLenum mode;
+    MeshGeometry* geometry;
+    InstanceData instance;
+} DrawItem;
+
+
+// Items that share program, mode and vertex array
+typedef struct DrawGroup
+{
+    u64 key;
+    u32 item_count;
+    u32 first;       // into the draw order
+    u32 next;        // where render_queue_sort puts the next item
+    DrawItem* item;  // first item of the group, for program and geometry
+} DrawGroup;
+
+
+typedef struct RenderQueue
+{
+    Array items;      // DrawItem in push order
+    Array groups;     // DrawGroup, sorted by key during the flush
+    Array order;      // u32 item indices grouped in draw order
+    Array instances;  // InstanceData in draw order
+    HashMap group_indices;  // key to group index, rebuilt every flush
+    GLuint instance_buffer;
+    u32 instance_capacity;
+
+    // Counted by render_queue_flush, for the overlay and benchmarks
+    u32 draw_count;
+    u32 instance_count;
+    u32 program_changes;
+    u32 vertex_array_changes;
+} RenderQueue;
+
+
+void render_queue_init(RenderQueue &queue)
+{
+    array_init(queue.items, sizeof(DrawItem), 64);
+    array_init(queue.groups, sizeof(DrawGroup), 16);
+    array_init(queue.order, sizeof(u32), 64);
+    array_init(queue.instances, sizeof(InstanceData), 64);
+    hashmap_init(queue.group_indices, HASHMAP_KEY_U64, sizeof(u32), 16);
+
+    glGenBuffers(1, &queue.instance_buffer);
+    debug_gl_created(DEBUG_ALLOC_GL_BUFFER, 1, &queue.instance_buffer);
+    queue.instance_capacity = 0;
+
+    queue.draw_count = 0;
+    queue.instance_count = 0;
+    queue.program_changes = 0;
+    queue.vertex_array_changes = 0;
+}
+
+
+void render_queue_free(RenderQueue &queue)
+{
+    debug_gl_deleted(DEBUG_ALLOC_GL_BUFFER, 1, &queue.instance_buffer);
+    glDeleteBuffers(1, &queue.instance_buffer);
+    array_free(queue.items);
+    array_free(queue.groups);
+    array_free(queue.order);
+    array_free(queue.instances);
+    hashmap_free(queue.group_indices);
+}
+
+
+DrawItem& render_queue_push(RenderQueue &queue, GLuint shader_program_id, Mesh &mesh, GLenum mode)
+{
+    DrawItem &item = *(DrawItem*)array_push(queue.items);
+
+    item.program = shader_program_id;
+    item.mode = mode;
+    item.geometry = mesh.geometry;
+    item.instance.model_matrix = mesh.model_matrix;
+    item.instance.picker_id = 0;
+    return item;
+}
+
+
+// Program first so binds change least, then mode and vertex array
+inline u64 render_queue_group_key(DrawItem &item)
+{
+    return ((u64)item.program << 40) | ((u64)(item.mode & 0xFF) << 32) | item.geometry->vao;
+}
+
+
+int render_queue_compare_groups(const void* a, const void* b)
+{
+    u64 key_a = ((const DrawGroup*)a)->key;
+    u64 key_b = ((const DrawGroup*)b)->key;
+    return key_a < key_b ? -1 : key_a > key_b;
+}
+
+
+// Points the per instance attributes of the bound vertex array at the
+// instances starting at first
+void render_queue_bind_instances(RenderQueue &queue, u32 first)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, queue.instance_buffer);
+    size_t offset = (size_t)first * sizeof(InstanceData);
+    for (u32 i=0; i < 4; ++i)
+    {
+        GLuint location = RENDER_QUEUE_INSTANCE_LOCATION + i;
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                              (GLvoid*)(offset + i * sizeof(glm::vec4)));
+        glVertexAttribDivisor(location, 1);
+    }
+
+    GLuint picker_location = RENDER_QUEUE_INSTANCE_LOCATION + 4;
+    glEnableVertexAttribArray(picker_location);
+    glVertexAttribIPointer(picker_location, 1, GL_UNSIGNED_INT, sizeof(InstanceData),
+                           (GLvoid*)(offset + offsetof(InstanceData, picker_id)));
+    glVertexAttribDivisor(picker_location, 1);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+// Groups the items, counting sort on the group so the order within a group
+// stays the push order
+void render_queue_sort(RenderQueue &queue)
+{
+    u32 item_count = queue.items.element_count;
+    DrawItem* items = (DrawItem*)queue.items.base_ptr;
+
+    // Count the items of every group, consecutive items mostly share a
+    // group so the map is only asked when the key changes
+    array_clear(queue.groups);
+    hashmap_clear(queue.group_indices);
+    u64 last_key = 0;
+    u32* last_group = NULL;
+    for (u32 i=0; i < item_count; ++i)
+    {
+        u64 key = render_queue_group_key(items[i]);
+        if (!last_group || key != last_key)
+        {
+            last_group = (u32*)hashmap_get(queue.group_indices, key);
+            if (!last_group)
+            {
+                DrawGroup group = {key, 0, 0, 0, &items[i]};
+                u32 index = queue.groups.element_count;
+                array_append(queue.groups, &group);
+                last_group = (u32*)hashmap_put(queue.group_indices, key, &index);
+            }
+            last_key = key;
+        }
+        ((DrawGroup*)queue.groups.base_ptr)[*last_group].item_count++;
+    }
+
+    // Sort the few groups and point the map at the sorted positions
+    u32 group_count = queue.groups.element_count;
+    DrawGroup* groups = (DrawGroup*)queue.groups.base_ptr;
+    qsort(groups, group_count, sizeof(DrawGroup), render_queue_compare_groups);
+    u32 first = 0;
+    for (u32 i=0; i < group_count; ++i)
+    {
+        groups[i].first = first;
+        groups[i].next = first;
+        first += groups[i].item_count;
+        hashmap_put(queue.group_indices, groups[i].key, &i);
+    }
+
+    array_resize(queue.order, item_count);
+    array_resize(queue.instances, item_count);
+    u32* order = (u32*)queue.order.base_ptr;
+    InstanceData* instances = (InstanceData*)queue.instances.base_ptr;
+    last_group = NULL;
+    for (u32 i=0; i < item_count; ++i)
+    {
+        u64 key = render_queue_group_key(items[i]);
+        if (!last_group || key != last_key)
+        {
+            last_group = (u32*)hashmap_get(queue.group_indices, key);
+            last_key = key;
+        }
+        u32 position = groups[*last_group].next++;
+        order[position] = i;
+        instances[position] = items[i].instance;
+    }
+}
+
+
+void render_queue_upload_instances(RenderQueue &queue)
+{
+    u32 instance_count = queue.instances.element_count;
+    glBindBuffer(GL_ARRAY_BUFFER, queue.instance_buffer);
+    if (instance_count > queue.instance_capacity)
+        queue.instance_capacity = queue.instances.max_element_count;
+    // NOTE(kk): Respecifying the storage every flush lets the driver hand
+    // out fresh memory instead of waiting for draws still reading the old
+    glBufferData(GL_ARRAY_BUFFER, queue.instance_capacity * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, instance_count * sizeof(InstanceData), queue.instances.base_ptr);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+// Draws everything pushed since the last flush and empties the queue,
+// leaves no program or vertex array bound
+void render_queue_flush(RenderQueue &queue, glm::mat4 vp, glm::vec3 camera_position, float time)
+{
+    if (queue.items.element_count == 0)
+        return;
+
+    render_queue_sort(queue);
+    render_queue_upload_instances(queue);
+
+    DrawItem* items = (DrawItem*)queue.items.base_ptr;
+    DrawGroup* groups = (DrawGroup*)queue.groups.base_ptr;
+    u32* order = (u32*)queue.order.base_ptr;
+    GLuint bound_program = 0;
+    ShaderUniforms* uniforms = NULL;
+    for (u32 i=0; i < queue.groups.element_count; ++i)
+    {
+        DrawGroup &group = groups[i];
+        MeshGeometry &geometry = *group.item->geometry;
+        GLuint program = group.item->program;
+        if (!uniforms || program != bound_program)
+        {
+            glUseProgram(program);
+            bound_program = program;
+            uniforms = shader_get_uniforms(program);
+            glUniformMatrix4fv(uniforms->locations[SHADER_UNIFORM_VP], 1, GL_FALSE, &vp[0][0]);
+            glUniform3fv(uniforms->locations[SHADER_UNIFORM_CAMERA_POSITION], 1, &camera_position[0]);
+            glUniform1f(uniforms->locations[SHADER_UNIFORM_TIME], time);
+            queue.program_changes++;
+        }
+        glBindVertexArray(geometry.vao);
+        queue.vertex_array_changes++;
+
+        if (uniforms->instanced)
+        {
+            render_queue_bind_instances(queue, group.first);
+            mesh_draw_elements_instanced(geometry, group.item->mode, group.item_count);
+            queue.draw_count++;
+        }
+        else
+        {
+            for (u32 j=group.first; j < group.first + group.item_count; ++j)
+            {
+                DrawItem &item = items[order[j]];
+                glm::mat4 mvp = vp * item.instance.model_matrix;
+                glUniformMatrix4fv(uniforms->locations[SHADER_UNIFORM_MVP], 1, GL_FALSE, &mvp[0][0]);
+                glUniform1ui(uniforms->locations[SHADER_UNIFORM_PICKER_ID], item.instance.picker_id);
+                mesh_draw_elements(geometry, item.mode);
+                queue.draw_count++;
+            }
+        }
+        queue.instance_count += group.item_count;
+    }
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+    array_clear(queue.items);
+}
+
+#endif // RENDERQUEUEH
@@ -0,0 +1,270 @@
+#ifndef SELECTIONH
+#define SELECTIONH
+
+#include <float.h>
+
+#include "types.h"
+#include "bitset.h"
+#include "frustum.h"
+#include "tlas.h"
+
+// Picking and marquee selection on the CPU, without an ID pass or a GPU
+// readback. The selector keeps its own TLAS over the meshes, apart from
+// the raytracer's scene_tlas that render workers read, and syncs it when the
+// scene version changes. The editor syncs it every frame, so a click finds
+// it current.
+// Point picks shoot the camera ray through the TLAS and the mesh BLASes.
+// Marquee selection tests instance bounds against the frustum through the
+// marquee rectangle, a TLAS subtree at a time, so subtrees fully inside or
+// outside cost one box test. With SELECTION_TRIANGLES, instances whose box
+// straddles the frustum are refined to their triangles.
+
+// Modes of selection_marquee
+#define SELECTION_BOUNDS 0
+#define SELECTION_TRIANGLES 1
+const char* SelectionMarqueeModeNames[] = {"bounds", "triangles"};
+
+
+// What the marquee reads of an instance
+typedef struct SelectionInstance
+{
+    float bbox[6];
+    BVH* blas;
+    glm::mat4 model_matrix;
+} SelectionInstance;
+
+
+typedef struct Selector
+{
+    TLAS tlas;
+    // NOTE(kk): In the order of the TLAS leaves, not of the meshes, so the
+    // instances of a subtree sit next to each other
+    SelectionInstance* instances;
+    u32* instance_slots;  // mesh index to its place in instances
+    u32 instance_capacity;
+    Array moved;          // u32 mesh indices, scratch of selection_update
+    u32 scene_version;
+    bool valid;
+} Selector;
+
+
+void selection_init(Selector &selector)
+{
+    memset(&selector, 0, sizeof(Selector));
+    array_init(selector.moved, sizeof(u32), 64);
+}
+
+
+void selection_free(Selector &selector)
+{
+    tlas_free(selector.tlas);
+    free(selector.instances);
+    free(selector.instance_slots);
+    array_free(selector.moved);
+    selector.instances = NULL;
+    selector.instance_slots = NULL;
+    selector.instance_capacity = 0;
+    selector.valid = false;
+}
+
+
+void selection_copy_instance(Selector &selector, u32 mesh_index)
+{
+    TLASInstance &tlas_instance = selector.tlas.instances[mesh_index];
+    SelectionInstance &instance = selector.instances[selector.instance_slots[mesh_index]];
+    memcpy(instance.bbox, selector.tlas.instance_bounds + mesh_index * 6, sizeof(instance.bbox));
+    instance.blas = tlas_instance.blas;
+    instance.model_matrix = tlas_instance.model_matrix;
+}
+
+
+// Syncs the TLAS with the meshes when scene_version moved since the last
+// call, cheap otherwise. Only meshes that moved are prepared, moving refits
+// the TLAS and adding or removing meshes rebuilds it.
+void selection_update(Selector &selector, Array &meshes, u32 scene_version)
+{
+    if (selector.valid && selector.scene_version == scene_version)
+        return;
+
+    // NOTE(kk): Adding or removing meshes shifts them to other instances,
+    // all are prepared then
+    TLAS &tlas = selector.tlas;
+    bool same_count = selector.valid && meshes.element_count == tlas.instance_count;
+    array_clear(selector.moved);
+    for (u32 i=0; i < meshes.element_count; ++i)
+    {
+        Mesh* mesh = (Mesh*)array_get_index(meshes, i);
+        if (same_count && tlas.instances[i].blas == mesh->geometry->bvh &&
+            tlas.instances[i].model_matrix == mesh->model_matrix)
+            continue;
+        tlas_prepare_mesh(*mesh);
+        array_append(selector.moved, &i);
+    }
+
+    if (tlas_update(tlas, meshes))
+    {
+        if (tlas.instance_count > selector.instance_capacity)
+        {
+            selector.instance_capacity = tlas.instance_capacity;
+            selector.instances = (SelectionInstance*)realloc(selector.instances,
+                                                             sizeof(SelectionInstance) * selector.instance_capacity);
+            selector.instance_slots = (u32*)realloc(selector.instance_slots, sizeof(u32) * selector.instance_capacity);
+        }
+        for (u32 slot=0; slot < tlas.instance_count; ++slot)
+        {
+            selector.instance_slots[tlas.bvh.triangle_indices[slot]] = slot;
+        }
+        for (u32 i=0; i < tlas.instance_count; ++i)
+        {
+            selection_copy_instance(selector, i);
+        }
+    }
+    else
+    {
+        u32* moved = (u32*)selector.moved.base_ptr;
+        for (u32 i=0; i < selector.moved.element_count; ++i)
+        {
+            selection_copy_instance(selector, moved[i]);
+        }
+    }
+    selector.scene_version = scene_version;
+    selector.valid = true;
+}
+
+
+// Index of the closest mesh along the ray, UINT_MAX when it hits nothing
+u32 selection_pick(Selector &selector, Ray &ray)
+{
+    HitRecord closest_hit;
+    closest_hit.t = FLT_MAX;
+    u32 mesh_index = UINT_MAX;
+    tlas_intersect(selector.tlas, ray, 0.0f, closest_hit, &mesh_index);
+    return mesh_index;
+}
+
+
+// True when any triangle of the instance is in the world space frustum.
+// Only the planes in plane_mask are tested, the instance box is inside the
+// others.
+bool selection_test_triangles(SelectionInstance &instance, Frustum &world_frustum,
+                              u32 plane_mask = FRUSTUM_ALL_PLANES)
+{
+    BVH &blas = *instance.blas;
+    if (blas.triangle_count == 0)
+        return false;
+
+    Frustum frustum = frustum_transform(world_frustum, instance.model_matrix, plane_mask);
+    TriangleStore &triangles = blas.triangles;
+    u32 stack[BVH_STACK_SIZE];
+    u8 stack_masks[BVH_STACK_SIZE];
+    u32 stack_size = 0;
+    stack[stack_size] = 0;
+    stack_masks[stack_size++] = plane_mask;
+    while (stack_size > 0)
+    {
+        BVHNode &node = blas.nodes[stack[--stack_size]];
+        u32 node_mask = stack_masks[stack_size];
+        int test = frustum_test_box(frustum, node.bbox, node_mask);
+        if (test == FRUSTUM_OUTSIDE)
+            continue;
+        if (test == FRUSTUM_INSIDE)
+            return true;
+
+        if (node.triangle_count > 0)
+        {
+            for (u32 i=node.left_first; i < node.left_first + node.triangle_count; ++i)
+            {
+                glm::vec3 a = glm::vec3(triangles.ax[i], triangles.ay[i], triangles.az[i]);
+                glm::vec3 b = a + glm::vec3(triangles.e1x[i], triangles.e1y[i], triangles.e1z[i]);
+                glm::vec3 c = a + glm::vec3(triangles.e2x[i], triangles.e2y[i], triangles.e2z[i]);
+                if (frustum_test_triangle(frustum, a, b, c, node_mask))
+                    return true;
+            }
+        }
+        else
+        {
+            stack[stack_size] = node.left_first;
+            stack_masks[stack_size++] = node_mask;
+            stack[stack_size] = node.left_first + 1;
+            stack_masks[stack_size++] = node_mask;
+        }
+    }
+    return false;
+}
+
+
+// Sets the bit of every instance below the node. The builder partitions the
+// instances in place, so a subtree owns the range from its leftmost to its
+// rightmost leaf.
+void selection_mark_subtree(TLAS &tlas, BVHNode &subtree, Bitset &selected)
+{
+    BVHNode* first = &subtree;
+    while (first->triangle_count == 0)
+        first = &tlas.bvh.nodes[first->left_first];
+    BVHNode* last = &subtree;
+    while (last->triangle_count == 0)
+        last = &tlas.bvh.nodes[last->left_first + 1];
+
+    // NOTE(kk): tlas_update stores mesh i as instance i, so the indices are
+    // mesh indices and the instances themselves are never touched
+    for (u32 i=first->left_first; i < last->left_first + last->triangle_count; ++i)
+    {
+        bitset_set(selected, tlas.bvh.triangle_indices[i]);
+    }
+}
+
+
+// Sets the bits of the meshes in the frustum, selected must hold a bit per
+// mesh. Returns how many bits were set.
+u32 selection_marquee(Selector &selector, Frustum &frustum, u32 mode, Bitset &selected)
+{
+    TLAS &tlas = selector.tlas;
+    if (tlas.instance_count == 0)
+        return 0;
+
+    // NOTE(kk): Children are inside every plane their parent is, so only
+    // the planes the parent straddles go down with them
+    u32 set_count = bitset_count(selected);
+    u32 stack[BVH_STACK_SIZE];
+    u8 stack_masks[BVH_STACK_SIZE];
+    u32 stack_size = 0;
+    stack[stack_size] = 0;
+    stack_masks[stack_size++] = FRUSTUM_ALL_PLANES;
+    while (stack_size > 0)
+    {
+        BVHNode &node = tlas.bvh.nodes[stack[--stack_size]];
+        u32 plane_mask = stack_masks[stack_size];
+        int test = frustum_test_box(frustum, node.bbox, plane_mask);
+        if (test == FRUSTUM_OUTSIDE)
+            continue;
+        if (test == FRUSTUM_INSIDE)
+        {
+            selection_mark_subtree(tlas, node, selected);
+            continue;
+        }
+
+        if (node.triangle_count == 0)
+        {
+            stack[stack_size] = node.left_first;
+            stack_masks[stack_size++] = plane_mask;
+            stack[stack_size] = node.left_first + 1;
+            stack_masks[stack_size++] = plane_mask;
+            continue;
+        }
+
+        for (u32 i=node.left_first; i < node.left_first + node.triangle_count; ++i)
+        {
+            SelectionInstance &instance = selector.instances[i];
+            u32 instance_mask = plane_mask;
+            test = frustum_test_box(frustum, instance.bbox, instance_mask);
+            bool hit = test == FRUSTUM_INSIDE ||
+                       (test == FRUSTUM_INTERSECTS &&
+                        (mode == SELECTION_BOUNDS || selection_test_triangles(instance, frustum, instance_mask)));
+            if (hit)
+                bitset_set(selected, tlas.bvh.triangle_indices[i]);
+        }
+    }
+    return bitset_count(selected) - set_count;
+}
+
+#endif // SELECTIONH
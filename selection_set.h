@@ -0,0 +1,166 @@
+#ifndef SELECTIONSETH
+#define SELECTIONSETH
+
+#include <stdlib.h>
+
+#include "types.h"
+#include "bitset.h"
+
+// Set of mesh indices as a sparse set: members sit packed in dense, in the
+// order they were added unless something was removed, and sparse[member] is
+// where. Test, add, remove and clear are O(1), iterating visits only the
+// members:
+// for (u32 i=0; i < set.count; ++i) set.dense[i]
+// NOTE(kk): sparse is never cleared, an entry only counts when dense points
+// back at it
+
+
+typedef struct SelectionSet
+{
+    u32* dense;
+    u32* sparse;
+    u32 count;
+    u32 capacity;  // members are below this, grows on add
+} SelectionSet;
+
+
+void selection_set_init(SelectionSet &set, u32 capacity)
+{
+    set.capacity = capacity > 0 ? capacity : 1;
+    set.dense = (u32*)malloc(sizeof(u32) * set.capacity);
+    set.sparse = (u32*)malloc(sizeof(u32) * set.capacity);
+    set.count = 0;
+}
+
+
+void selection_set_reserve(SelectionSet &set, u32 capacity)
+{
+    if (capacity <= set.capacity)
+        return;
+
+    if (capacity < set.capacity * 2)
+        capacity = set.capacity * 2;
+    set.dense = (u32*)realloc(set.dense, sizeof(u32) * capacity);
+    set.sparse = (u32*)realloc(set.sparse, sizeof(u32) * capacity);
+    set.capacity = capacity;
+}
+
+
+inline bool selection_set_contains(SelectionSet &set, u32 member)
+{
+    if (member >= set.capacity)
+        return false;
+    u32 position = set.sparse[member];
+    return position < set.count && set.dense[position] == member;
+}
+
+
+// False when it was a member already
+bool selection_set_add(SelectionSet &set, u32 member)
+{
+    if (selection_set_contains(set, member))
+        return false;
+
+    selection_set_reserve(set, member + 1);
+    set.sparse[member] = set.count;
+    set.dense[set.count++] = member;
+    return true;
+}
+
+
+// The last member takes the place of the removed one. False when it wasn't
+// a member.
+bool selection_set_remove(SelectionSet &set, u32 member)
+{
+    if (!selection_set_contains(set, member))
+        return false;
+
+    u32 position = set.sparse[member];
+    u32 last = set.dense[--set.count];
+    set.dense[position] = last;
+    set.sparse[last] = position;
+    return true;
+}
+
+
+// True when it is a member afterwards
+bool selection_set_toggle(SelectionSet &set, u32 member)
+{
+    if (selection_set_remove(set, member))
+        return false;
+    selection_set_add(set, member);
+    return true;
+}
+
+
+void selection_set_clear(SelectionSet &set)
+{
+    set.count = 0;
+}
+
+
+// Adds first to end - 1
+void selection_set_add_range(SelectionSet &set, u32 first, u32 end)
+{
+    if (first >= end)
+        return;
+
+    selection_set_reserve(set, end);
+    for (u32 member=first; member < end; ++member)
+    {
+        selection_set_add(set, member);
+    }
+}
+
+
+// Removes first to end - 1, walks the members or the range, whichever is
+// shorter
+void selection_set_remove_range(SelectionSet &set, u32 first, u32 end)
+{
+    if (first >= end)
+        return;
+
+    if (end - first < set.count)
+    {
+        for (u32 member=first; member < end; ++member)
+        {
+            selection_set_remove(set, member);
+        }
+        return;
+    }
+
+    u32 kept_count = 0;
+    for (u32 i=0; i < set.count; ++i)
+    {
+        u32 member = set.dense[i];
+        if (member >= first && member < end)
+            continue;
+        set.sparse[member] = kept_count;
+        set.dense[kept_count++] = member;
+    }
+    set.count = kept_count;
+}
+
+
+// Adds the set bits, in increasing order
+void selection_set_add_bits(SelectionSet &set, Bitset &bits)
+{
+    selection_set_reserve(set, bits.bit_count);
+    for (u32 member=0; bitset_next(bits, member); ++member)
+    {
+        selection_set_add(set, member);
+    }
+}
+
+
+void selection_set_free(SelectionSet &set)
+{
+    free(set.dense);
+    free(set.sparse);
+    set.dense = NULL;
+    set.sparse = NULL;
+    set.count = 0;
+    set.capacity = 0;
+}
+
+#endif // SELECTIONSETH
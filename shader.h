@@ -0,0 +1,134 @@
+#ifndef SHADERH
+#define SHADERH
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "types.h"
+#include "debug.h"
+#include "hashmap.h"
+
+// Shader programs and their uniform locations. create_shader looks up the
+// uniforms the renderer sets once after linking, drawing asks the cache
+// instead of glGetUniformLocation. Locations are -1 when a program doesn't
+// use the uniform, setting -1 is a no-op in GL.
+// Programs with an instanceModel attribute take their model matrix (and
+// picker id) per instance, see render_queue.h.
+
+#define SHADER_UNIFORM_MVP 0
+#define SHADER_UNIFORM_VP 1
+#define SHADER_UNIFORM_CAMERA_POSITION 2
+#define SHADER_UNIFORM_TIME 3
+#define SHADER_UNIFORM_PICKER_ID 4
+#define SHADER_UNIFORM_COUNT 5
+
+static const char* ShaderUniformNames[] = {"MVP", "VP", "camera_position", "time", "picker_id"};
+
+
+typedef struct ShaderUniforms
+{
+    GLint locations[SHADER_UNIFORM_COUNT];
+    bool instanced;
+} ShaderUniforms;
+
+// Program id to ShaderUniforms
+static HashMap shader_uniforms;
+
+
+// Whole file as a NUL terminated string, NULL when it can't be read
+char* shader_read_file(const char* file_path)
+{
+    FILE* fh = fopen(file_path, "rb");
+    if (!fh)
+        return NULL;
+    fseek(fh, 0, SEEK_END);
+    long size = ftell(fh);
+    fseek(fh, 0, SEEK_SET);
+
+    char* buffer = (char*)malloc(size + 1);
+    size_t read_size = fread(buffer, 1, size, fh);
+    buffer[read_size] = 0;
+    fclose(fh);
+    return buffer;
+}
+
+
+u8 compile_shader(GLuint shader_id, const char* shader_path)
+{
+    print("Compiling shader %s", shader_path);
+    char* shader_buffer = shader_read_file(shader_path);
+    if (!shader_buffer)
+    {
+        print("Can't read %s", shader_path);
+        return 0;
+    }
+
+    glShaderSource(shader_id, 1, &shader_buffer, NULL);
+    glCompileShader(shader_id);
+    free(shader_buffer);
+
+    GLint is_compiled = 0;
+    glGetShaderiv(shader_id, GL_COMPILE_STATUS, &is_compiled);
+    if(is_compiled == GL_FALSE)
+    {
+        GLint max_length = 0;
+        glGetShaderiv(shader_id, GL_INFO_LOG_LENGTH, &max_length);
+        char errorLog[max_length];
+        glGetShaderInfoLog(shader_id, max_length, &max_length, &errorLog[0]);
+        glDeleteShader(shader_id);
+        print("%s", errorLog);
+        return 0;
+    }
+    return 1;
+}
+
+
+void shader_cache_uniforms(GLuint shader_program_id)
+{
+    if (!shader_uniforms.value_size)
+        hashmap_init(shader_uniforms, HASHMAP_KEY_U64, sizeof(ShaderUniforms), 32);
+
+    ShaderUniforms uniforms;
+    for (u32 i=0; i < SHADER_UNIFORM_COUNT; ++i)
+    {
+        uniforms.locations[i] = glGetUniformLocation(shader_program_id, ShaderUniformNames[i]);
+    }
+    uniforms.instanced = glGetAttribLocation(shader_program_id, "instanceModel") >= 0;
+    hashmap_put(shader_uniforms, shader_program_id, &uniforms);
+}
+
+
+// Cached locations of the program, programs that didn't come from
+// create_shader are looked up on first use
+ShaderUniforms* shader_get_uniforms(GLuint shader_program_id)
+{
+    ShaderUniforms* uniforms = (ShaderUniforms*)hashmap_get(shader_uniforms, shader_program_id);
+    if (!uniforms)
+    {
+        shader_cache_uniforms(shader_program_id);
+        uniforms = (ShaderUniforms*)hashmap_get(shader_uniforms, shader_program_id);
+    }
+    return uniforms;
+}
+
+
+GLuint create_shader(const char* vertex_shader, const char* fragment_shader)
+{
+    GLuint shader_program_id = glCreateProgram();
+    GLuint vert_id = glCreateShader(GL_VERTEX_SHADER);
+    u8 rv = compile_shader(vert_id, vertex_shader);
+    assert(rv);
+
+    glAttachShader(shader_program_id, vert_id);
+    GLuint frag_id = glCreateShader(GL_FRAGMENT_SHADER);
+    rv = compile_shader(frag_id, fragment_shader);
+    assert(rv);
+
+    glAttachShader(shader_program_id, frag_id);
+    glLinkProgram(shader_program_id);
+    shader_cache_uniforms(shader_program_id);
+    return shader_program_id;
+}
+
+#endif // SHADERH
@@ -0,0 +1,17 @@
+#version 410
+
+// Unit cube corners, one transform per bounding box
+layout(location = 0) in vec3 vertexPosition_modelspace;
+layout(location = 1) in mat4 bboxTransform;
+
+uniform mat4 VP;
+
+out vec3 fragmentColor;
+out vec3 normal;
+
+void main(){
+    normal = vec3(0, 0, 0);
+    fragmentColor = vec3(1, 0, 0);
+
+    gl_Position = VP * bboxTransform * vec4(vertexPosition_modelspace, 1);
+}
@@ -0,0 +1,25 @@
+#version 410
+
+// Input vertex data, different for all executions of this shader.
+layout(location = 0) in vec3 vertexPosition_modelspace;
+layout(location = 1) in vec3 vertexColor;
+layout(location = 2) in vec3 vertexNormal;
+
+// Per instance, the model matrix takes locations 3 to 6
+layout(location = 3) in mat4 instanceModel;
+layout(location = 7) in uint instancePickerId;
+
+// Values that stay constant for the whole draw.
+uniform mat4 VP;
+
+out vec3 fragmentColor;
+out vec3 normal;
+flat out uint pickerId;
+
+void main(){
+    normal = vertexNormal;
+    fragmentColor = vertexColor;
+    pickerId = instancePickerId;
+
+    gl_Position = VP * instanceModel * vec4(vertexPosition_modelspace, 1);
+}
@@ -0,0 +1,12 @@
+#version 410
+
+flat in uint pickerId;
+
+out vec3 color;
+
+// Shows the ID pass on screen, one color per id
+void main()
+{
+    uint hash = pickerId * 2654435761u;
+    color = vec3(hash & 255u, (hash >> 8) & 255u, (hash >> 16) & 255u) / 255.0;
+}
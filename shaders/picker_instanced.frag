@@ -0,0 +1,13 @@
+#version 410
+
+flat in uint pickerId;
+
+// Integer attachments of the picker framebuffer, mesh id 0 is nothing
+layout(location = 0) out uint meshId;
+layout(location = 1) out uint primitiveId;
+
+void main()
+{
+    meshId = pickerId;
+    primitiveId = uint(gl_PrimitiveID);
+}
@@ -0,0 +1,329 @@
+#ifndef TLASH
+#define TLASH
+
+#include <string.h>
+
+#include "types.h"
+#include "array.h"
+#include "bvh.h"
+
+// Two level scene hierarchy for the raytracer. Bottom level BVHs (BLAS) are
+// shared between meshes with identical vertex data, the top level (TLAS) is
+// a BVH over the world space boxes of mesh_data_array instances.
+
+// When refitting has grown the root surface area past this factor the TLAS
+// is rebuilt from scratch instead
+#define TLAS_REFIT_AREA_LIMIT 2.0f
+
+
+typedef struct BLASEntry
+{
+    u64 hash;
+    u32 vertex_array_length;
+    u32 index_count;
+    float* vertex_positions;
+    u32* indices;
+    BVH* bvh;
+} BLASEntry;
+
+
+typedef struct TLASInstance
+{
+    glm::mat4 model_matrix;
+    glm::mat4 inverse_model_matrix;
+    glm::mat4 inverse_transpose_model_matrix;
+    BVH* blas;
+    u32 mesh_index;
+} TLASInstance;
+
+
+typedef struct TLAS
+{
+    BVH bvh;
+    TLASInstance* instances;
+    float* instance_bounds;
+    u32 instance_count;
+    u32 instance_capacity;
+    float built_area;
+} TLAS;
+
+
+static Array blas_registry;
+
+
+// FNV-1a
+u64 blas_hash_bytes(u64 hash, void* data, size_t size)
+{
+    byte* bytes = (byte*)data;
+    for (size_t i=0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+bool blas_entry_matches(BLASEntry* entry, u64 hash, float* vertex_positions, u32 vertex_array_length,
+                        u32* indices, u32 index_count)
+{
+    if (entry->hash != hash ||
+        entry->vertex_array_length != vertex_array_length ||
+        entry->index_count != index_count)
+        return false;
+
+    if (entry->vertex_positions != vertex_positions &&
+        memcmp(entry->vertex_positions, vertex_positions, vertex_array_length * sizeof(float)) != 0)
+        return false;
+
+    return entry->indices == indices ||
+           memcmp(entry->indices, indices, index_count * sizeof(u32)) == 0;
+}
+
+
+// Hands out the BVH of any previously seen mesh with the same vertex and
+// index data, so copies of one asset are only built once. indices may be
+// NULL for meshes with three vertices per triangle.
+BVH* blas_get_or_build(float* vertex_positions, u32 vertex_array_length, u32* indices, u32 index_count)
+{
+    if (blas_registry.element_size == 0)
+    {
+        array_init(blas_registry, sizeof(BLASEntry), 64);
+    }
+
+    u64 hash = blas_hash_bytes(14695981039346656037ULL, vertex_positions, vertex_array_length * sizeof(float));
+    hash = blas_hash_bytes(hash, indices, index_count * sizeof(u32));
+    for (u32 i=0; i < blas_registry.element_count; ++i)
+    {
+        BLASEntry* entry = (BLASEntry*)array_get_index(blas_registry, i);
+        if (blas_entry_matches(entry, hash, vertex_positions, vertex_array_length, indices, index_count))
+            return entry->bvh;
+    }
+
+    BLASEntry entry;
+    entry.hash = hash;
+    entry.vertex_array_length = vertex_array_length;
+    entry.index_count = index_count;
+    entry.vertex_positions = vertex_positions;
+    entry.indices = indices;
+    u32 triangle_count = indices ? index_count / 3 : vertex_array_length / 9;
+    entry.bvh = bvh_build(vertex_positions, indices, triangle_count);
+    array_append(blas_registry, &entry);
+    return entry.bvh;
+}
+
+
+void tlas_get_instance_bounds(float* object_bbox, glm::mat4 &model_matrix, float* world_bbox)
+{
+    bvh_bbox_reset(world_bbox);
+    for (u32 corner=0; corner < 8; ++corner)
+    {
+        glm::vec4 p = glm::vec4(object_bbox[(corner & 1) ? 3 : 0],
+                                object_bbox[(corner & 2) ? 4 : 1],
+                                object_bbox[(corner & 4) ? 5 : 2],
+                                1.0f);
+        glm::vec3 world = glm::vec3(model_matrix * p);
+        bvh_bbox_grow(world_bbox, &world[0]);
+    }
+}
+
+
+// True when tlas_update would change anything, lets a caller that shares
+// the TLAS with other threads find out before touching it
+bool tlas_is_outdated(TLAS &tlas, Array &meshes)
+{
+    if (meshes.element_count != tlas.instance_count || tlas.bvh.nodes == NULL)
+        return true;
+
+    for (u32 i=0; i < meshes.element_count; ++i)
+    {
+        Mesh* mesh = (Mesh*)array_get_index(meshes, i);
+        TLASInstance* instance = &tlas.instances[i];
+        if (instance->blas != mesh->geometry->bvh || instance->model_matrix != mesh->model_matrix)
+            return true;
+    }
+    return false;
+}
+
+
+// Inverse matrices and BLAS of the mesh, what tlas_update expects to be
+// current
+void tlas_prepare_mesh(Mesh &mesh)
+{
+    mesh.inverse_model_matrix = glm::inverse(mesh.model_matrix);
+    mesh.inverse_transpose_model_matrix = glm::inverseTranspose(mesh.model_matrix);
+
+    // Geometry never changes after load, so BLASes are built only once
+    // and shared by every mesh with the same vertex data
+    MeshGeometry* geometry = mesh.geometry;
+    if (!geometry->bvh)
+    {
+        geometry->bvh = blas_get_or_build(geometry->vertex_positions, geometry->vertex_array_length,
+                                          geometry->indices, geometry->index_count);
+    }
+}
+
+
+// Syncs the TLAS with the meshes. Adding or removing meshes rebuilds it,
+// moving them only refits the boxes of the instances whose matrix changed.
+// Returns true when it rebuilt, the leaves may hold other instances then.
+bool tlas_update(TLAS &tlas, Array &meshes)
+{
+    u32 mesh_count = meshes.element_count;
+    bool rebuild = mesh_count != tlas.instance_count || tlas.bvh.nodes == NULL;
+
+    if (mesh_count > tlas.instance_capacity)
+    {
+        tlas.instance_capacity = mesh_count * 2;
+        tlas.instances = (TLASInstance*)realloc(tlas.instances, sizeof(TLASInstance) * tlas.instance_capacity);
+        tlas.instance_bounds = (float*)realloc(tlas.instance_bounds, sizeof(float) * 6 * tlas.instance_capacity);
+    }
+
+    bool moved = false;
+    for (u32 i=0; i < mesh_count; ++i)
+    {
+        Mesh* mesh = (Mesh*)array_get_index(meshes, i);
+        TLASInstance* instance = &tlas.instances[i];
+
+        if (!rebuild)
+        {
+            if (instance->blas == mesh->geometry->bvh && instance->model_matrix == mesh->model_matrix)
+                continue;
+            if (instance->blas != mesh->geometry->bvh)
+                rebuild = true;
+        }
+
+        instance->model_matrix = mesh->model_matrix;
+        instance->inverse_model_matrix = mesh->inverse_model_matrix;
+        instance->inverse_transpose_model_matrix = mesh->inverse_transpose_model_matrix;
+        instance->blas = mesh->geometry->bvh;
+        instance->mesh_index = i;
+        tlas_get_instance_bounds(mesh->geometry->bbox, mesh->model_matrix, tlas.instance_bounds + i * 6);
+        moved = true;
+    }
+    tlas.instance_count = mesh_count;
+
+    if (!rebuild && moved)
+    {
+        bvh_refit(tlas.bvh, tlas.instance_bounds);
+        if (bvh_bbox_area(tlas.bvh.nodes[0].bbox) > tlas.built_area * TLAS_REFIT_AREA_LIMIT)
+            rebuild = true;
+    }
+
+    if (rebuild)
+    {
+        bvh_build_from_bounds(tlas.bvh, tlas.instance_bounds, mesh_count);
+        tlas.built_area = bvh_bbox_area(tlas.bvh.nodes[0].bbox);
+    }
+    return rebuild;
+}
+
+
+// True when the instance was hit closer than closest_hit
+bool tlas_intersect_instance(TLASInstance* instance, Ray &r, float t_min, HitRecord &closest_hit)
+{
+    glm::mat4 &inverse_model_matrix = instance->inverse_model_matrix;
+
+    // Modify the ray to intersect transformed mesh data
+    Ray changed_ray;
+    changed_ray.origin = glm::vec3(inverse_model_matrix * glm::vec4(r.origin, 1));
+
+    // Homogenous coordinate must be set to 0 for vectors
+    /*https://online.ucsd.edu/courses/course-v1:CSE+168X+2020-SP/courseware/Unit_3/L10/1?activate_block_id=block-v1%3ACSE%2B168X%2B2020-SP%2Btype%40html%2Bblock%40video_l10v1*/
+    changed_ray.direction = glm::vec3(inverse_model_matrix * glm::vec4(r.direction, 0));
+
+    // NOTE(kk): The ray parameter is preserved by the affine transform, so
+    // the closest world space hit so far can cull the object space traversal
+    HitRecord this_hit_record;
+    this_hit_record.t = closest_hit.t;
+    this_hit_record.p = glm::vec3(0);
+    this_hit_record.normal= glm::vec3(0);
+    bool intersect = bvh_intersect(*instance->blas, changed_ray, t_min, closest_hit.t, this_hit_record);
+
+    if (intersect && this_hit_record.t < closest_hit.t)
+    {
+        closest_hit.t = this_hit_record.t;
+        closest_hit.p = glm::vec3(instance->model_matrix * glm::vec4(this_hit_record.p, 1));
+        closest_hit.normal = glm::normalize(glm::vec3(instance->inverse_transpose_model_matrix * glm::vec4(this_hit_record.normal, 1)));
+        return true;
+    }
+    return false;
+}
+
+
+// Closest hit of a world space ray against all instances, closest_hit.t
+// must be initialized to the maximum distance. hit_mesh_index gets the
+// mesh_index of the hit instance when given.
+bool tlas_intersect(TLAS &tlas, Ray &ray, float t_min, HitRecord &closest_hit, u32* hit_mesh_index = NULL)
+{
+    if (tlas.instance_count == 0)
+        return false;
+
+    float start_t = closest_hit.t;
+    glm::vec3 inverse_direction = glm::vec3(1.0f / ray.direction.x,
+                                            1.0f / ray.direction.y,
+                                            1.0f / ray.direction.z);
+    u32 stack[BVH_STACK_SIZE];
+    u32 stack_size = 0;
+
+    BVHNode* node = &tlas.bvh.nodes[0];
+    if (ray_intersect_box_distance(ray, inverse_direction, node->bbox, closest_hit.t) == FLT_MAX)
+        return false;
+
+    while (true)
+    {
+        RAY_STATS_ADD(nodes_visited, 1);
+        if (node->triangle_count > 0)
+        {
+            for (u32 i=0; i < node->triangle_count; ++i)
+            {
+                u32 instance_index = tlas.bvh.triangle_indices[node->left_first + i];
+                TLASInstance* instance = &tlas.instances[instance_index];
+                if (tlas_intersect_instance(instance, ray, t_min, closest_hit) && hit_mesh_index)
+                    *hit_mesh_index = instance->mesh_index;
+            }
+
+            if (stack_size == 0)
+                break;
+            node = &tlas.bvh.nodes[stack[--stack_size]];
+            continue;
+        }
+
+        u32 near_index = node->left_first;
+        u32 far_index = node->left_first + 1;
+        float near_distance = ray_intersect_box_distance(ray, inverse_direction, tlas.bvh.nodes[near_index].bbox, closest_hit.t);
+        float far_distance = ray_intersect_box_distance(ray, inverse_direction, tlas.bvh.nodes[far_index].bbox, closest_hit.t);
+        if (far_distance < near_distance)
+        {
+            u32 temp_index = near_index;
+            near_index = far_index;
+            far_index = temp_index;
+            swapf(near_distance, far_distance);
+        }
+
+        if (near_distance == FLT_MAX)
+        {
+            if (stack_size == 0)
+                break;
+            node = &tlas.bvh.nodes[stack[--stack_size]];
+        }
+        else
+        {
+            node = &tlas.bvh.nodes[near_index];
+            if (far_distance != FLT_MAX)
+                stack[stack_size++] = far_index;
+        }
+    }
+    return closest_hit.t < start_t;
+}
+
+void tlas_free(TLAS &tlas)
+{
+    free(tlas.bvh.nodes);
+    free(tlas.bvh.triangle_indices);
+    free(tlas.instances);
+    free(tlas.instance_bounds);
+    memset(&tlas, 0, sizeof(TLAS));
+}
+
+#endif // TLASH
@@ -0,0 +1,152 @@
+#ifndef TRIANGLESTOREH
+#define TRIANGLESTOREH
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+
+// Render time copy of mesh triangles for the intersectors. Every triangle
+// is stored as its first vertex, the two edges from it and the normalized
+// geometric normal, one array per component so SIMD code can load them
+// directly. The GL side vertex buffers are left untouched.
+
+#define TRIANGLE_STORE_ALIGNMENT 32
+#define TRIANGLE_STORE_STREAM_COUNT 12
+
+
+typedef struct TriangleStore
+{
+    float* ax;
+    float* ay;
+    float* az;
+    float* e1x;
+    float* e1y;
+    float* e1z;
+    float* e2x;
+    float* e2y;
+    float* e2z;
+    float* nx;
+    float* ny;
+    float* nz;
+    u32 triangle_count;
+    void* memory;
+} TriangleStore;
+
+
+// Corner of a triangle in an indexed mesh, or in a flat one with three
+// vertices per triangle when indices is NULL
+inline float* triangle_get_vertex(float* vertex_positions, u32* indices, u32 triangle_index, u32 corner)
+{
+    if (indices)
+        return vertex_positions + indices[triangle_index * 3 + corner] * 3;
+    return vertex_positions + (triangle_index * 3 + corner) * 3;
+}
+
+
+// Triangles are written in the given order, BVH builds pass their leaf
+// order so each leaf is one contiguous block in every stream
+void triangle_store_build(TriangleStore &store, float* vertex_positions, u32* indices,
+                          u32* order, u32 triangle_count)
+{
+    // Pad each stream to a whole number of 8 wide blocks so every stream
+    // starts on a 32 byte boundary
+    u32 stride = (triangle_count + 7) & ~7u;
+    if (stride == 0)
+        stride = 8;
+
+    void* memory = NULL;
+    if (posix_memalign(&memory, TRIANGLE_STORE_ALIGNMENT, sizeof(float) * stride * TRIANGLE_STORE_STREAM_COUNT) != 0)
+    {
+        print("Failed to allocate triangle store for %u triangles", triangle_count);
+        memset(&store, 0, sizeof(store));
+        return;
+    }
+
+    float* streams = (float*)memory;
+    memset(streams, 0, sizeof(float) * stride * TRIANGLE_STORE_STREAM_COUNT);
+    store.memory = memory;
+    store.triangle_count = triangle_count;
+    store.ax = streams + 0 * stride;
+    store.ay = streams + 1 * stride;
+    store.az = streams + 2 * stride;
+    store.e1x = streams + 3 * stride;
+    store.e1y = streams + 4 * stride;
+    store.e1z = streams + 5 * stride;
+    store.e2x = streams + 6 * stride;
+    store.e2y = streams + 7 * stride;
+    store.e2z = streams + 8 * stride;
+    store.nx = streams + 9 * stride;
+    store.ny = streams + 10 * stride;
+    store.nz = streams + 11 * stride;
+
+    for (u32 i=0; i < triangle_count; ++i)
+    {
+        u32 t = order ? order[i] : i;
+        float* a = triangle_get_vertex(vertex_positions, indices, t, 0);
+        float* b = triangle_get_vertex(vertex_positions, indices, t, 1);
+        float* c = triangle_get_vertex(vertex_positions, indices, t, 2);
+        glm::vec3 A = glm::vec3(a[0], a[1], a[2]);
+        glm::vec3 AB = glm::vec3(b[0], b[1], b[2]) - A;
+        glm::vec3 AC = glm::vec3(c[0], c[1], c[2]) - A;
+        glm::vec3 normal = glm::normalize(glm::cross(AB, AC));
+
+        store.ax[i] = A.x;
+        store.ay[i] = A.y;
+        store.az[i] = A.z;
+        store.e1x[i] = AB.x;
+        store.e1y[i] = AB.y;
+        store.e1z[i] = AB.z;
+        store.e2x[i] = AC.x;
+        store.e2y[i] = AC.y;
+        store.e2z[i] = AC.z;
+        store.nx[i] = normal.x;
+        store.ny[i] = normal.y;
+        store.nz[i] = normal.z;
+    }
+}
+
+
+void triangle_store_free(TriangleStore &store)
+{
+    free(store.memory);
+    memset(&store, 0, sizeof(store));
+}
+
+
+// Moller-Trumbore against a stored triangle, same acceptance rules as
+// ray_intersect_triangle without recomputing the edges and normal
+bool triangle_store_intersect(TriangleStore &store, u32 i, Ray &ray, float t_min, float t_max, HitRecord &rec)
+{
+    glm::vec3 AB = glm::vec3(store.e1x[i], store.e1y[i], store.e1z[i]);
+    glm::vec3 AC = glm::vec3(store.e2x[i], store.e2y[i], store.e2z[i]);
+
+    glm::vec3 rayCrossEdge = glm::cross(ray.direction, AC);
+    float det = glm::dot(AB, rayCrossEdge);
+    if (det > -EPSILON && det < EPSILON)
+        return false;
+
+    float inv_det = 1.0f / det;
+
+    glm::vec3 rayToVert = ray.origin - glm::vec3(store.ax[i], store.ay[i], store.az[i]);
+    float u = glm::dot(rayToVert, rayCrossEdge) * inv_det;
+    if (u < 0.0f || u > 1.0f)
+        return false;
+
+    glm::vec3 qvec = glm::cross(rayToVert, AB);
+    float v = glm::dot(ray.direction, qvec) * inv_det;
+    if (v < 0.0f || u + v > 1.0f)
+        return false;
+
+    float distance = glm::dot(AC, qvec) * inv_det;
+    if (distance > t_min && distance < t_max)
+    {
+        rec.p = ray_point_at_distance(ray, distance);
+        rec.normal = glm::vec3(store.nx[i], store.ny[i], store.nz[i]);
+        rec.t = distance;
+        return true;
+    }
+    return false;
+}
+
+#endif // TRIANGLESTOREH
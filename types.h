@@ -9,6 +9,7 @@ typedef uint16_t u16;
 typedef uint8_t u8;
 typedef uint8_t byte;
 
+typedef int64_t i64;
 typedef int32_t i32;
 typedef int16_t i16;
 typedef int8_t i8;